@@ -0,0 +1,186 @@
+#include "allocationcounter.h"
+
+#include <QAtomicInteger>
+#include <QDebug>
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+thread_local quint64 allocations = 0;
+// 预期内的分配，外层检查时扣除
+thread_local quint64 expected = 0;
+
+QAtomicInteger<quint64> scopes = 0;
+QAtomicInteger<quint64> dirtyScopes = 0;
+QAtomicInteger<quint64> worst = 0;
+}
+
+#ifdef DRAWINGBOARD_ALLOC_COUNTER
+
+#if defined(__GLIBC__)
+// Qt 容器和 QImage 的数据直接用 malloc 分配，glibc 上一并替换才能统计到
+extern "C" {
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t n, std::size_t size);
+void* __libc_realloc(void* p, std::size_t size);
+
+void* malloc(std::size_t size)
+{
+    ++allocations;
+    return __libc_malloc(size);
+}
+
+void* calloc(std::size_t n, std::size_t size)
+{
+    ++allocations;
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, std::size_t size)
+{
+    ++allocations;
+    return __libc_realloc(p, size);
+}
+}
+#endif
+
+namespace {
+void* allocate(std::size_t size)
+{
+#if !defined(__GLIBC__)
+    ++allocations;
+#endif
+    for(;;)
+    {
+        void* p = std::malloc(size ? size : 1);
+        if(p)
+        {
+            return p;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if(!handler)
+        {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+}
+
+void* operator new(std::size_t size)
+{
+    return allocate(size);
+}
+
+void* operator new[](std::size_t size)
+{
+    return allocate(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    try
+    {
+        return allocate(size);
+    }
+    catch(...)
+    {
+        return nullptr;
+    }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return operator new(size, std::nothrow);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+#endif
+
+namespace AllocationCounter {
+
+bool enabled()
+{
+#ifdef DRAWINGBOARD_ALLOC_COUNTER
+    return true;
+#else
+    return false;
+#endif
+}
+
+quint64 count()
+{
+    return allocations;
+}
+
+QJsonObject toJson()
+{
+    QJsonObject obj;
+    obj.insert("enabled", enabled());
+    obj.insert("scopes", qint64(scopes.loadRelaxed()));
+    obj.insert("dirty", qint64(dirtyScopes.loadRelaxed()));
+    obj.insert("worst", qint64(worst.loadRelaxed()));
+    return obj;
+}
+
+}
+
+AllocationFreeScope::AllocationFreeScope(const char* name)
+    :name(name)
+    ,start(allocations)
+    ,expectedStart(expected)
+{}
+
+AllocationFreeScope::~AllocationFreeScope()
+{
+    const quint64 n = (allocations - start) - (expected - expectedStart);
+    scopes.fetchAndAddRelaxed(1);
+    if(n == 0)
+    {
+        return;
+    }
+
+    dirtyScopes.fetchAndAddRelaxed(1);
+    if(n > worst.loadRelaxed())
+    {
+        worst.storeRelaxed(n);
+    }
+
+    static const bool fatal = qEnvironmentVariableIntValue("DRAWINGBOARD_ALLOC_FATAL") != 0;
+    if(fatal)
+    {
+        qFatal("%llu heap allocations in %s", static_cast<unsigned long long>(n), name);
+    }
+    qWarning() << n << "heap allocations in" << name;
+}
+
+AllocationExpectedScope::AllocationExpectedScope()
+    :start(allocations)
+    ,expectedStart(expected)
+{}
+
+AllocationExpectedScope::~AllocationExpectedScope()
+{
+    // 嵌套时内层已经计入，只补上本层新增的部分
+    expected = expectedStart + (allocations - start);
+}
@@ -0,0 +1,52 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <QJsonObject>
+#include <QtGlobal>
+
+// 统计热路径上的堆分配，用于检查移动鼠标和绘制时没有分配
+// 只有打开 DRAWINGBOARD_ALLOC_COUNTER 编译时才替换全局 operator new（glibc 上还包括 malloc），
+// 否则下面的宏为空，不影响正常构建
+namespace AllocationCounter {
+    bool enabled();
+    // 当前线程累计的分配次数
+    quint64 count();
+    // 有分配的事件数等，供控制套接字的 stats 使用
+    QJsonObject toJson();
+}
+
+// 作用域内出现预期之外的分配时打印警告；
+// 设置环境变量 DRAWINGBOARD_ALLOC_FATAL=1 时直接终止，供自动化检查使用
+class AllocationFreeScope
+{
+public:
+    explicit AllocationFreeScope(const char* name);
+    ~AllocationFreeScope();
+
+private:
+    const char* name;
+    quint64 start;
+    quint64 expectedStart;
+};
+
+// 新建瓦片、写时复制等每笔只发生一次的分配不计入外层的检查
+class AllocationExpectedScope
+{
+public:
+    AllocationExpectedScope();
+    ~AllocationExpectedScope();
+
+private:
+    quint64 start;
+    quint64 expectedStart;
+};
+
+#ifdef DRAWINGBOARD_ALLOC_COUNTER
+#define ALLOCATION_FREE_SCOPE(name) AllocationFreeScope allocationFreeScope_(name)
+#define ALLOCATION_EXPECTED_SCOPE() AllocationExpectedScope allocationExpectedScope_
+#else
+#define ALLOCATION_FREE_SCOPE(name)
+#define ALLOCATION_EXPECTED_SCOPE()
+#endif
+
+#endif // ALLOCATIONCOUNTER_H
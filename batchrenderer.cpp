@@ -0,0 +1,464 @@
+#include "batchrenderer.h"
+
+#include "config.h"
+#include "controlserver.h"
+#include "dbapplication.h"
+
+#include <QAtomicInteger>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutex>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+
+#include <cstring>
+
+namespace {
+// 记录中每行通常只有一个点，一笔的采样攒够这么多再化简，与画板每帧化简一批的效果相近
+const int BATCH_POINTS = 256;
+// --check 时看得出的差值，与化简容差无关：轮廓偏移约四分之一像素时边缘覆盖率变化 64 级，另留取整误差；
+// 默认容差 0.25 下曲线的差值都在此以内，容差再大时很快超出
+const int VISIBLE_LEVELS = 72;
+// --check 时差值超过 VISIBLE_LEVELS 的像素占有笔迹像素的比例上限，千分比
+const int DIFFERING_PERMILLE = 5;
+
+// 两张同尺寸图片逐通道比较，返回最大差值；differing 为差值超过 VISIBLE_LEVELS 的像素数，
+// painted 为任意一张中不透明度不为 0 的像素数
+int compare(const QImage& a, const QImage& b, qint64* differing, qint64* painted)
+{
+    int worst = 0;
+    *differing = 0;
+    *painted = 0;
+    for(int y = 0; y < a.height(); ++y)
+    {
+        const QRgb* pa = reinterpret_cast<const QRgb*>(a.constScanLine(y));
+        const QRgb* pb = reinterpret_cast<const QRgb*>(b.constScanLine(y));
+        for(int x = 0; x < a.width(); ++x)
+        {
+            if(qAlpha(pa[x]) || qAlpha(pb[x]))
+            {
+                ++*painted;
+            }
+            if(pa[x] == pb[x])
+            {
+                continue;
+            }
+            int diff = qAbs(qAlpha(pa[x]) - qAlpha(pb[x]));
+            diff = qMax(diff, qAbs(qRed(pa[x]) - qRed(pb[x])));
+            diff = qMax(diff, qAbs(qGreen(pa[x]) - qGreen(pb[x])));
+            diff = qMax(diff, qAbs(qBlue(pa[x]) - qBlue(pb[x])));
+            if(diff > VISIBLE_LEVELS)
+            {
+                ++*differing;
+            }
+            worst = qMax(worst, diff);
+        }
+    }
+    return worst;
+}
+}
+
+JournalRenderer::JournalRenderer(const QSize& size, const QColor& color, int width)
+    :layer(size, MemoryStats::BOARD)
+    ,staging(size, MemoryStats::STAGING)
+    ,color(color)
+    ,width(width)
+{}
+
+bool JournalRenderer::render(QIODevice* input, QString* error)
+{
+    int lineNumber = 0;
+    while(!input->atEnd())
+    {
+        ++lineNumber;
+        const QByteArray line = input->readLine().trimmed();
+        // 空行和 # 开头的注释跳过
+        if(line.isEmpty() || line.startsWith('#'))
+        {
+            continue;
+        }
+        if(!apply(line, error))
+        {
+            *error = QString("line %1: %2").arg(lineNumber).arg(*error);
+            return false;
+        }
+    }
+
+    // 记录在笔画中途结束时按抬笔处理
+    release();
+    return true;
+}
+
+void JournalRenderer::setSimplifyTolerance(qreal pixels)
+{
+    tolerance = pixels;
+}
+
+QImage JournalRenderer::image() const
+{
+    return layer.image();
+}
+
+qint64 JournalRenderer::points() const
+{
+    return count;
+}
+
+qint64 JournalRenderer::keptPoints() const
+{
+    return qint64(simplifier.outputPoints());
+}
+
+bool JournalRenderer::apply(const QByteArray& line, QString* error)
+{
+    const QList<QByteArray> args = line.simplified().split(' ');
+    const QByteArray& cmd = args.first();
+
+    if(cmd == "pen")
+    {
+        if(!selectPen(QString::fromUtf8(args.value(1))))
+        {
+            *error = "unsupported pen " + QString::fromUtf8(args.value(1));
+            return false;
+        }
+        return true;
+    }
+    if(cmd == "color")
+    {
+        const QColor c(QString::fromLatin1(args.value(1)));
+        if(!c.isValid())
+        {
+            *error = "invalid color";
+            return false;
+        }
+        color = c;
+        return true;
+    }
+    if(cmd == "size")
+    {
+        bool ok = false;
+        const int size = args.value(1).toInt(&ok);
+        if(!ok || size < 1 || size > 100)
+        {
+            *error = "size out of range";
+            return false;
+        }
+        width = size;
+        return true;
+    }
+    if(cmd == "down" || cmd == "move" || cmd == "up" || cmd == "stroke")
+    {
+        if(!ControlServer::parsePoints(args, 1, &parsed) || ((cmd == "down" || cmd == "up") && parsed.size() != 1))
+        {
+            *error = "invalid points";
+            return false;
+        }
+        count += parsed.size();
+
+        if(cmd == "down")
+        {
+            press(parsed.first());
+        }
+        else if(cmd == "move")
+        {
+            move(parsed);
+        }
+        else if(cmd == "up")
+        {
+            release();
+        }
+        else
+        {
+            press(parsed.takeFirst());
+            move(parsed);
+            release();
+        }
+        return true;
+    }
+    if(cmd == "clear")
+    {
+        release();
+        layer.clear();
+        return true;
+    }
+    // 只影响窗口或会话的命令离线时没有意义
+    if(cmd == "open" || cmd == "close" || cmd == "undo" || cmd == "redo" || cmd == "export" || cmd == "stats" || cmd == "trace" || cmd == "latency")
+    {
+        return true;
+    }
+
+    *error = "unknown command " + QString::fromUtf8(cmd);
+    return false;
+}
+
+bool JournalRenderer::selectPen(const QString& name)
+{
+    release();
+    if(name != "pencil" && name != "eraser" && name != "highlighter" && name != "laser")
+    {
+        return false;
+    }
+    eraser = name == "eraser";
+    highlighter = name == "highlighter";
+    laser = name == "laser";
+    return true;
+}
+
+void JournalRenderer::press(const QPointF& pos)
+{
+    release();
+    pressed = true;
+    last = pos;
+
+    // 落笔处画一个点
+    batch.resize(1);
+    batch[0] = InputSample();
+    batch[0].pos = pos;
+    draw(batch);
+    batch.resize(0);
+}
+
+void JournalRenderer::move(const QVector<QPointF>& points)
+{
+    if(!pressed)
+    {
+        return;
+    }
+
+    for(const QPointF& pos : points)
+    {
+        InputSample sample;
+        sample.pos = pos;
+        batch.append(sample);
+    }
+    // 逐行化简时每批只有一两个点，化简不起作用
+    if(batch.size() >= BATCH_POINTS)
+    {
+        drawBatch();
+    }
+}
+
+void JournalRenderer::release()
+{
+    if(!pressed)
+    {
+        return;
+    }
+    drawBatch();
+    pressed = false;
+    flushStaging();
+}
+
+void JournalRenderer::drawBatch()
+{
+    if(batch.isEmpty())
+    {
+        return;
+    }
+    draw(batch);
+    last = batch.last().pos;
+    batch.resize(0);
+}
+
+void JournalRenderer::draw(const QVector<InputSample>& samples)
+{
+    if(laser)
+    {
+        return;
+    }
+
+    const bool stage = StrokeRasterizer::needsStaging(highlighter, eraser, color.alpha());
+    if(stage)
+    {
+        stagingMultiply = highlighter;
+    }
+    simplifier.simplify(last, samples, tolerance, width / 2, &simplified);
+    // 只有导出范围内的像素会写入结果
+    const QRect dirty = rasterizer.rasterize(last, simplified, width, QRect(QPoint(0, 0), layer.size()));
+    if(dirty.isEmpty())
+    {
+        return;
+    }
+
+    const StrokeRasterizer::Mode mode = StrokeRasterizer::modeFor(highlighter, eraser, stage);
+    Layer* target = stage ? &staging : &layer;
+    target->forEachTile(dirty, mode != StrokeRasterizer::Clear, [this, mode](QImage* tile, const QPoint& origin){
+        rasterizer.composite(tile, origin, color, mode);
+    });
+}
+
+void JournalRenderer::flushStaging()
+{
+    if(staging.isEmpty())
+    {
+        return;
+    }
+    if(stagingMultiply)
+    {
+        layer.multiply(staging);
+    }
+    else
+    {
+        layer.merge(staging);
+    }
+    staging.clear();
+}
+
+namespace BatchRender {
+
+bool requested(int argc, char** argv)
+{
+    for(int i = 1; i < argc; ++i)
+    {
+        if(std::strcmp(argv[i], "--render") == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+int run(const QStringList& arguments)
+{
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("render", "Render input journals to PNG without a window."));
+    parser.addOption(QCommandLineOption({"o", "output"}, "Output directory, defaults to the input's directory.", "dir"));
+    parser.addOption(QCommandLineOption("size", "Canvas size.", "WxH", "1920x1080"));
+    parser.addOption(QCommandLineOption({"j", "jobs"}, "Worker threads.", "n", QString::number(QThread::idealThreadCount())));
+    parser.addOption(QCommandLineOption("simplify", "Stroke simplification tolerance in pixels, 0 to disable.", "px"));
+    parser.addOption(QCommandLineOption("check", "Also render without simplification and fail on visible differences."));
+    parser.addPositionalArgument("inputs", "Journal files or directories of *.journal files.", "<input>...");
+    parser.process(arguments);
+
+    const QStringList size = parser.value("size").split('x');
+    const QSize canvasSize(size.value(0).toInt(), size.value(1).toInt());
+    if(size.size() != 2 || canvasSize.isEmpty())
+    {
+        err << "invalid size " << parser.value("size") << Qt::endl;
+        return 1;
+    }
+
+    QFileInfoList inputs;
+    for(const QString& path : parser.positionalArguments())
+    {
+        const QFileInfo info(path);
+        if(info.isDir())
+        {
+            inputs << QDir(path).entryInfoList({"*.journal"}, QDir::Files, QDir::Name);
+        }
+        else if(info.isFile())
+        {
+            inputs << info;
+        }
+        else
+        {
+            err << "no such input " << path << Qt::endl;
+        }
+    }
+    if(inputs.isEmpty())
+    {
+        parser.showHelp(1);
+    }
+
+    const QString outputDir = parser.value("output");
+    if(!outputDir.isEmpty() && !QDir().mkpath(outputDir))
+    {
+        err << "cannot create " << outputDir << Qt::endl;
+        return 1;
+    }
+
+    // 笔的初始状态与画板启动时一致
+    ConfigHandle* handle = static_cast<DBApplication*>(qApp)->getSingleton<Config>()->getConfigHandle(Config::INTERNAL);
+    Q_ASSERT(handle);
+    QColor penColor(handle->getString("color.pen"));
+    penColor.setAlpha(handle->getInt("color.pen.opacity"));
+    const int penWidth = handle->getInt("size.pen");
+    const qreal tolerance = parser.isSet("simplify") ? parser.value("simplify").toDouble() : handle->getDouble("stroke.simplify.tolerance");
+    const bool check = parser.isSet("check");
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(qMax(1, parser.value("jobs").toInt()));
+
+    QMutex outputMutex;
+    QAtomicInteger<qint64> points = 0;
+    QAtomicInteger<qint64> kept = 0;
+    QAtomicInt failed = 0;
+    QElapsedTimer timer;
+    timer.start();
+
+    for(const QFileInfo& info : std::as_const(inputs))
+    {
+        pool.start([&, info](){
+            auto fail = [&](const QString& message){
+                QMutexLocker lock(&outputMutex);
+                err << info.filePath() << ": " << message << Qt::endl;
+                failed.fetchAndAddRelaxed(1);
+            };
+
+            QFile file(info.absoluteFilePath());
+            if(!file.open(QIODevice::ReadOnly))
+            {
+                fail(file.errorString());
+                return;
+            }
+
+            JournalRenderer renderer(canvasSize, penColor, penWidth);
+            renderer.setSimplifyTolerance(tolerance);
+            QString error;
+            if(!renderer.render(&file, &error))
+            {
+                fail(error);
+                return;
+            }
+
+            if(check)
+            {
+                file.seek(0);
+                JournalRenderer reference(canvasSize, penColor, penWidth);
+                reference.render(&file, &error);
+
+                qint64 differing = 0;
+                qint64 painted = 0;
+                const int worst = compare(renderer.image(), reference.image(), &differing, &painted);
+                {
+                    QMutexLocker lock(&outputMutex);
+                    out << info.filePath() << ": kept " << renderer.keptPoints() << " of " << reference.keptPoints()
+                        << " points, max difference " << worst << ", " << differing << " of " << painted
+                        << " painted pixels differ by more than " << VISIBLE_LEVELS << Qt::endl;
+                }
+                // 少量像素的明显差异来自取整，成片出现说明化简改变了笔画
+                const qint64 allowed = painted * DIFFERING_PERMILLE / 1000;
+                if(differing > allowed)
+                {
+                    fail(QString("%1 differing pixels exceed %2").arg(differing).arg(allowed));
+                    return;
+                }
+            }
+
+            const QString target = QDir(outputDir.isEmpty() ? info.absolutePath() : outputDir).filePath(info.completeBaseName() + ".png");
+            if(!renderer.image().save(target))
+            {
+                fail("cannot write " + target);
+                return;
+            }
+            points.fetchAndAddRelaxed(renderer.points());
+            kept.fetchAndAddRelaxed(renderer.keptPoints());
+        });
+    }
+    pool.waitForDone();
+
+    const qint64 elapsed = qMax<qint64>(1, timer.elapsed());
+    out << inputs.size() << " inputs, " << failed.loadRelaxed() << " failed, "
+        << points.loadRelaxed() << " points (" << kept.loadRelaxed() << " kept) in " << elapsed << " ms ("
+        << qint64(points.loadRelaxed() * 1000 / elapsed) << " points/s)" << Qt::endl;
+    return failed.loadRelaxed() ? 1 : 0;
+}
+
+}
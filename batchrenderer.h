@@ -0,0 +1,72 @@
+#ifndef BATCHRENDERER_H
+#define BATCHRENDERER_H
+
+#include "layer.h"
+#include "strokerasterizer.h"
+#include "strokesimplifier.h"
+
+#include <QColor>
+#include <QStringList>
+
+class QIODevice;
+
+// 离线执行一份输入记录，格式与控制套接字的命令相同，只处理手绘笔
+// 落笔、移动和抬笔的处理与 Board 一致：半透明和荧光笔先写入预备层，橡皮擦直接清除
+class JournalRenderer
+{
+public:
+    JournalRenderer(const QSize& size, const QColor& color, int width);
+
+    // 与画板相同的在线化简，0 表示逐点绘制
+    void setSimplifyTolerance(qreal pixels);
+    // 出错时返回 false，error 中带有行号
+    bool render(QIODevice* input, QString* error);
+    QImage image() const;
+    qint64 points() const;
+    // 化简后实际绘制的点数
+    qint64 keptPoints() const;
+
+private:
+    bool apply(const QByteArray& line, QString* error);
+    bool selectPen(const QString& name);
+    void press(const QPointF& pos);
+    void move(const QVector<QPointF>& points);
+    void release();
+    // 化简并绘制攒下的采样
+    void drawBatch();
+    void draw(const QVector<InputSample>& samples);
+    void flushStaging();
+
+private:
+    Layer layer;
+    Layer staging;
+    bool stagingMultiply = false;
+    StrokeRasterizer rasterizer;
+    StrokeSimplifier simplifier;
+    qreal tolerance = 0;
+    QVector<InputSample> simplified;
+
+    QColor color;
+    qreal width = 1;
+    bool eraser = false;
+    bool highlighter = false;
+    // 激光笔不写入图层
+    bool laser = false;
+
+    bool pressed = false;
+    QPointF last;
+    QVector<QPointF> parsed;
+    QVector<InputSample> batch;
+    qint64 count = 0;
+};
+
+// DrawingBoard --render <文件或目录>... [--output <目录>] [--size <宽>x<高>] [--jobs <线程数>]
+//              [--simplify <像素>] [--check]
+// 目录中的 *.journal 全部渲染，每个输入生成同名 PNG，多个输入分给多个线程
+// --check 另外不化简渲染一次并逐像素比较，看得出差异的像素过多时视为失败
+namespace BatchRender {
+    bool requested(int argc, char** argv);
+    int run(const QStringList& arguments);
+}
+
+#endif // BATCHRENDERER_H
@@ -1,5 +1,15 @@
 #include "boardprivate.h"
 #include "board.h"
+#include "allocationcounter.h"
+#include "trace.h"
+#include "compositor.h"
+#include "fadingink.h"
+#include "floatingselection.h"
+#include "floodfill.h"
+#include "glyphcache.h"
+#include "strokeshare.h"
+#include "textblock.h"
+#include "tilepyramid.h"
 #include "drawer.h"
 #include "preview.h"
 #include "tools.h"
@@ -8,17 +18,59 @@
 
 #include <QPainter>
 #include <QPropertyAnimation>
+#include <QVariantAnimation>
 #include <QResizeEvent>
+#include <QTabletEvent>
+#include <QKeyEvent>
+#include <QInputMethod>
+#include <QWheelEvent>
 #include <QStack>
 #include <QApplication>
 #include <QTimer>
 #include <QPen>
 #include <QPixmapCache>
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QUndoStack>
 #include <QPainterPath>
+#include <QSet>
+#include <QSharedPointer>
 #include <QWindow>
 
+#include <cmath>
+
+namespace {
+// 超过约一百万像素的刷新区域才值得分给多个线程
+const int PARALLEL_COMPOSITE_PIXELS = 1024 * 1024;
+// 选区缩放控制点在屏幕上的边长
+const int SELECTION_HANDLE_SIZE = 10;
+// 缩小显示时视口对应的画布可能很大，填充只处理落点周围这个范围
+const int MAX_FILL_SIZE = 4096;
+// 显示 1% 到 1000% 的内容
+const qreal MIN_ZOOM = 0.01;
+const qreal MAX_ZOOM = 10.0;
+
+// 沿轮廓每隔 step 取一个方块，得到的区域与周长成正比，与形状面积无关
+QRegion outlineRegion(const QPainterPath& path, qreal width, int step)
+{
+    const int m = int(std::ceil(width / 2)) + 2;
+    const qreal length = path.length();
+    if(length <= step)
+    {
+        return QRegion(path.controlPointRect().toAlignedRect().adjusted(-m, -m, m, m));
+    }
+
+    QRegion region;
+    const QSize box(step + 2 * m, step + 2 * m);
+    for(qreal s = 0; s < length + step; s += step)
+    {
+        QPointF pt = path.pointAtPercent(path.percentAtLength(qMin(s, length)));
+        region += QRect(pt.toPoint() - QPoint(step / 2 + m, step / 2 + m), box);
+    }
+    return region;
+}
+}
+
 BoardPrivate::BoardPrivate(Board* _q)
     :q(_q)
 {
@@ -32,30 +84,42 @@ BoardPrivate::BoardPrivate(Board* _q)
 
 
     controlPlatform->connect(controlPlatform, &Drawer::backgroundOpacityChanged, controlPlatform, [this](int value){
-        if(freeze) return;
+        if(freeze || trimmed) return;
 
         // qDebug() << "value";
         backgroundCanvas.fill(controlPlatform->backgroundColor());
         q->update();
     });
     controlPlatform->connect(controlPlatform, &Drawer::backgroundColorChanged, controlPlatform, [this](const QColor & c){
-        if(freeze) return;
+        if(freeze || trimmed) return;
 
         backgroundCanvas.fill(c);
         q->update();
     });
+    // 回收内存后画布已释放，恢复时按当前的笔和颜色重建，这里不再预览
     controlPlatform->connect(controlPlatform, &Drawer::penSizeChanged, controlPlatform, [this](int value){
+        if(trimmed) return;
+
         foregroundCanvas.fill(Qt::transparent);
+        foregroundPreview = true;
+        cursorRect = QRectF();
 
         QPainter p(&foregroundCanvas);
         p.setRenderHint(QPainter::Antialiasing);
         p.setPen(*controlPlatform->currentPen());
         p.drawPoint(q->rect().center());
 
-        q->update();
+        // 只刷新旧光标和预览点所在区域
+        q->update(penRectF.toAlignedRect());
+        penRectF = QRectF(q->rect().center(), QSizeF()).marginsAdded(QMarginsF(value, value, value, value));
+        q->update(penRectF.toAlignedRect());
     });
     controlPlatform->connect(controlPlatform, &Drawer::penColorChanged, controlPlatform, [this](const QColor& c){
+        if(trimmed) return;
+
         foregroundCanvas.fill(Qt::transparent);
+        foregroundPreview = true;
+        cursorRect = QRectF();
 
         QPainter p(&foregroundCanvas);
         QPen pen = *controlPlatform->currentPen();
@@ -63,29 +127,22 @@ BoardPrivate::BoardPrivate(Board* _q)
         p.setPen(pen);
         p.drawPoint(q->rect().center());
 
-        q->update();
+        q->update(penRectF.toAlignedRect());
+        penRectF = QRectF(q->rect().center(), QSizeF()).marginsAdded(QMarginsF(50, 50, 50, 50));
+        q->update(penRectF.toAlignedRect());
     });
     controlPlatform->connect(controlPlatform, &Drawer::collapsed, controlPlatform, [this](){
         savedControlPlatformGeometry = controlPlatform->geometry();
 
-        QPropertyAnimation *anim = new QPropertyAnimation(controlPlatform, "geometry", q);
-        q->connect(anim, &QPropertyAnimation::finished, q, [anim](){
-            anim->deleteLater();
-        });
-        anim->setDuration(100);
-        anim->setStartValue(savedControlPlatformGeometry);
-        anim->setEndValue(savedControlPlatformGeometry.marginsRemoved(QMargins(0,180,0,0)));
-        anim->start();
+        slideDrawer(savedControlPlatformGeometry, savedControlPlatformGeometry.marginsRemoved(QMargins(0,214,0,0)), 100, false);
     });
     controlPlatform->connect(controlPlatform, &Drawer::expanded, controlPlatform, [this](){
-        QPropertyAnimation *anim = new QPropertyAnimation(controlPlatform, "geometry", q);
-        q->connect(anim, &QPropertyAnimation::finished, q, [anim](){
-            anim->deleteLater();
-        });
-        anim->setDuration(100);
-        anim->setStartValue(controlPlatform->geometry());
-        anim->setEndValue(savedControlPlatformGeometry);
-        anim->start();
+        QRect from = drawerAnimation ? drawerSurfaceRect : controlPlatform->geometry();
+
+        // 先在隐藏状态下布局到展开尺寸，再缓存画面
+        hideDrawer();
+        controlPlatform->setGeometry(savedControlPlatformGeometry);
+        slideDrawer(from, savedControlPlatformGeometry, 100, false);
     });
     controlPlatform->connect(controlPlatform, &Drawer::downClicked, controlPlatform, [this](){
         if(previewPort)
@@ -166,8 +223,39 @@ BoardPrivate::BoardPrivate(Board* _q)
 
         QTimer::singleShot(300, q, showMin);
     });
+    controlPlatform->connect(controlPlatform, &Drawer::currentPenChanged, controlPlatform, [this](Pen*){
+        commitText();
+        commitSelection();
+        updateMagnifier(mousePosition);
+    });
+    controlPlatform->connect(controlPlatform, &Drawer::layerAddClicked, controlPlatform, [this](){
+        addLayer();
+    });
+    controlPlatform->connect(controlPlatform, &Drawer::layerRemoveClicked, controlPlatform, [this](){
+        removeLayer();
+    });
+    controlPlatform->connect(controlPlatform, &Drawer::layerClearClicked, controlPlatform, [this](){
+        clearLayer();
+    });
+    controlPlatform->connect(controlPlatform, &Drawer::layerRaiseClicked, controlPlatform, [this](){
+        moveLayer(1);
+    });
+    controlPlatform->connect(controlPlatform, &Drawer::layerLowerClicked, controlPlatform, [this](){
+        moveLayer(-1);
+    });
+    controlPlatform->connect(controlPlatform, &Drawer::currentLayerChanged, controlPlatform, [this](int index){
+        commitText();
+        commitSelection();
+        layers.setCurrentIndex(index);
+    });
+    controlPlatform->connect(controlPlatform, &Drawer::layerVisibleChanged, controlPlatform, [this](int index, bool v){
+        // 只重新合成该图层覆盖的区域
+        QRect r = layers.at(index).layer.bounds();
+        layers.setVisible(index, v);
+        commitPyramid();
+        q->update(toWidget(r));
+    });
     controlPlatform->connect(controlPlatform, &Drawer::leave, controlPlatform, [this](){
-        foregroundCanvas.fill(Qt::transparent);
         q->drawPen(q->cursor().pos());
         q->update();
     });
@@ -175,6 +263,7 @@ BoardPrivate::BoardPrivate(Board* _q)
         freeze = f;
         if(!f)
         {
+            magnifier.clear();
             backgroundCanvas.fill(controlPlatform->backgroundColor());
             screenPixmap.fill(Qt::transparent);
             q->update();
@@ -182,7 +271,7 @@ BoardPrivate::BoardPrivate(Board* _q)
         }
 
         setState(NONE);
-        controlPlatform->hide();
+        hideDrawer();
 
         QEventLoop loop;
         QTimer::singleShot(10, [&]() {
@@ -204,343 +293,1923 @@ BoardPrivate::BoardPrivate(Board* _q)
         backgroundCanvas.fill(Qt::transparent);
         QPainter p(&backgroundCanvas);
         p.drawPixmap(backgroundCanvas.rect(), screenPixmap/*, backgroundCanvas.rect()*/);
+        // 缩略图只在截屏时生成一次，镜片移动时不再缩放整张截图
+        magnifier.setSource(screenPixmap.toImage());
 
+        updateMemoryStats();
         q->update();
     });
 
 
-    backgroundCanvas = QPixmap(q->size());
-    boardCanvas = QPixmap(q->size());
-    preBoradCanvas = QPixmap(q->size());
-    foregroundCanvas = QPixmap(q->size());
+    Config* config = static_cast<DBApplication*>(qApp)->getSingleton<Config>();
+    ConfigHandle* handle = config->getConfigHandle(Config::INTERNAL);
+    Q_ASSERT(handle);
+    // 移动鼠标时不再按字符串查询配置
+    displayPen = handle->getBool("display.pen");
+    latency.setEnabled(handle->getBool("latency.enabled"));
+    simplifyTolerance = handle->getDouble("stroke.simplify.tolerance");
+    q->connect(config, &Config::configChanged, q, [this, handle](Config::ChangedType, const QString& id){
+        if(id == "display.pen")
+        {
+            displayPen = handle->getBool("display.pen");
+            cursorPen = nullptr;
+        }
+    });
+    fadingInk = new FadingInk(q);
+    fadingInk->setDuration(handle->getInt("laser.fade.duration"));
+    magnifier.setZoom(handle->getDouble("magnifier.zoom"));
+    magnifier.setRadius(handle->getInt("magnifier.radius"));
+    q->connect(fadingInk, &FadingInk::damaged, q, [this](const QRectF& r){
+        q->update(toWidget(r));
+    });
+
+    // 与其他实例同步手绘笔画
+    const QString shareMode = handle->getString("share.mode");
+    if(shareMode == "host" || shareMode == "join")
+    {
+        share = new StrokeShare(q);
+        q->connect(share, &StrokeShare::received, q, [this](quint32 peer, const QVector<StrokeProtocol::Message>& messages){
+            if(mouseIsPress)
+            {
+                remoteQueue.append({peer, messages, false});
+                return;
+            }
+            applyRemote(peer, messages);
+        });
+        q->connect(share, &StrokeShare::peerLeft, q, [this](quint32 peer){
+            if(mouseIsPress)
+            {
+                remoteQueue.append({peer, {}, true});
+                return;
+            }
+            removeRemote(peer);
+        });
+
+        const QString name = handle->getString("share.name");
+        const quint16 port = quint16(handle->getInt("share.port"));
+        if(shareMode == "host")
+        {
+            share->listen(name, handle->getString("share.bind"), port);
+        }
+        else
+        {
+            share->connectTo(name, handle->getString("share.host"), port);
+        }
+    }
+
+    // 浮动期间从外部撤销或重做时放弃浮动内容，抬起的像素由撤销记录恢复
+    QUndoStack* undoStack = static_cast<DBApplication*>(qApp)->getSingleton<QUndoStack>();
+    Q_ASSERT(undoStack);
+    q->connect(undoStack, &QUndoStack::indexChanged, q, [this](){
+        if(!selectionPushing && selection.isActive())
+        {
+            q->update(selectionWidgetRect());
+            selection.discard();
+        }
+    });
+
+    // 缩略层级更新后只刷新对应区域
+    pyramid = new TilePyramid(q);
+    q->connect(pyramid, &TilePyramid::updated, q, [this](const QRect& r){
+        if(TilePyramid::levelFor(viewZoom) > 0)
+        {
+            q->update(toWidget(r));
+        }
+    });
+
+    idleTrimTimer = new QTimer(q);
+    idleTrimTimer->setSingleShot(true);
+    q->connect(idleTrimTimer, &QTimer::timeout, q, [this](){
+        trimMemory();
+    });
+
+    backgroundCanvas = QImage(q->size(), QImage::Format_ARGB32_Premultiplied);
+    layers = LayerStack(q->size());
+    layers.add(q->tr("layer.name.default").arg(1));
+    syncLayers();
+    preBoradCanvas = Layer(q->size(), MemoryStats::STAGING);
+    foregroundCanvas = QImage(q->size(), QImage::Format_ARGB32_Premultiplied);
 
     backgroundCanvas.fill(controlPlatform->backgroundColor());
-    boardCanvas.fill(Qt::transparent);
-    preBoradCanvas.fill(Qt::transparent);
     foregroundCanvas.fill(Qt::transparent);
     screenPixmap.fill(Qt::transparent);
+
+    updateMemoryStats();
 }
 
-BoardPrivate::~BoardPrivate()
+StrokeProtocol::PenState BoardPrivate::sharedPen() const
 {
-    if(controlPlatform)
-    {
-        delete controlPlatform;
-        controlPlatform = nullptr;
-    }
-
-    QPixmapCache::clear();
+    const Pen* pen = controlPlatform->currentPen();
+    StrokeProtocol::PenState state;
+    state.flags = (pen->isEraser() ? StrokeProtocol::ERASER : 0) | (pen->isHighlighter() ? StrokeProtocol::HIGHLIGHTER : 0);
+    state.color = pen->color().rgba();
+    state.width = pen->widthF() / viewZoom;
+    return state;
 }
 
-void BoardPrivate::drawBackgroundImg(QPainter* p)
+void BoardPrivate::applyRemote(quint32 peer, const QVector<StrokeProtocol::Message>& messages)
 {
-    if(state & State::SHOW_BACKGROUND)
+    RemoteStroke& stroke = remoteStrokes[peer];
+    QRect dirty;
+    for(const StrokeProtocol::Message& m : messages)
     {
-        p->save();
-        p->drawPixmap(q->rect(),backgroundCanvas);
-        p->restore();
+        switch (m.type) {
+        case StrokeProtocol::PEN:
+            stroke.pen = m.pen;
+            break;
+        case StrokeProtocol::BEGIN:
+            dirty |= commitRemote(stroke);
+            stroke.drawing = true;
+            stroke.layerId = layers.currentId();
+            stroke.before = layers.current()->snapshot();
+            stroke.last = m.samples.first().pos;
+            dirty |= drawRemote(stroke, m.samples);
+            break;
+        case StrokeProtocol::POINTS:
+            dirty |= drawRemote(stroke, m.samples);
+            break;
+        case StrokeProtocol::END:
+            dirty |= commitRemote(stroke);
+            break;
+        }
     }
-}
 
-void BoardPrivate::drawBoardImg(QPainter* p)
-{
-    if(state & State::SHOW_BOARD)
+    if(!dirty.isEmpty())
     {
-        p->save();
-        p->drawPixmap(q->rect(),boardCanvas);
-        p->restore();
+        invalidatePassThrough(toWidget(dirty));
+        q->update(toWidget(dirty));
     }
 }
 
-void BoardPrivate::drawPreBoardImg(QPainter *p)
+QRect BoardPrivate::drawRemote(RemoteStroke& stroke, const QVector<InputSample>& samples)
 {
-    if(state & State::SHOW_BOARD)
+    Layer* layer = layers.find(stroke.layerId);
+    if(!stroke.drawing || !layer || samples.isEmpty())
     {
-        p->save();
-        p->drawPixmap(q->rect(),preBoradCanvas);
-        p->restore();
+        return QRect();
     }
-}
 
-void BoardPrivate::drawForeGroundImg(QPainter* p)
-{
-    if(state & State::SHOW_FOREGTOUND)
+    const bool highlighter = stroke.pen.flags & StrokeProtocol::HIGHLIGHTER;
+    const bool eraser = stroke.pen.flags & StrokeProtocol::ERASER;
+    const bool staging = StrokeRasterizer::needsStaging(highlighter, eraser, qAlpha(stroke.pen.color));
+    const StrokeRasterizer::Mode mode = StrokeRasterizer::modeFor(highlighter, eraser, staging);
+
+    Layer* target = staging ? &stroke.staging : layer;
+    const QRect dirty = stroke.rasterizer.rasterize(stroke.last, samples, stroke.pen.width, Layer::extent());
+    stroke.last = samples.last().pos;
+    if(dirty.isEmpty())
     {
-        p->save();
-        p->drawPixmap(q->rect(),foregroundCanvas);
-        p->restore();
+        return QRect();
+    }
+
+    const QColor color = QColor::fromRgba(stroke.pen.color);
+    target->forEachTile(dirty, mode != StrokeRasterizer::Clear, [&stroke, &color, mode](QImage* tile, const QPoint& origin){
+        stroke.rasterizer.composite(tile, origin, color, mode);
+    });
+    // 与本地荧光笔相同，以开始时的快照为底随写随叠底
+    if(highlighter)
+    {
+        layer->multiply(stroke.staging, stroke.before, dirty);
     }
+    return dirty;
 }
 
-void BoardPrivate::pressPreBoard()
+QRect BoardPrivate::commitRemote(RemoteStroke& stroke)
 {
-    QPainter p(&boardCanvas);
-    p.drawPixmap(boardCanvas.rect(), preBoradCanvas);
+    if(!stroke.drawing)
+    {
+        return QRect();
+    }
+    stroke.drawing = false;
 
-    preBoradCanvas.fill(Qt::transparent);
-}
+    QRect dirty;
+    Layer* layer = layers.find(stroke.layerId);
+    if(layer && !stroke.staging.isEmpty())
+    {
+        dirty = stroke.staging.bounds();
+        if(!(stroke.pen.flags & StrokeProtocol::HIGHLIGHTER))
+        {
+            layer->merge(stroke.staging);
+        }
+    }
+    stroke.staging.clear();
 
-void BoardPrivate::savaState()
-{
-    // qDebug() << "push";
-    stateStack.push(state);
+    if(layer)
+    {
+        pushLayerChange(stroke.layerId, stroke.before, layer->snapshot());
+    }
+    stroke.before = Layer::Tiles();
+    return dirty;
 }
 
-void BoardPrivate::restoreState()
+void BoardPrivate::removeRemote(quint32 peer)
 {
-    // qDebug() << "pop";
-    setState(stateStack.isEmpty() ? State::READY_TO_DRAW : stateStack.pop());
+    // 对端断开时提交它画了一半的笔画
+    auto it = remoteStrokes.find(peer);
+    if(it != remoteStrokes.end())
+    {
+        const QRect dirty = toWidget(commitRemote(*it));
+        remoteStrokes.erase(it);
+        invalidatePassThrough(dirty);
+        q->update(dirty);
+    }
 }
 
-void BoardPrivate::setState(State s)
+void BoardPrivate::suspendRemote()
 {
-    if(state == s)
+    // 对端画了一半的笔画先提交成独立的撤销记录，本地笔画的快照不再包含它的后半段
+    QRect dirty;
+    for(RemoteStroke& stroke : remoteStrokes)
     {
-        return;
+        if(stroke.drawing)
+        {
+            dirty |= commitRemote(stroke);
+            stroke.resume = true;
+        }
+    }
+    if(!dirty.isEmpty())
+    {
+        q->update(toWidget(dirty));
     }
-    state = s;
-    // qDebug() << "current state" << s;
-    q->update();
 }
 
-bool BoardPrivate::showOrHideDrawer(QPoint p)
+void BoardPrivate::resumeRemote()
 {
-    static bool hideStatus = true;
-
-    auto cRect = q->rect();
-    if(p.y() > cRect.center().y())
+    for(RemoteStroke& stroke : remoteStrokes)
     {
-        if(controlPlatform->isVisible() || !(state & State::SHOW_CONTROL) || mouseIsPress)
+        if(!stroke.resume)
         {
-            // qDebug() << "return" << controlPlatform->isVisible() << !(state & State::SHOW_CONTROL) << mouseIsPress;
-            return false;
+            continue;
         }
-        else
+        stroke.resume = false;
+        // 从提交处接着画，后半段的撤销记录以本地笔画之后的图层为起点
+        Layer* layer = layers.find(stroke.layerId);
+        if(layer)
         {
-            controlPlatform->show();
-            QPropertyAnimation *anim = new QPropertyAnimation(controlPlatform, "pos", q);
-            q->connect(anim, &QPropertyAnimation::finished, q, [anim](){
-                anim->deleteLater();
-            });
-            anim->setDuration(80);
-            anim->setStartValue(QPoint(cRect.center().x() - controlPlatform->rect().width() / 2, cRect.bottom()));
-            anim->setEndValue(QPoint(cRect.center().x() - controlPlatform->rect().width() / 2, cRect.bottom() - controlPlatform->rect().height()));
-            anim->start();
+            stroke.drawing = true;
+            stroke.before = layer->snapshot();
         }
-
-        hideStatus = false;
     }
-    else
+
+    // 按到达顺序补上排队的包
+    const QVector<RemotePacket> queue = std::move(remoteQueue);
+    remoteQueue.clear();
+    for(const RemotePacket& packet : queue)
     {
-        if(!controlPlatform->isVisible() || hideStatus)
+        if(packet.left)
         {
-            hideStatus = true;
-            return false;
+            removeRemote(packet.peer);
         }
         else
         {
-
-            hideStatus = true;
-            QPropertyAnimation *anim = new QPropertyAnimation(controlPlatform, "pos", q);
-            q->connect(anim, &QPropertyAnimation::finished, q, [this, anim](){
-                controlPlatform->hide();
-                anim->deleteLater();
-            });
-            anim->setDuration(80);
-            anim->setStartValue(QPoint(cRect.center().x() - controlPlatform->rect().width() / 2, cRect.bottom() - controlPlatform->rect().height()));
-            anim->setEndValue(QPoint(cRect.center().x() - controlPlatform->rect().width() / 2, cRect.bottom()));
-            anim->start();
+            applyRemote(packet.peer, packet.messages);
         }
     }
-    return true;
 }
 
-
-Board::Board(QWidget *parent, Qt::WindowFlags f)
-    : QWidget{parent, f}
-    , d(new BoardPrivate(this))
+void BoardPrivate::queueInput(const QPointF& pos, qreal pressure, quint64 timestamp)
 {
-
-    this->setAttribute(Qt::WA_OpaquePaintEvent);
-    this->setAttribute(Qt::WA_NoSystemBackground);
-    this->setAutoFillBackground(false);
-
-    this->setMouseTracking(true);
-    this->setCursor(Qt::BlankCursor);
+    InputSample sample;
+    sample.pos = toCanvas(pos);
+    sample.pressure = pressure > 0 ? pressure : 1.0;
+    sample.timestamp = timestamp;
+    latency.stamp(&sample);
+
+    // 缓冲区满时立即绘制，保证不丢采样；否则在下一次刷新前统一绘制，调用方负责请求刷新
+    if(!inputBuffer.push(sample))
+    {
+        drainInput();
+        inputBuffer.push(sample);
+    }
 }
 
-Board::~Board()
+void BoardPrivate::drainInput()
 {
-    QUndoStack* undoStack = static_cast<DBApplication*>(qApp)->getSingleton<QUndoStack>();
-    if(undoStack)
+    if(inputBuffer.drain(inputBatch) == 0)
     {
-        undoStack->clear();
+        return;
     }
 
-    if(d)
+    QRectF dirty;
     {
-        delete d;
-        d = nullptr;
+        ALLOCATION_FREE_SCOPE("Board::drawLine");
+        // 容差和笔宽都按屏幕像素计算，换算到画布
+        const qreal radiusScale = controlPlatform->currentPen()->widthF() / viewZoom / 2;
+        simplifier.simplify(mouseLastPos, inputBatch, simplifyTolerance / viewZoom, radiusScale, &strokeBatch);
+        dirty = q->drawLine(mouseLastPos, strokeBatch);
+    }
+    latency.rasterized(inputBatch);
+    mouseLastPos = strokeBatch.last().pos;
+    if(share)
+    {
+        share->strokePoints(strokeBatch);
+    }
+
+    if(!dirty.isNull())
+    {
+        q->update(toWidget(dirty));
     }
 }
 
-void Board::readyToDraw()
+void BoardPrivate::updateCursorSprite()
 {
-    d->setState((BoardPrivate::State)(d->state | BoardPrivate::READY_TO_DRAW));
+    const Pen* pen = controlPlatform->currentPen();
+    cursorPen = pen;
+    cursorColor = pen->color().rgba();
+    cursorWidth = pen->width();
+
+    // 笔宽大小的圆点，笔形图标画在鼠标位置的右上方
+    const qreal radius = pen->width() / 2.0;
+    QRectF bounds(-radius, -radius, radius * 2, radius * 2);
+    const QPixmap pix = displayPen ? pen->shape() : QPixmap();
+    if(!pix.isNull())
+    {
+        bounds |= QRectF(0, -pix.height(), pix.width(), pix.height());
+    }
+
+    const QRect r = bounds.toAlignedRect();
+    cursorOffset = r.topLeft();
+    cursorSprite = QImage(r.size().expandedTo(QSize(1, 1)), QImage::Format_ARGB32_Premultiplied);
+    cursorSprite.fill(Qt::transparent);
+
+    QPainter p(&cursorSprite);
+    p.translate(-cursorOffset);
+    p.setRenderHint(QPainter::Antialiasing);
+    p.setPen(Qt::NoPen);
+    p.setBrush(pen->color());
+    p.drawEllipse(QPointF(), radius, radius);
+    if(!pix.isNull())
+    {
+        p.drawPixmap(QPointF(0, -pix.height()), pix);
+    }
 }
 
-QPixmap Board::save()
+void BoardPrivate::updateMemoryStats()
 {
-    return d->boardCanvas;
+    backgroundTracker.update(backgroundCanvas.sizeInBytes());
+    foregroundTracker.update(foregroundCanvas.sizeInBytes());
+    backingTracker.update(backingImage.sizeInBytes());
+    screenTracker.update(qint64(screenPixmap.width()) * screenPixmap.height() * screenPixmap.depth() / 8 + screenCompressed.size());
 }
 
-QPixmap Board::save(bool withBackground)
+void BoardPrivate::enterPassThrough()
 {
-    if(!withBackground) return save();
+    commitText();
+    commitSelection();
+    fadingInk->clear();
+    q->update(magnifier.rect());
+    magnifier.hide();
+    setState((State)(state & ~SHOW_BACKGROUND & ~SHOW_FOREGTOUND & ~SHOW_CONTROL));
+    hideDrawer();
+    // 未绘制的采样直接丢弃
+    inputBuffer.drain(inputBatch);
+
+    passThrough = true;
+    passThroughFrame = QImage();
+    q->setMouseTracking(false);
+    q->setCursor(Qt::ArrowCursor);
+    q->update();
 
-    QPixmap pix(d->boardCanvas.size());
-    QPainter p(&pix);
-    d->drawBackgroundImg(&p);
-    d->drawBoardImg(&p);
-    d->drawPreBoardImg(&p);
-    return pix;
+    scheduleTrim();
 }
 
-bool Board::eventFilter(QObject* watched, QEvent* event)
+void BoardPrivate::leavePassThrough()
 {
-    if(watched == d->controlPlatform)
+    if(!passThrough)
     {
-        // qDebug() << event->type();
-        if(event->type() == QEvent::MouseButtonPress)
-        {
-            QMouseEvent* e = static_cast<QMouseEvent*>(event);
-            if(e->button() == Qt::RightButton)
-            {
-                d->controlPlatform->hide();
-                d->setState((BoardPrivate::State)(d->state & ~BoardPrivate::State::SHOW_CONTROL));
-                QTimer::singleShot(2000, this,[this](){
-                    d->setState((BoardPrivate::State)(d->state | BoardPrivate::State::SHOW_CONTROL));
-                });
-                return qApp->notify(this,new QMouseEvent(QEvent::MouseMove, this->mapFromGlobal(e->globalPosition()), e->globalPosition(),Qt::NoButton,Qt::NoButton, Qt::NoModifier));
-            }
-        }
-        else if(event->type() == QEvent::MouseButtonDblClick)
-        {
-            // QPainter p(&d->boardCanvas);
-            // p.setCompositionMode(QPainter::CompositionMode_Clear);
-            // p.setPen(Qt::transparent);
-            // p.setBrush(Qt::transparent);
-            // p.drawRect(d->boardCanvas.rect());
-
-            auto redo = [=](){
-                d->boardCanvas.fill(Qt::transparent);
-                this->update();
-            };
+        return;
+    }
 
-            QUndoStack* undoStack = static_cast<DBApplication*>(qApp)->getSingleton<QUndoStack>();
-            Q_ASSERT(undoStack);
-            QPixmap boradCanvas = d->boardCanvas;
-            QUndoCommand* undoCommand = TOOLS::createUndoRedoCommand([this, boradCanvas](){
-                d->boardCanvas = boradCanvas;
-                this->update();
-            }, redo);
+    passThrough = false;
+    passThroughFrame = QImage();
+    passThroughStale = QRegion();
+    restoreMemory();
 
-            undoStack->push(undoCommand);
+    q->setMouseTracking(true);
+    q->setCursor(Qt::BlankCursor);
+}
 
-            redo();
-        }
+void BoardPrivate::invalidatePassThrough(const QRect& r)
+{
+    if(!passThrough || passThroughFrame.isNull())
+    {
+        return;
     }
-
-    return QWidget::eventFilter(watched, event);
+    passThroughStale |= r.isNull() ? q->rect() : (r & q->rect());
 }
 
-void Board::paintEvent(QPaintEvent* event)
+void BoardPrivate::scheduleTrim()
 {
-    qint64 start =  QDateTime::currentMSecsSinceEpoch();
-    // qDebug() << "start" << start;
-    Q_UNUSED(event);
-
-    QPainter p(this);
-    p.setRenderHint(QPainter::Antialiasing);
-
-    d->drawBackgroundImg(&p);
-    d->drawBoardImg(&p);
-    d->drawPreBoardImg(&p);
-    d->drawForeGroundImg(&p);
+    ConfigHandle* handle = static_cast<DBApplication*>(qApp)->getSingleton<Config>()->getConfigHandle(Config::INTERNAL);
+    Q_ASSERT(handle);
 
-    // qDebug() << "spent" << QDateTime::currentMSecsSinceEpoch() - start;
+    int delay = handle->getInt("idle.trim.delay");
+    if(delay <= 0)
+    {
+        return;
+    }
+    idleTrimTimer->start(delay * 1000);
 }
 
-void Board::resizeEvent(QResizeEvent* event)
+void BoardPrivate::trimMemory()
 {
-    d->backgroundCanvas = d->backgroundCanvas.scaled(event->size());
-    d->boardCanvas = d->boardCanvas.scaled(event->size());
-    d->preBoradCanvas = d->boardCanvas.scaled(event->size());
-    d->foregroundCanvas = d->foregroundCanvas.scaled(event->size());
+    if(trimmed || mouseIsPress)
+    {
+        return;
+    }
+    trimmed = true;
+
+    // 可以重新生成的画布直接释放；穿透状态下只显示合成好的画面，保留它，
+    // 否则下一次刷新会重新合成并把压缩的瓦片全部解压
+    preBoradCanvas.clear();
+    backgroundCanvas = QImage();
+    foregroundCanvas = QImage();
+    backingImage = QImage();
+    controlPlatform->releaseSurface();
+
+    // 缩略层级的待处理快照与图层共享瓦片，先释放
+    pyramid->clear();
+    layers.trim();
+    magnifier.clear();
+
+    if(!screenPixmap.isNull())
+    {
+        QImage img = screenPixmap.toImage().convertToFormat(QImage::Format_ARGB32_Premultiplied);
+        screenCompressedSize = img.size();
+        screenCompressed = qCompress(img.constBits(), int(img.sizeInBytes()), 1);
+        screenPixmap = QPixmap();
+    }
 
-    QWidget::resizeEvent(event);
+    updateMemoryStats();
 }
 
-void Board::mouseMoveEvent(QMouseEvent* event)
+void BoardPrivate::restoreMemory()
 {
-    auto position = event->position();
-    if(d->mousePosition == position) return;
-    // qDebug() << "last pos" << d->mousePosition << "cur pos" << position;
+    idleTrimTimer->stop();
+    if(!trimmed)
+    {
+        return;
+    }
+    trimmed = false;
 
-    d->showOrHideDrawer(position.toPoint());
+    QElapsedTimer timer;
+    timer.start();
 
-    QPainterPath path(d->mousePosition);
-    path.moveTo(position);
-    path.addRect(d->penRectF);
+    if(!screenCompressed.isEmpty())
+    {
+        QByteArray raw = qUncompress(screenCompressed);
+        QImage img(reinterpret_cast<const uchar*>(raw.constData()), screenCompressedSize.width(), screenCompressedSize.height(), QImage::Format_ARGB32_Premultiplied);
+        screenPixmap = QPixmap::fromImage(img);
+        screenCompressed.clear();
+        if(freeze)
+        {
+            magnifier.setSource(img);
+        }
+    }
 
-    if(d->mouseLastPos.isNull())
+    backgroundCanvas = QImage(q->size(), QImage::Format_ARGB32_Premultiplied);
+    if(freeze)
     {
-        d->mouseLastPos = position.toPoint();
+        backgroundCanvas.fill(Qt::transparent);
+        QPainter p(&backgroundCanvas);
+        p.drawPixmap(backgroundCanvas.rect(), screenPixmap);
     }
     else
     {
-        if(d->mouseIsPress)
-        {
-            drawLine(d->mouseLastPos, position.toPoint());
-            QPainterPath linePath(d->mouseLastPos);
-            linePath.moveTo(position);
-            path.addPath(linePath);
-        }
-
-        d->mouseLastPos = position.toPoint();
+        backgroundCanvas.fill(controlPlatform->backgroundColor());
     }
 
-    path.addRect(d->penRectF = drawPen(position));
+    foregroundCanvas = QImage(q->size(), QImage::Format_ARGB32_Premultiplied);
+    foregroundCanvas.fill(Qt::transparent);
 
-    QTimer::singleShot(0,[this,path](){
-        this->update(path.boundingRect().toRect().marginsAdded(QMargins(100,100,100,100)));
-        // this->update();
-    });
+    // 画板图层在第一次访问时自动解压，这里提前完成以便统计耗时
+    layers.ensureResident();
+    commitPyramid(true);
 
-    d->mousePosition = position;
+    qint64 nsecs = timer.nsecsElapsed();
+    if(MemoryStats* stats = static_cast<DBApplication*>(qApp)->getSingleton<MemoryStats>())
+    {
+        stats->recordRestoreLatency(nsecs);
+    }
+
+    updateMemoryStats();
+    q->update();
+}
+
+BoardPrivate::~BoardPrivate()
+{
+    delete textBlock;
+    textBlock = nullptr;
+
+    if(controlPlatform)
+    {
+        delete controlPlatform;
+        controlPlatform = nullptr;
+    }
+
+    QPixmapCache::clear();
+}
+
+void BoardPrivate::drawBackgroundImg(QPainter* p, const QRect& r)
+{
+    if(state & State::SHOW_BACKGROUND)
+    {
+        QRect rect = r.isNull() ? q->rect() : r;
+        p->save();
+        p->drawImage(rect, backgroundCanvas, rect);
+        p->restore();
+    }
+}
+
+void BoardPrivate::drawBoardImg(QPainter* p, const QRect& r)
+{
+    if(!(state & State::SHOW_BOARD))
+    {
+        return;
+    }
+
+    QRect rect = r.isNull() ? q->rect() : r;
+    p->save();
+    if(viewIsIdentity())
+    {
+        layers.draw(p, rect);
+        p->restore();
+        return;
+    }
+
+    const QRect canvasRect = toCanvas(rect);
+    const int level = TilePyramid::levelFor(viewZoom);
+    p->setClipRect(rect, Qt::IntersectClip);
+    p->setTransform(viewTransform(), true);
+    p->setRenderHint(QPainter::SmoothPixmapTransform);
+    if(level == 0)
+    {
+        layers.draw(p, canvasRect);
+    }
+    else
+    {
+        // 缩小显示时从最接近的缩略层级取样，绘制的瓦片数与内容多少无关
+        const QRegion stale = viewStale & canvasRect;
+        p->save();
+        p->setClipRegion(QRegion(canvasRect).subtracted(stale), Qt::IntersectClip);
+        pyramid->draw(p, level, canvasRect);
+        p->restore();
+
+        for(const QRect& sr : stale)
+        {
+            layers.draw(p, sr);
+        }
+    }
+    p->restore();
+}
+
+void BoardPrivate::drawPreBoardImg(QPainter *p, const QRect& r)
+{
+    if(!(state & State::SHOW_BOARD))
+    {
+        return;
+    }
+
+    // 荧光笔已经叠底到图层，预备层只需要显示半透明笔
+    QRect rect = r.isNull() ? q->rect() : r;
+    if(!preBoardMultiply)
+    {
+        drawStaging(p, rect, preBoradCanvas);
+    }
+    for(const RemoteStroke& stroke : std::as_const(remoteStrokes))
+    {
+        if(!(stroke.pen.flags & StrokeProtocol::HIGHLIGHTER))
+        {
+            drawStaging(p, rect, stroke.staging);
+        }
+    }
+}
+
+void BoardPrivate::drawStaging(QPainter* p, const QRect& rect, const Layer& staging) const
+{
+    if(staging.isEmpty())
+    {
+        return;
+    }
+
+    p->save();
+    if(viewIsIdentity())
+    {
+        staging.draw(p, rect);
+    }
+    else
+    {
+        p->setClipRect(rect, Qt::IntersectClip);
+        p->setTransform(viewTransform(), true);
+        p->setRenderHint(QPainter::SmoothPixmapTransform);
+        staging.draw(p, toCanvas(rect));
+    }
+    p->restore();
+}
+
+void BoardPrivate::drawForeGroundImg(QPainter* p, const QRect& r)
+{
+    if(state & State::SHOW_FOREGTOUND)
+    {
+        QRect rect = r.isNull() ? q->rect() : r;
+        p->save();
+        if(foregroundPreview)
+        {
+            p->drawImage(rect, foregroundCanvas, rect);
+        }
+        if(cursorRect.intersects(rect))
+        {
+            p->drawImage(cursorRect.topLeft(), cursorSprite);
+        }
+        p->restore();
+    }
+}
+
+void BoardPrivate::drawDrawerSurface(QPainter* p)
+{
+    if(!drawerAnimation || drawerSurface.isNull())
+    {
+        return;
+    }
+
+    // 画面底部对齐，折叠/展开时只裁剪，不缩放
+    qreal surfaceHeight = drawerSurface.height() / drawerSurface.devicePixelRatio();
+    p->save();
+    p->setClipRect(drawerSurfaceRect);
+    p->drawPixmap(QPointF(drawerSurfaceRect.left(), drawerSurfaceRect.bottom() + 1 - surfaceHeight), drawerSurface);
+    p->restore();
+}
+
+void BoardPrivate::prepareBoard(const QRect& r)
+{
+    const QRect canvasRect = toCanvas(r);
+    layers.flatten(canvasRect);
+    if(textBlock)
+    {
+        textBlock->ensureLayout();
+    }
+    viewStale = QRegion();
+    if(TilePyramid::levelFor(viewZoom) > 0)
+    {
+        // 正在绘制、尚未提交的笔画也要从第 0 级显示
+        viewStale = pyramid->stale().united(layers.uncommitted()) & canvasRect;
+    }
+}
+
+void BoardPrivate::commitPyramid(bool full)
+{
+    QRect r = layers.takeCommitted();
+    if(full)
+    {
+        pyramid->clear();
+        r = layers.contentBounds();
+        invalidatePassThrough();
+    }
+    else if(!r.isEmpty())
+    {
+        invalidatePassThrough(toWidget(QRectF(r)));
+    }
+    // 清空画布时合成结果可能为空，录像还要覆盖之前记录过的内容
+    QRect recordRect;
+    if(recorder.isRecording())
+    {
+        recordRect = full ? r.united(recorder.bounds()) : r;
+    }
+    if(r.isEmpty() && recordRect.isEmpty())
+    {
+        return;
+    }
+
+    const Layer::Tiles base = layers.composite();
+    if(!r.isEmpty())
+    {
+        pyramid->update(base, r);
+    }
+    recorder.capture(base, recordRect);
+}
+
+void BoardPrivate::pressPreBoard()
+{
+    TRACE_SCOPE("Board::pressPreBoard");
+    if(preBoradCanvas.isEmpty())
+    {
+        return;
+    }
+
+    // 荧光笔在绘制时已经叠底到图层
+    if(!preBoardMultiply)
+    {
+        layers.current()->merge(preBoradCanvas);
+    }
+    preBoradCanvas.clear();
+    preBoardMultiply = false;
+}
+
+QPainterPath BoardPrivate::shapePath(Pen::Tool tool, const QPointF& from, const QPointF& to, qreal width) const
+{
+    QPainterPath path;
+    switch (tool) {
+    case Pen::LINE:
+        path.moveTo(from);
+        path.lineTo(to);
+        break;
+    case Pen::ARROW:
+    {
+        path.moveTo(from);
+        path.lineTo(to);
+
+        // 箭头是同一条路径上的折线，半透明颜色也不会重叠加深
+        const QLineF line(to, from);
+        if(line.length() > 0)
+        {
+            const qreal head = qMin(line.length() / 2, qMax(width * 4, 16 / viewZoom));
+            QLineF wing = line;
+            wing.setLength(head);
+            wing.setAngle(line.angle() + 30);
+            path.moveTo(wing.p2());
+            path.lineTo(to);
+            wing.setAngle(line.angle() - 30);
+            path.lineTo(wing.p2());
+        }
+        break;
+    }
+    case Pen::RECTANGLE:
+        path.addRect(QRectF(from, to).normalized());
+        break;
+    case Pen::ELLIPSE:
+        path.addEllipse(QRectF(from, to).normalized());
+        break;
+    default:
+        break;
+    }
+    return path;
+}
+
+void BoardPrivate::updateShapePreview(const QPointF& pos, Qt::KeyboardModifiers modifiers)
+{
+    const Pen::Tool tool = controlPlatform->currentPen()->tool();
+    QPointF to = toCanvas(pos);
+
+    // 按住 Shift 时约束为正方形、圆形或 45 度角
+    if(modifiers & Qt::ShiftModifier)
+    {
+        const QPointF delta = to - shapeAnchor;
+        if(tool == Pen::RECTANGLE || tool == Pen::ELLIPSE)
+        {
+            const qreal side = qMax(qAbs(delta.x()), qAbs(delta.y()));
+            to = shapeAnchor + QPointF(delta.x() < 0 ? -side : side, delta.y() < 0 ? -side : side);
+        }
+        else
+        {
+            QLineF line(shapeAnchor, to);
+            line.setAngle(std::round(line.angle() / 45) * 45);
+            to = line.p2();
+        }
+    }
+    shapeCurrent = to;
+
+    // 只刷新上一帧和这一帧形状轮廓覆盖的区域
+    const qreal width = controlPlatform->currentPen()->widthF();
+    const QPainterPath path = viewTransform().map(shapePath(tool, shapeAnchor, shapeCurrent, width / viewZoom));
+    const QRegion region = outlineRegion(path, width, 32);
+    q->update(region.united(shapeRegion));
+    shapeRegion = region;
+}
+
+void BoardPrivate::drawShapePreview(QPainter* p, const QRect& r)
+{
+    if(!shaping || shapeAnchor == shapeCurrent)
+    {
+        return;
+    }
+
+    const Pen* pen = controlPlatform->currentPen();
+    const qreal width = pen->widthF() / viewZoom;
+
+    p->save();
+    p->setClipRect(r, Qt::IntersectClip);
+    p->setTransform(viewTransform(), true);
+    p->setRenderHint(QPainter::Antialiasing);
+    p->setPen(QPen(pen->color(), width, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
+    p->setBrush(Qt::NoBrush);
+    p->drawPath(shapePath(pen->tool(), shapeAnchor, shapeCurrent, width));
+    p->restore();
+}
+
+QRect BoardPrivate::commitShape()
+{
+    shaping = false;
+    if(shapeAnchor == shapeCurrent)
+    {
+        return QRect();
+    }
+
+    const Pen* pen = controlPlatform->currentPen();
+    const qreal width = pen->widthF() / viewZoom;
+    const QPainterPath path = shapePath(pen->tool(), shapeAnchor, shapeCurrent, width);
+    const QPen shapePen(pen->color(), width, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin);
+
+    // 只为轮廓经过的瓦片分配内存，每块瓦片只绘制一次
+    QSet<quint32> keys;
+    const QRegion region = outlineRegion(path, width, Layer::TILE_SIZE / 2);
+    for(const QRect& rect : region)
+    {
+        for(int ty = Layer::floorDiv(rect.top(), Layer::TILE_SIZE); ty <= Layer::floorDiv(rect.bottom(), Layer::TILE_SIZE); ++ty)
+        {
+            for(int tx = Layer::floorDiv(rect.left(), Layer::TILE_SIZE); tx <= Layer::floorDiv(rect.right(), Layer::TILE_SIZE); ++tx)
+            {
+                keys.insert(Layer::tileKey(tx, ty));
+            }
+        }
+    }
+
+    Layer* layer = layers.current();
+    for(quint32 key : std::as_const(keys))
+    {
+        const QRect tileRect(Layer::tileIndex(key) * Layer::TILE_SIZE, QSize(Layer::TILE_SIZE, Layer::TILE_SIZE));
+        layer->forEachTile(tileRect, true, [&](QImage* tile, const QPoint& origin){
+            QPainter tp(tile);
+            tp.setRenderHint(QPainter::Antialiasing);
+            tp.translate(-origin);
+            tp.setPen(shapePen);
+            tp.setBrush(Qt::NoBrush);
+            tp.drawPath(path);
+        });
+    }
+    return region.boundingRect();
+}
+
+void BoardPrivate::beginText(const QPointF& pos)
+{
+    const Pen* pen = controlPlatform->currentPen();
+    // 字号随笔宽变化，按屏幕上看到的大小换算到画布
+    QFont font = q->font();
+    font.setPixelSize(qMax(1, qRound((12 + pen->widthF() * 2) / viewZoom)));
+
+    GlyphCache* cache = static_cast<DBApplication*>(qApp)->getSingleton<GlyphCache>();
+    Q_ASSERT(cache);
+    textBlock = new TextBlock(cache, font, pen->color(), toCanvas(pos));
+
+    q->setAttribute(Qt::WA_InputMethodEnabled, true);
+    q->activateWindow();
+    q->setFocus();
+    editText(textBlock->caretRect());
+}
+
+void BoardPrivate::editText(const QRectF& damage)
+{
+    if(!damage.isEmpty())
+    {
+        q->update(toWidget(damage));
+    }
+    QGuiApplication::inputMethod()->update(Qt::ImCursorRectangle);
+}
+
+void BoardPrivate::drawTextPreview(QPainter* p, const QRect& r)
+{
+    if(!textBlock)
+    {
+        return;
+    }
+
+    p->save();
+    p->setClipRect(r, Qt::IntersectClip);
+    p->setTransform(viewTransform(), true);
+    p->setRenderHint(QPainter::SmoothPixmapTransform, !viewIsIdentity());
+    textBlock->draw(p, QRectF(toCanvas(r)), true);
+    p->restore();
+}
+
+void BoardPrivate::commitText()
+{
+    if(!textBlock)
+    {
+        return;
+    }
+
+    TextBlock* block = textBlock;
+    textBlock = nullptr;
+    q->setAttribute(Qt::WA_InputMethodEnabled, false);
+    q->update(toWidget(block->bounds()));
+
+    if(!block->isEmpty())
+    {
+        pressPreBoard();
+        const quint32 id = layers.currentId();
+        Layer* layer = layers.current();
+        const Layer::Tiles before = layer->snapshot();
+        block->commit(layer);
+        const Layer::Tiles after = layer->snapshot();
+
+        QUndoStack* undoStack = static_cast<DBApplication*>(qApp)->getSingleton<QUndoStack>();
+        Q_ASSERT(undoStack);
+        undoStack->push(createLayerChange(id, before, after));
+        commitPyramid();
+    }
+    delete block;
+
+    // 没有正在编辑的文字时才能整体丢弃图集
+    GlyphCache* cache = static_cast<DBApplication*>(qApp)->getSingleton<GlyphCache>();
+    Q_ASSERT(cache);
+    cache->trim();
+}
+
+void BoardPrivate::drawFadingInk(QPainter* p, const QRect& r)
+{
+    if(fadingInk->isEmpty())
+    {
+        return;
+    }
+
+    p->save();
+    p->setClipRect(r, Qt::IntersectClip);
+    p->setTransform(viewTransform(), true);
+    fadingInk->draw(p, QRectF(toCanvas(r)));
+    p->restore();
+}
+
+void BoardPrivate::updateMagnifier(const QPointF& pos)
+{
+    const QRect before = magnifier.rect();
+    if(freeze && !passThrough && controlPlatform->currentPen()->tool() == Pen::MAGNIFIER)
+    {
+        magnifier.render(pos, q->size());
+    }
+    else
+    {
+        magnifier.hide();
+    }
+
+    // 旧位置和新位置分别刷新
+    q->update(before);
+    q->update(magnifier.rect());
+}
+
+void BoardPrivate::drawMagnifier(QPainter* p, const QRect& r)
+{
+    magnifier.draw(p, r);
+}
+
+void BoardPrivate::fillAt(const QPointF& pos)
+{
+    const QPoint seed = toCanvas(pos).toPoint();
+    const QRect area = toCanvas(q->rect()) & QRect(seed - QPoint(MAX_FILL_SIZE / 2, MAX_FILL_SIZE / 2), QSize(MAX_FILL_SIZE, MAX_FILL_SIZE));
+    if(!area.contains(seed))
+    {
+        return;
+    }
+
+    // 参考图是画布坐标下看到的内容：冻结的截图加上所有可见图层
+    QImage reference(area.size(), QImage::Format_ARGB32_Premultiplied);
+    reference.fill(Qt::transparent);
+    {
+        QPainter rp(&reference);
+        rp.translate(-area.topLeft());
+        if(freeze)
+        {
+            rp.save();
+            rp.setTransform(viewTransform().inverted(), true);
+            rp.drawImage(0, 0, backgroundCanvas);
+            rp.restore();
+        }
+        layers.flatten(area);
+        layers.draw(&rp, area);
+    }
+
+    ConfigHandle* handle = static_cast<DBApplication*>(qApp)->getSingleton<Config>()->getConfigHandle(Config::INTERNAL);
+    Q_ASSERT(handle);
+    FloodFill flood(reference, area.topLeft(), handle->getInt("fill.tolerance"));
+    const QRect filled = flood.fill(seed);
+    if(filled.isEmpty())
+    {
+        return;
+    }
+
+    const QColor color = controlPlatform->currentPen()->color();
+    const quint32 id = layers.currentId();
+    Layer* layer = layers.current();
+    const Layer::Tiles before = layer->snapshot();
+    layer->forEachTile(filled, true, [&flood, &color](QImage* tile, const QPoint& origin){
+        flood.composite(tile, origin, color);
+    });
+    const Layer::Tiles after = layer->snapshot();
+
+    QUndoStack* undoStack = static_cast<DBApplication*>(qApp)->getSingleton<QUndoStack>();
+    Q_ASSERT(undoStack);
+    undoStack->push(createLayerChange(id, before, after));
+    commitPyramid();
+}
+
+bool BoardPrivate::selectionGesture() const
+{
+    return lassoing || selectionDrag != FloatingSelection::NONE;
+}
+
+void BoardPrivate::pressSelection(const QPointF& pos)
+{
+    const QPointF c = toCanvas(pos);
+    if(selection.isActive())
+    {
+        selectionDrag = selection.hitTest(c, SELECTION_HANDLE_SIZE / viewZoom);
+        if(selectionDrag != FloatingSelection::NONE)
+        {
+            selectionGrab = c;
+            selectionGrabRect = selection.rect();
+            return;
+        }
+        // 点击选区以外的位置时放下
+        commitSelection();
+    }
+
+    lassoing = true;
+    lassoPolygon.clear();
+    lassoPolygon << c;
+}
+
+void BoardPrivate::moveSelection(const QPointF& pos, Qt::KeyboardModifiers modifiers)
+{
+    const QPointF c = toCanvas(pos);
+    if(lassoing)
+    {
+        // 套索不闭合显示，每次只刷新新增的一段
+        const QPointF last = lassoPolygon.last();
+        lassoPolygon << c;
+        q->update(toWidget(QRectF(last, c).normalized()).adjusted(-2, -2, 2, 2));
+        return;
+    }
+
+    const QRect before = selectionWidgetRect();
+    const QPointF delta = c - selectionGrab;
+    if(selectionDrag == FloatingSelection::MOVE)
+    {
+        selection.setRect(selectionGrabRect.translated(delta));
+    }
+    else if(selectionDrag == FloatingSelection::SCALE)
+    {
+        // 按住 Shift 保持宽高比
+        QSizeF size(qMax<qreal>(1, selectionGrabRect.width() + delta.x()), qMax<qreal>(1, selectionGrabRect.height() + delta.y()));
+        if(modifiers & Qt::ShiftModifier)
+        {
+            const qreal k = qMax(size.width() / selectionGrabRect.width(), size.height() / selectionGrabRect.height());
+            size = selectionGrabRect.size() * k;
+        }
+        selection.setRect(QRectF(selectionGrabRect.topLeft(), size));
+    }
+    q->update(before);
+    q->update(selectionWidgetRect());
+}
+
+void BoardPrivate::releaseSelection()
+{
+    if(selectionDrag != FloatingSelection::NONE)
+    {
+        selectionDrag = FloatingSelection::NONE;
+        return;
+    }
+
+    lassoing = false;
+    q->update(toWidget(lassoPolygon.boundingRect()).adjusted(-2, -2, 2, 2));
+    if(lassoPolygon.size() > 2)
+    {
+        selectionLayer = layers.currentId();
+        Layer* layer = layers.current();
+        const Layer::Tiles before = layer->snapshot();
+        if(selection.lift(layer, lassoPolygon))
+        {
+            pushLayerChange(selectionLayer, before, layer->snapshot());
+            q->update(selectionWidgetRect());
+        }
+    }
+    lassoPolygon.clear();
+}
+
+void BoardPrivate::commitSelection()
+{
+    if(!selection.isActive())
+    {
+        return;
+    }
+
+    q->update(selectionWidgetRect());
+    selectionDrag = FloatingSelection::NONE;
+    Layer* layer = layers.find(selectionLayer);
+    if(!layer)
+    {
+        selection.discard();
+        return;
+    }
+
+    const Layer::Tiles before = layer->snapshot();
+    selection.drop(layer);
+    pushLayerChange(selectionLayer, before, layer->snapshot());
+}
+
+void BoardPrivate::deleteSelection()
+{
+    // 抬起时已经从图层中移除，丢弃浮动内容即可，撤销抬起就能恢复
+    q->update(selectionWidgetRect());
+    selectionDrag = FloatingSelection::NONE;
+    selection.discard();
+}
+
+void BoardPrivate::drawSelection(QPainter* p, const QRect& r)
+{
+    if(!selection.isActive() && !lassoing)
+    {
+        return;
+    }
+
+    p->save();
+    p->setClipRect(r, Qt::IntersectClip);
+    p->setTransform(viewTransform(), true);
+    selection.draw(p, QRectF(toCanvas(r)), SELECTION_HANDLE_SIZE / viewZoom);
+    if(lassoing && lassoPolygon.size() > 1)
+    {
+        QPen pen(QColor(255, 255, 255, 220), 0, Qt::DashLine);
+        pen.setCosmetic(true);
+        p->setPen(pen);
+        p->drawPolyline(lassoPolygon);
+    }
+    p->restore();
+}
+
+QRect BoardPrivate::selectionWidgetRect() const
+{
+    if(!selection.isActive())
+    {
+        return QRect();
+    }
+    return toWidget(selection.rect()).adjusted(-SELECTION_HANDLE_SIZE, -SELECTION_HANDLE_SIZE, SELECTION_HANDLE_SIZE, SELECTION_HANDLE_SIZE);
+}
+
+TOOLS::UndoRedoCommand* BoardPrivate::createLayerChange(quint32 id, const Layer::Tiles& before, const Layer::Tiles& after)
+{
+    // 未改动的瓦片不与撤销记录共享，空闲时图层可以整体压缩
+    struct Change{
+        Layer::Tiles patch;
+        bool applied;
+    };
+    QSharedPointer<Change> change(new Change{Layer::diff(before, after), true});
+    auto toggle = [this, id, change](bool apply){
+        // 入栈时的 redo 不需要执行；图层已被删除时撤销记录不再生效
+        if(change->applied == apply)
+        {
+            return;
+        }
+        if(Layer* layer = layers.find(id))
+        {
+            change->patch = layer->swap(change->patch);
+            change->applied = apply;
+            commitPyramid();
+        }
+        q->update();
+    };
+
+    TOOLS::UndoRedoCommand* undoCommand = TOOLS::createUndoRedoCommand([toggle](){
+        toggle(false);
+    }, [toggle](){
+        toggle(true);
+    });
+    undoCommand->setMemoryCost(Layer::changedBytes(before, after));
+    return undoCommand;
+}
+
+void BoardPrivate::pushLayerChange(quint32 id, const Layer::Tiles& before, const Layer::Tiles& after)
+{
+    QUndoStack* undoStack = static_cast<DBApplication*>(qApp)->getSingleton<QUndoStack>();
+    Q_ASSERT(undoStack);
+
+    selectionPushing = true;
+    undoStack->push(createLayerChange(id, before, after));
+    selectionPushing = false;
+    commitPyramid();
+}
+
+void BoardPrivate::addLayer()
+{
+    layers.add(q->tr("layer.name.default").arg(layers.count() + 1));
+    syncLayers();
+}
+
+void BoardPrivate::removeLayer()
+{
+    if(layers.count() <= 1)
+    {
+        clearLayer();
+        return;
+    }
+
+    // 删除图层可以撤销，图层本身连同瓦片一起保存在命令中
+    const int index = layers.currentIndex();
+    const LayerStack::Entry entry = layers.at(index);
+    auto redo = [this, id = entry.id](){
+        int i = layers.indexOf(id);
+        if(i >= 0 && layers.count() > 1)
+        {
+            layers.take(i);
+            commitPyramid();
+            syncLayers();
+            q->update();
+        }
+    };
+    auto undo = [this, index, entry](){
+        layers.insert(index, entry);
+        commitPyramid();
+        syncLayers();
+        q->update();
+    };
+
+    QUndoStack* undoStack = static_cast<DBApplication*>(qApp)->getSingleton<QUndoStack>();
+    Q_ASSERT(undoStack);
+    TOOLS::UndoRedoCommand* undoCommand = TOOLS::createUndoRedoCommand(undo, redo);
+    undoCommand->setMemoryCost(Layer::bytes(entry.layer.snapshot()));
+    undoStack->push(undoCommand);
+}
+
+void BoardPrivate::moveLayer(int delta)
+{
+    const int from = layers.currentIndex();
+    layers.move(from, qBound(0, from + delta, layers.count() - 1));
+    commitPyramid();
+    syncLayers();
+    q->update();
+}
+
+void BoardPrivate::clearLayer()
+{
+    const quint32 id = layers.currentId();
+    Layer* layer = layers.current();
+    const Layer::Tiles tiles = layer->snapshot();
+    if(tiles.isEmpty())
+    {
+        return;
+    }
+
+    layer->restore(Layer::Tiles());
+    commitPyramid();
+    q->update();
+
+    QUndoStack* undoStack = static_cast<DBApplication*>(qApp)->getSingleton<QUndoStack>();
+    Q_ASSERT(undoStack);
+    undoStack->push(createLayerChange(id, tiles, Layer::Tiles()));
+}
+
+void BoardPrivate::syncLayers()
+{
+    QStringList names;
+    QList<bool> visible;
+    for(int i = 0; i < layers.count(); ++i)
+    {
+        names << layers.at(i).name;
+        visible << layers.at(i).visible;
+    }
+    controlPlatform->setLayers(names, visible, layers.currentIndex());
+}
+
+void BoardPrivate::savaState()
+{
+    // qDebug() << "push";
+    stateStack.push(state);
+}
+
+void BoardPrivate::restoreState()
+{
+    // qDebug() << "pop";
+    setState(stateStack.isEmpty() ? State::READY_TO_DRAW : stateStack.pop());
+}
+
+void BoardPrivate::setState(State s)
+{
+    if(state == s)
+    {
+        return;
+    }
+    state = s;
+    // qDebug() << "current state" << s;
+    q->update();
+}
+
+QTransform BoardPrivate::viewTransform() const
+{
+    return QTransform(viewZoom, 0, 0, viewZoom, viewOffset.x(), viewOffset.y());
+}
+
+bool BoardPrivate::viewIsIdentity() const
+{
+    return viewZoom == 1.0 && viewOffset.isNull();
+}
+
+QPointF BoardPrivate::toCanvas(const QPointF& p) const
+{
+    return (p - viewOffset) / viewZoom;
+}
+
+QRect BoardPrivate::toCanvas(const QRect& r) const
+{
+    if(viewIsIdentity())
+    {
+        return r;
+    }
+    return QRectF(toCanvas(QPointF(r.topLeft())), QSizeF(r.size()) / viewZoom).toAlignedRect();
+}
+
+QRect BoardPrivate::toWidget(const QRectF& r) const
+{
+    if(viewIsIdentity())
+    {
+        return r.toAlignedRect();
+    }
+    // 平滑缩放会影响相邻像素，多刷新一圈
+    return viewTransform().mapRect(r).toAlignedRect().adjusted(-1, -1, 1, 1);
+}
+
+void BoardPrivate::zoomView(qreal factor, const QPointF& anchor)
+{
+    const qreal zoom = qBound(MIN_ZOOM, viewZoom * factor, MAX_ZOOM);
+    if(zoom == viewZoom)
+    {
+        return;
+    }
+
+    // 保持锚点下的画布位置不动
+    const QPointF canvasAnchor = toCanvas(anchor);
+    viewZoom = zoom;
+    viewOffset = anchor - canvasAnchor * viewZoom;
+    passThroughFrame = QImage();
+    q->update();
+}
+
+void BoardPrivate::panView(const QPointF& delta)
+{
+    if(delta.isNull())
+    {
+        return;
+    }
+
+    viewOffset += delta;
+    passThroughFrame = QImage();
+    q->update();
+}
+
+void BoardPrivate::resetView()
+{
+    viewZoom = 1.0;
+    viewOffset = QPointF();
+    passThroughFrame = QImage();
+    q->update();
+}
+
+bool BoardPrivate::showOrHideDrawer(QPoint p)
+{
+    static bool hideStatus = true;
+
+    auto cRect = q->rect();
+    if(p.y() > cRect.center().y())
+    {
+        if(drawerVisible() || !(state & State::SHOW_CONTROL) || mouseIsPress)
+        {
+            // qDebug() << "return" << drawerVisible() << !(state & State::SHOW_CONTROL) << mouseIsPress;
+            return false;
+        }
+        else
+        {
+            QRect shown(QPoint(cRect.center().x() - controlPlatform->rect().width() / 2, cRect.bottom() - controlPlatform->rect().height()), controlPlatform->size());
+            slideDrawer(shown.translated(0, controlPlatform->rect().height()), shown, 80, false);
+        }
+
+        hideStatus = false;
+    }
+    else
+    {
+        if(!drawerVisible() || hideStatus)
+        {
+            hideStatus = true;
+            return false;
+        }
+        else
+        {
+
+            hideStatus = true;
+            QRect shown(QPoint(cRect.center().x() - controlPlatform->rect().width() / 2, cRect.bottom() - controlPlatform->rect().height()), controlPlatform->size());
+            slideDrawer(shown, shown.translated(0, controlPlatform->rect().height()), 80, true);
+        }
+    }
+    return true;
+}
+
+bool BoardPrivate::drawerVisible() const
+{
+    return drawerAnimation ? drawerTargetVisible : controlPlatform->isVisible();
+}
+
+void BoardPrivate::hideDrawer()
+{
+    stopDrawerAnimation();
+    controlPlatform->hide();
+}
+
+void BoardPrivate::slideDrawer(const QRect& from, const QRect& to, int duration, bool hideOnFinished)
+{
+    stopDrawerAnimation();
+
+    // 整个面板只渲染一次，动画过程中平移缓存画面
+    drawerSurface = controlPlatform->surface();
+    drawerSurfaceRect = from;
+    drawerTargetVisible = !hideOnFinished;
+    controlPlatform->hide();
+
+    QVariantAnimation* anim = new QVariantAnimation(q);
+    drawerAnimation = anim;
+    q->connect(anim, &QVariantAnimation::valueChanged, q, [this](const QVariant& v){
+        TRACE_SCOPE("Drawer::slide");
+        QRect r = v.toRect();
+        q->update(QRegion(drawerSurfaceRect).united(r));
+        drawerSurfaceRect = r;
+    });
+    q->connect(anim, &QVariantAnimation::finished, q, [this, anim, to, hideOnFinished](){
+        drawerAnimation = nullptr;
+        drawerSurface = QPixmap();
+        q->update(drawerSurfaceRect);
+
+        controlPlatform->setGeometry(to);
+        controlPlatform->setVisible(!hideOnFinished);
+        anim->deleteLater();
+    });
+    anim->setDuration(duration);
+    anim->setStartValue(from);
+    anim->setEndValue(to);
+    anim->start();
+    q->update(from);
+}
+
+void BoardPrivate::stopDrawerAnimation()
+{
+    if(!drawerAnimation)
+    {
+        return;
+    }
+
+    drawerAnimation->stop();
+    drawerAnimation->deleteLater();
+    drawerAnimation = nullptr;
+    drawerSurface = QPixmap();
+    q->update(drawerSurfaceRect);
+}
+
+
+Board::Board(QWidget *parent, Qt::WindowFlags f)
+    : QWidget{parent, f}
+    , d(new BoardPrivate(this))
+{
+
+    this->setAttribute(Qt::WA_OpaquePaintEvent);
+    this->setAttribute(Qt::WA_NoSystemBackground);
+    this->setAutoFillBackground(false);
+
+    this->setMouseTracking(true);
+    this->setCursor(Qt::BlankCursor);
+}
+
+Board::~Board()
+{
+    QUndoStack* undoStack = static_cast<DBApplication*>(qApp)->getSingleton<QUndoStack>();
+    if(undoStack)
+    {
+        undoStack->clear();
+    }
+
+    if(d)
+    {
+        delete d;
+        d = nullptr;
+    }
+}
+
+void Board::readyToDraw()
+{
+    d->leavePassThrough();
+    d->setState((BoardPrivate::State)(d->state | BoardPrivate::READY_TO_DRAW));
+}
+
+QPixmap Board::save()
+{
+    if(d->viewIsIdentity())
+    {
+        return QPixmap::fromImage(d->layers.image());
+    }
+
+    // 按当前视图导出
+    QPixmap pix(this->size());
+    pix.fill(Qt::transparent);
+    d->prepareBoard(this->rect());
+    QPainter p(&pix);
+    d->drawBoardImg(&p);
+    return pix;
+}
+
+QPixmap Board::save(bool withBackground)
+{
+    if(!withBackground) return save();
+
+    QPixmap pix(this->size());
+    d->prepareBoard(pix.rect());
+    QPainter p(&pix);
+    d->drawBackgroundImg(&p);
+    d->drawBoardImg(&p);
+    d->drawPreBoardImg(&p);
+    return pix;
+}
+
+bool Board::startRecording(const QString& path)
+{
+    ConfigHandle* handle = static_cast<DBApplication*>(qApp)->getSingleton<Config>()->getConfigHandle(Config::INTERNAL);
+    d->recorder.setVerbose(handle->getBool("timelapse.stats"));
+    if(!d->recorder.start(path, d->toCanvas(this->rect())))
+    {
+        return false;
+    }
+    // 第一帧包含已有内容，之后只记录变化
+    d->recorder.capture(d->layers.composite(), d->layers.contentBounds());
+    return true;
+}
+
+void Board::stopRecording()
+{
+    d->recorder.stop();
+}
+
+bool Board::isRecording() const
+{
+    return d->recorder.isRecording();
+}
+
+Drawer* Board::drawer() const
+{
+    return d->controlPlatform;
+}
+
+void Board::injectPress(const QPointF& pos)
+{
+    QMouseEvent event(QEvent::MouseButtonPress, pos, this->mapToGlobal(pos), Qt::LeftButton, Qt::LeftButton, Qt::NoModifier);
+    mousePressEvent(&event);
+}
+
+void Board::injectMove(const QVector<QPointF>& points)
+{
+    if(points.isEmpty() || !d->mouseIsPress)
+    {
+        return;
+    }
+
+    // 形状和选区只关心最后的位置
+    if(d->selectionGesture())
+    {
+        d->moveSelection(points.last(), Qt::NoModifier);
+    }
+    else if(d->shaping)
+    {
+        d->updateShapePreview(points.last(), Qt::NoModifier);
+    }
+    else
+    {
+        for(const QPointF& p : points)
+        {
+            d->queueInput(p, 1.0, 0);
+        }
+        // 刷新前统一绘制
+        update(QRectF(points.last(), QSizeF(1, 1)).toAlignedRect());
+    }
+}
+
+void Board::injectRelease(const QPointF& pos)
+{
+    QMouseEvent event(QEvent::MouseButtonRelease, pos, this->mapToGlobal(pos), Qt::LeftButton, Qt::NoButton, Qt::NoModifier);
+    mouseReleaseEvent(&event);
+}
+
+void Board::clearLayer()
+{
+    d->clearLayer();
+}
+
+LatencyProbe* Board::latency() const
+{
+    return &d->latency;
+}
+
+const StrokeSimplifier& Board::simplifier() const
+{
+    return d->simplifier;
+}
+
+bool Board::event(QEvent* event)
+{
+    TRACE_SCOPE_ARG("Board::event", "type", event->type());
+    if(event->type() != QEvent::UpdateRequest)
+    {
+        return QWidget::event(event);
+    }
+
+    // 在合成这一帧之前把积累的输入采样一次性绘制，脏区域并入同一次刷新
+    d->drainInput();
+    const bool result = QWidget::event(event);
+    // 绘制和后备缓冲的刷新都在这次事件中同步完成
+    d->latency.flushed(d->controlPlatform->currentPen()->width(), size());
+    return result;
+}
+
+bool Board::eventFilter(QObject* watched, QEvent* event)
+{
+    if(watched == d->controlPlatform)
+    {
+        // qDebug() << event->type();
+        if(event->type() == QEvent::MouseButtonPress)
+        {
+            QMouseEvent* e = static_cast<QMouseEvent*>(event);
+            if(e->button() == Qt::RightButton)
+            {
+                d->hideDrawer();
+                d->setState((BoardPrivate::State)(d->state & ~BoardPrivate::State::SHOW_CONTROL));
+                QTimer::singleShot(2000, this,[this](){
+                    d->setState((BoardPrivate::State)(d->state | BoardPrivate::State::SHOW_CONTROL));
+                });
+                return qApp->notify(this,new QMouseEvent(QEvent::MouseMove, this->mapFromGlobal(e->globalPosition()), e->globalPosition(),Qt::NoButton,Qt::NoButton, Qt::NoModifier));
+            }
+        }
+        else if(event->type() == QEvent::MouseButtonDblClick)
+        {
+            // 双击清空当前图层
+            d->clearLayer();
+        }
+    }
+
+    return QWidget::eventFilter(watched, event);
+}
+
+void Board::paintEvent(QPaintEvent* event)
+{
+    TRACE_SCOPE_ARG("Board::paintEvent", "rects", event->region().rectCount());
+
+    QPainter p(this);
+    p.setRenderHint(QPainter::Antialiasing);
+
+    // 只合成本次需要刷新的区域
+    const QRect r = event->rect();
+    if(d->passThrough)
+    {
+        // 画面只合成一次，之后的刷新直接贴图
+        if(d->passThroughFrame.isNull())
+        {
+            d->prepareBoard(this->rect());
+            d->passThroughFrame = QImage(this->size(), QImage::Format_ARGB32_Premultiplied);
+            d->passThroughFrame.fill(Qt::transparent);
+            QPainter fp(&d->passThroughFrame);
+            d->drawBoardImg(&fp);
+            d->drawPreBoardImg(&fp);
+            d->passThroughStale = QRegion();
+        }
+        else if(!d->passThroughStale.isEmpty())
+        {
+            // 只重画被改动的区域，其余部分仍然直接贴图
+            QPainter fp(&d->passThroughFrame);
+            for(const QRect& rect : d->passThroughStale)
+            {
+                d->prepareBoard(rect);
+                fp.setCompositionMode(QPainter::CompositionMode_Source);
+                fp.fillRect(rect, Qt::transparent);
+                fp.setCompositionMode(QPainter::CompositionMode_SourceOver);
+                d->drawBoardImg(&fp, rect);
+                d->drawPreBoardImg(&fp, rect);
+            }
+            d->passThroughStale = QRegion();
+        }
+        if(!d->passThroughFrame.isNull())
+        {
+            p.drawImage(r, d->passThroughFrame, r);
+        }
+        return;
+    }
+
+    // 形状预览等只刷新细长轮廓，按区域中的各个矩形分别合成
+    for(const QRect& rect : event->region())
+    {
+        // 合成缓存只在界面线程更新，之后各条带并发读取
+        d->prepareBoard(rect);
+        if(rect.width() * rect.height() >= PARALLEL_COMPOSITE_PIXELS)
+        {
+            if(d->backingImage.size() != this->size())
+            {
+                d->backingImage = QImage(this->size(), QImage::Format_ARGB32_Premultiplied);
+                d->updateMemoryStats();
+            }
+
+            Compositor::composite(&d->backingImage, rect, [this](QPainter* sp, const QRect& stripe){
+                d->drawBackgroundImg(sp, stripe);
+                d->drawBoardImg(sp, stripe);
+                d->drawPreBoardImg(sp, stripe);
+                d->drawShapePreview(sp, stripe);
+                d->drawTextPreview(sp, stripe);
+                d->drawSelection(sp, stripe);
+                d->drawFadingInk(sp, stripe);
+                d->drawMagnifier(sp, stripe);
+                d->drawForeGroundImg(sp, stripe);
+            });
+            p.drawImage(rect, d->backingImage, rect);
+        }
+        else
+        {
+            d->drawBackgroundImg(&p, rect);
+            d->drawBoardImg(&p, rect);
+            d->drawPreBoardImg(&p, rect);
+            d->drawShapePreview(&p, rect);
+            d->drawTextPreview(&p, rect);
+            d->drawSelection(&p, rect);
+            d->drawFadingInk(&p, rect);
+            d->drawMagnifier(&p, rect);
+            d->drawForeGroundImg(&p, rect);
+        }
+    }
+    d->drawDrawerSurface(&p);
+    d->latency.painted();
+}
+
+void Board::showEvent(QShowEvent* event)
+{
+    d->restoreMemory();
+    QWidget::showEvent(event);
+}
+
+void Board::hideEvent(QHideEvent* event)
+{
+    d->commitText();
+    d->commitSelection();
+    d->scheduleTrim();
+    QWidget::hideEvent(event);
+}
+
+void Board::resizeEvent(QResizeEvent* event)
+{
+    d->restoreMemory();
+    d->backgroundCanvas = d->backgroundCanvas.scaled(event->size());
+    d->layers.resize(event->size());
+    d->preBoradCanvas.resize(event->size());
+    d->foregroundCanvas = d->foregroundCanvas.scaled(event->size());
+    d->backingImage = QImage();
+    d->updateMemoryStats();
+
+    QWidget::resizeEvent(event);
+}
+
+void Board::mouseMoveEvent(QMouseEvent* event)
+{
+    if(d->passThrough) return;
+
+    auto position = event->position();
+    if(d->mousePosition == position) return;
+    // qDebug() << "last pos" << d->mousePosition << "cur pos" << position;
+
+    if(d->panning)
+    {
+        d->panView(position - d->panLastPos);
+        d->panLastPos = position;
+    }
+
+    d->showOrHideDrawer(position.toPoint());
+
+    // 放大镜、选区和形状预览各自刷新，每次都要重建路径或区域，不在下面的检查范围内
+    if(!d->magnifier.rect().isNull() || d->controlPlatform->currentPen()->tool() == Pen::MAGNIFIER)
+    {
+        d->updateMagnifier(position);
+    }
+
+    if(d->selectionGesture())
+    {
+        d->moveSelection(position, event->modifiers());
+    }
+    else if(d->shaping)
+    {
+        d->updateShapePreview(position, event->modifiers());
+    }
+
+    QRectF dirty;
+    {
+        // 悬停和手绘时每次移动都不应有堆分配；刷新请求由 Qt 记录，不在检查范围内
+        ALLOCATION_FREE_SCOPE("Board::mouseMoveEvent");
+
+        // 数位板的采样已在 tabletEvent 中入队，跳过由它合成的鼠标事件；鼠标和触摸合成的事件照常处理
+        const QPointingDevice::PointerType pointer = event->pointerType();
+        const bool fromTablet = pointer == QPointingDevice::PointerType::Pen || pointer == QPointingDevice::PointerType::Eraser || pointer == QPointingDevice::PointerType::Cursor;
+        if(!d->selectionGesture() && !d->shaping && d->mouseIsPress && !fromTablet)
+        {
+            for(const QEventPoint& point : event->points())
+            {
+                d->queueInput(point.position(), 1.0, point.timestamp());
+            }
+        }
+
+        // 只刷新旧光标和新光标所在区域，笔迹在刷新前绘制并另行请求
+        dirty = d->penRectF;
+        d->penRectF = drawPen(position);
+        dirty |= d->penRectF;
+        d->mousePosition = position;
+    }
+    update(dirty.toAlignedRect());
 }
 
 void Board::mousePressEvent(QMouseEvent* event)
 {
+    if(d->passThrough && event->button() == Qt::LeftButton)
+    {
+        QWidget::mousePressEvent(event);
+        return;
+    }
+    d->restoreMemory();
+
     if(event->button() == Qt::LeftButton)
     {
+        // 点击其他位置时先提交正在编辑的文字
+        d->commitText();
+        d->drainInput();
         d->pressPreBoard();
 
-        QPixmap boradCanvas = d->boardCanvas;
-        d->lastUndo = [this, boradCanvas](){
-            d->boardCanvas = boradCanvas;
-            this->update();
-        };
+        // 隐藏的图层上落笔时自动显示
+        if(!d->layers.at(d->layers.currentIndex()).visible)
+        {
+            d->layers.setVisible(d->layers.currentIndex(), true);
+            d->syncLayers();
+        }
+
+        const Pen::Tool tool = d->controlPlatform->currentPen()->tool();
+        if((d->state & BoardPrivate::READY_TO_DRAW) && tool == Pen::TEXT)
+        {
+            d->hideDrawer();
+            d->beginText(event->position());
+            QWidget::mousePressEvent(event);
+            return;
+        }
+        if((d->state & BoardPrivate::READY_TO_DRAW) && tool == Pen::FILL)
+        {
+            d->hideDrawer();
+            d->fillAt(event->position());
+            QWidget::mousePressEvent(event);
+            return;
+        }
+        if((d->state & BoardPrivate::READY_TO_DRAW) && tool == Pen::SELECT)
+        {
+            // 选取期间同样视为按下，避免弹出工具栏
+            d->hideDrawer();
+            d->suspendRemote();
+            d->mouseIsPress = true;
+            d->pressSelection(event->position());
+            QWidget::mousePressEvent(event);
+            return;
+        }
+        // 放大镜只跟随光标，不绘制
+        if(tool == Pen::MAGNIFIER)
+        {
+            QWidget::mousePressEvent(event);
+            return;
+        }
+
+        // 按下期间对端的笔画排队，快照里不会混入对端的改动
+        d->suspendRemote();
+        d->lastUndoLayer = d->layers.currentId();
+        d->lastUndoTiles = d->layers.current()->snapshot();
 
         d->mouseIsPress = true;
+        d->mouseLastPos = d->toCanvas(event->position());
         if(d->state & BoardPrivate::READY_TO_DRAW)
         {
-            d->controlPlatform->hide();
-            drawPoint(event->position().toPoint());
-
-            this->update();
+            d->hideDrawer();
+            const Pen* pen = d->controlPlatform->currentPen();
+            if(pen->isLaser())
+            {
+                d->fadingInk->begin(pen->color(), pen->widthF() / d->viewZoom);
+            }
+            if(pen->tool() == Pen::FREEHAND)
+            {
+                // 激光笔迹只在本地显示，不同步
+                if(d->share && !pen->isLaser())
+                {
+                    d->share->beginStroke(d->sharedPen(), d->mouseLastPos);
+                }
+                // 只刷新落笔处
+                this->update(d->toWidget(drawPoint(event->position().toPoint())));
+            }
+            else
+            {
+                d->shaping = true;
+                d->shapeAnchor = d->shapeCurrent = d->mouseLastPos;
+                d->shapeRegion = QRegion();
+            }
         }
     }
+    else if(event->button() == Qt::MiddleButton)
+    {
+        // 中键拖动平移视图
+        d->panning = true;
+        d->panLastPos = event->position();
+    }
     else if(event->button() == Qt::BackButton)
     {
         QUndoStack* undoStack = static_cast<DBApplication*>(qApp)->getSingleton<QUndoStack>();
@@ -558,36 +2227,67 @@ void Board::mousePressEvent(QMouseEvent* event)
 
 void Board::mouseReleaseEvent(QMouseEvent* event)
 {
-    if(event->button() == Qt::LeftButton)
+    if(event->button() == Qt::LeftButton && d->selectionGesture())
     {
+        d->releaseSelection();
+        d->mouseIsPress = false;
+        d->resumeRemote();
+        d->showOrHideDrawer(event->pos());
+    }
+    else if(event->button() == Qt::LeftButton && d->mouseIsPress && d->controlPlatform->currentPen()->isLaser())
+    {
+        // 激光笔迹不进入图层，也没有撤销记录
+        d->drainInput();
+        d->fadingInk->end();
+        d->mouseIsPress = false;
+        d->resumeRemote();
+        d->showOrHideDrawer(event->pos());
+    }
+    else if(event->button() == Qt::LeftButton && d->mouseIsPress)
+    {
+        d->drainInput();
+        if(d->share)
+        {
+            d->share->endStroke();
+        }
+        if(d->shaping)
+        {
+            QRect dirty = d->commitShape();
+            this->update(d->shapeRegion.united(d->toWidget(dirty)));
+            d->shapeRegion = QRegion();
+        }
         d->pressPreBoard();
 
         QUndoStack* undoStack = static_cast<DBApplication*>(qApp)->getSingleton<QUndoStack>();
         Q_ASSERT(undoStack);
-        QPixmap boradCanvas = d->boardCanvas;
-        QUndoCommand* undoCommand = TOOLS::createUndoRedoCommand(d->lastUndo, [this, boradCanvas](){
-            d->boardCanvas = boradCanvas;
-            this->update();
-        });
+        if(Layer* layer = d->layers.find(d->lastUndoLayer))
+        {
+            undoStack->push(d->createLayerChange(d->lastUndoLayer, d->lastUndoTiles, layer->snapshot()));
+        }
+        d->lastUndoTiles = Layer::Tiles();
 
-        undoStack->push(undoCommand);
+        // 笔画提交后在后台更新缩略层级
+        d->commitPyramid();
 
         d->mouseIsPress = false;
+        d->resumeRemote();
         d->showOrHideDrawer(event->pos());
     }
+    else if(event->button() == Qt::MiddleButton)
+    {
+        d->panning = false;
+    }
     else if(event->button() == Qt::RightButton)
     {
         qDebug() << d->state << BoardPrivate::READY_TO_DRAW;
 
         if((d->state & BoardPrivate::READY_TO_DRAW) == BoardPrivate::READY_TO_DRAW)
         {
-            d->setState((BoardPrivate::State)(d->state & ~BoardPrivate::SHOW_BACKGROUND & ~BoardPrivate::SHOW_FOREGTOUND & ~BoardPrivate::SHOW_CONTROL));
-            d->controlPlatform->hide();
-            this->setCursor(Qt::ArrowCursor);
+            d->enterPassThrough();
         }
         else
         {
-            this->setCursor(Qt::BlankCursor);
+            d->leavePassThrough();
             d->setState((BoardPrivate::State)(d->state | BoardPrivate::READY_TO_DRAW));
             // 激活当前窗口
             this->raise();
@@ -596,10 +2296,145 @@ void Board::mouseReleaseEvent(QMouseEvent* event)
     QWidget::mouseReleaseEvent(event);
 }
 
+void Board::tabletEvent(QTabletEvent* event)
+{
+    if(!d->passThrough && d->mouseIsPress && !d->shaping && !d->selectionGesture() && event->type() == QEvent::TabletMove)
+    {
+        for(const QEventPoint& point : event->points())
+        {
+            d->queueInput(point.position(), point.pressure(), point.timestamp());
+        }
+    }
+
+    // 不接受事件，由 Qt 合成鼠标事件处理按下、抬起和光标
+    event->ignore();
+}
+
+void Board::wheelEvent(QWheelEvent* event)
+{
+    if(d->passThrough || d->mouseIsPress)
+    {
+        QWidget::wheelEvent(event);
+        return;
+    }
+
+    if(event->modifiers() & Qt::ControlModifier)
+    {
+        d->zoomView(std::pow(1.25, event->angleDelta().y() / 120.0), event->position());
+    }
+    else if(!d->magnifier.rect().isNull())
+    {
+        // 镜片显示时滚轮调整放大倍数
+        d->magnifier.setZoom(d->magnifier.zoom() * std::pow(1.25, event->angleDelta().y() / 120.0));
+        d->updateMagnifier(event->position());
+    }
+    else
+    {
+        QPointF delta = event->pixelDelta().isNull() ? QPointF(event->angleDelta()) / 2 : QPointF(event->pixelDelta());
+        d->panView(delta);
+    }
+    event->accept();
+}
+
+void Board::keyPressEvent(QKeyEvent* event)
+{
+    if(d->textBlock && !(event->modifiers() & Qt::ControlModifier))
+    {
+        QRectF damage;
+        switch (event->key()) {
+        case Qt::Key_Return:
+        case Qt::Key_Enter:
+            damage = d->textBlock->insert("\n");
+            break;
+        case Qt::Key_Backspace:
+            damage = d->textBlock->backspace();
+            break;
+        case Qt::Key_Delete:
+            damage = d->textBlock->remove();
+            break;
+        case Qt::Key_Left:
+        case Qt::Key_Right:
+        case Qt::Key_Up:
+        case Qt::Key_Down:
+        case Qt::Key_Home:
+        case Qt::Key_End:
+            damage = d->textBlock->moveCaret(event->key());
+            break;
+        default:
+            if(event->text().isEmpty() || !event->text().at(0).isPrint())
+            {
+                QWidget::keyPressEvent(event);
+                return;
+            }
+            damage = d->textBlock->insert(event->text());
+            break;
+        }
+        d->editText(damage);
+        return;
+    }
+
+    if(d->selection.isActive() && (event->key() == Qt::Key_Delete || event->key() == Qt::Key_Backspace))
+    {
+        d->deleteSelection();
+        return;
+    }
+
+    if(event->modifiers() & Qt::ControlModifier)
+    {
+        const QPointF center = QRectF(this->rect()).center();
+        switch (event->key()) {
+        case Qt::Key_0:
+            d->resetView();
+            return;
+        case Qt::Key_Equal:
+        case Qt::Key_Plus:
+            d->zoomView(1.25, center);
+            return;
+        case Qt::Key_Minus:
+            d->zoomView(0.8, center);
+            return;
+        default:
+            break;
+        }
+    }
+    QWidget::keyPressEvent(event);
+}
+
+void Board::inputMethodEvent(QInputMethodEvent* event)
+{
+    if(d->textBlock && !event->commitString().isEmpty())
+    {
+        d->editText(d->textBlock->insert(event->commitString()));
+    }
+    event->accept();
+}
+
+QVariant Board::inputMethodQuery(Qt::InputMethodQuery query) const
+{
+    if(d->textBlock)
+    {
+        switch (query) {
+        case Qt::ImEnabled:
+            return true;
+        case Qt::ImCursorRectangle:
+            return d->toWidget(d->textBlock->caretRect());
+        default:
+            break;
+        }
+    }
+    return QWidget::inputMethodQuery(query);
+}
+
 void Board::enterEvent(QEnterEvent* event)
 {
     // qDebug() << "enter" << event->position();
 
+    if(d->passThrough)
+    {
+        return;
+    }
+    d->restoreMemory();
+
     d->mousePosition = event->position();
     d->penRectF = drawPen(d->mousePosition);
 
@@ -615,87 +2450,84 @@ void Board::leaveEvent(QEvent* event)
     // d->setState((BoardPrivate::State)(d->state & ~BoardPrivate::SHOW_FOREGTOUND));
 }
 
-void Board::drawPoint(QPoint pointPos)
+QRectF Board::drawPoint(QPoint pointPos)
 {
-    if(d->state & BoardPrivate::READY_TO_DRAW)
-    {
-        const Pen* pen = d->controlPlatform->currentPen();
-        qreal alpha = qreal((qreal)pen->color().alpha() / (qreal)255);
+    InputSample sample;
+    sample.pos = d->toCanvas(pointPos);
+    d->pointBatch.resize(0);
+    d->pointBatch.append(sample);
 
-        if(alpha < 1.0 && !pen->isEraser())
-        {
-            QPainter p(&d->preBoradCanvas);
-            p.setRenderHint(QPainter::Antialiasing);
-            p.setPen(*pen);
-            p.setCompositionMode(QPainter::CompositionMode_Source);
-            p.drawPoint(pointPos);
-        }
-        else{
-            QPainter p(&d->boardCanvas);
-            p.setRenderHint(QPainter::Antialiasing);
-            p.setPen(*pen);
-            p.setCompositionMode(pen->isEraser() ? QPainter::CompositionMode_Clear : p.compositionMode());
-            p.drawPoint(pointPos);
-        }
-    }
+    return drawLine(sample.pos, d->pointBatch);
 }
 
-void Board::drawLine(QPoint lastMousePos, QPoint mousePos)
+QRectF Board::drawLine(QPointF lastMousePos, const QVector<InputSample>& samples)
 {
-    if(d->state & BoardPrivate::READY_TO_DRAW)
+    if(!(d->state & BoardPrivate::READY_TO_DRAW) || samples.isEmpty())
     {
-        const Pen* pen = d->controlPlatform->currentPen();
-        qreal alpha = qreal((qreal)pen->color().alpha() / (qreal)255);
-
-        if(alpha < 1.0 && !pen->isEraser())
-        {
-            QPainter painter(&d->preBoradCanvas);
-            painter.setRenderHint(QPainter::Antialiasing);
-            painter.setPen(*pen);
-            painter.setCompositionMode(QPainter::CompositionMode_Source);
-            painter.drawLine(lastMousePos, mousePos);
-        }
-        else
-        {
-            QPainter painter(&d->boardCanvas);
-            painter.setRenderHint(QPainter::Antialiasing);
-            painter.setPen(*pen);
-            painter.setCompositionMode(pen->isEraser() ? QPainter::CompositionMode_Clear : painter.compositionMode());
-            painter.drawLine(lastMousePos, mousePos);
-        }
+        return QRectF();
     }
-}
-
-QRectF Board::drawPen(QPointF mousePos)
-{
-    d->foregroundCanvas.fill(Qt::transparent);
+    TRACE_SCOPE_ARG("Board::drawLine", "samples", samples.size());
 
     const Pen* pen = d->controlPlatform->currentPen();
-    auto pix = pen->shape();
+    if(pen->isLaser())
+    {
+        return d->fadingInk->lineTo(lastMousePos, samples);
+    }
 
-    QPainter p(&d->foregroundCanvas);
-    // p.setPen(*p);
-    p.setRenderHint(QPainter::Antialiasing);
-    p.setPen(Qt::transparent);
-    p.setBrush(pen->color());
-    p.setCompositionMode(QPainter::CompositionMode_Source);
+    // 荧光笔整笔先写入预备层，线段重叠处不会反复加深
+    bool staging = StrokeRasterizer::needsStaging(pen->isHighlighter(), pen->isEraser(), pen->color().alpha());
+    if(staging)
+    {
+        d->preBoardMultiply = pen->isHighlighter();
+    }
 
-    QPainterPath path;
-    path.addEllipse(mousePos,pen->width() / 2, pen->width() / 2);
-    // p.drawEllipse();
+    // 整批采样渲染成一张遮罩，再单次合成到覆盖的瓦片
+    Layer* target = staging ? &d->preBoradCanvas : d->layers.current();
+    // 笔宽按屏幕像素计算，缩放后在画布上相应变粗或变细
+    // 只绘制可见区域加上一个笔宽的边距，低缩放下拖到窗口外也不会分配大片瓦片
+    const qreal width = pen->widthF() / d->viewZoom;
+    const int margin = int(std::ceil(width));
+    const QRect clip = d->toCanvas(this->rect()).adjusted(-margin, -margin, margin, margin);
+    QRect dirty = d->rasterizer.rasterize(lastMousePos, samples, width, clip);
+    if(dirty.isEmpty())
+    {
+        return QRectF();
+    }
 
-    p.drawPath(path);
+    struct{
+        StrokeRasterizer* rasterizer;
+        QColor color;
+        StrokeRasterizer::Mode mode;
+    } job{&d->rasterizer, pen->color(), StrokeRasterizer::modeFor(pen->isHighlighter(), pen->isEraser(), staging)};
+    // 橡皮擦不需要为空白区域分配瓦片；只捕获一个指针，std::function 不必在堆上保存闭包
+    target->forEachTile(dirty, job.mode != StrokeRasterizer::Clear, [&job](QImage* tile, const QPoint& origin){
+        job.rasterizer->composite(tile, origin, job.color, job.mode);
+    });
+    // 荧光笔随写随叠底到图层，底色取按下时的快照，显示的就是抬起后的结果
+    if(d->preBoardMultiply)
+    {
+        d->layers.current()->multiply(d->preBoradCanvas, d->lastUndoTiles, dirty);
+    }
 
-    Config* config = static_cast<DBApplication*>(qApp)->getSingleton<Config>();
-    ConfigHandle* handle = config->getConfigHandle(Config::INTERNAL);
-    Q_ASSERT(handle);
+    return dirty;
+}
+
+QRectF Board::drawPen(QPointF mousePos)
+{
+    TRACE_SCOPE("Board::drawPen");
+    if(d->foregroundPreview)
+    {
+        d->foregroundCanvas.fill(Qt::transparent);
+        d->foregroundPreview = false;
+    }
 
-    if(handle->getBool("display.pen"))
+    const Pen* pen = d->controlPlatform->currentPen();
+    if(pen != d->cursorPen || pen->color().rgba() != d->cursorColor || pen->width() != d->cursorWidth)
     {
-        mousePos.setY(mousePos.y() - pix.height());
-        p.drawPixmap(mousePos, pix);
+        ALLOCATION_EXPECTED_SCOPE();
+        d->updateCursorSprite();
     }
-    path.addRect(QRectF(mousePos.x(), mousePos.y(), pix.size().width(), pix.size().height()));
 
-    return path.boundingRect();
+    d->cursorRect = QRectF(mousePos + d->cursorOffset, d->cursorSprite.size());
+    return d->cursorRect;
 }
@@ -1,9 +1,13 @@
 #ifndef BOARD_H
 #define BOARD_H
 
+#include "inputbuffer.h"
+
 #include <QWidget>
 
 class Drawer;
+class LatencyProbe;
+class StrokeSimplifier;
 class BoardPrivate;
 
 class Board : public QWidget
@@ -17,19 +21,45 @@ public:
 
     QPixmap save();
     QPixmap save(bool withBackground);
+
+    // 延时录像写入 path，之后每次提交只记录变化的区域
+    bool startRecording(const QString& path);
+    void stopRecording();
+    bool isRecording() const;
+
+    // 自动化接口，坐标为窗口坐标，与鼠标操作走同一条绘制路径
+    Drawer* drawer() const;
+    void injectPress(const QPointF& pos);
+    // 注入的点在下一次刷新前合并成一批绘制
+    void injectMove(const QVector<QPointF>& points);
+    void injectRelease(const QPointF& pos);
+    void clearLayer();
+    // 输入到上屏的延迟统计
+    LatencyProbe* latency() const;
+    // 在线化简前后的采样数
+    const StrokeSimplifier& simplifier() const;
 protected:
+    virtual bool event(QEvent* event) override;
     virtual bool eventFilter(QObject* watched, QEvent* event) override;
     virtual void paintEvent(QPaintEvent* event) override;
+    virtual void showEvent(QShowEvent* event) override;
+    virtual void hideEvent(QHideEvent* event) override;
     virtual void resizeEvent(QResizeEvent* event) override;
     virtual void mouseMoveEvent(QMouseEvent* event) override;
     virtual void mousePressEvent(QMouseEvent* event) override;
     virtual void mouseReleaseEvent(QMouseEvent* event) override;
+    virtual void tabletEvent(QTabletEvent* event) override;
+    virtual void wheelEvent(QWheelEvent* event) override;
+    virtual void keyPressEvent(QKeyEvent* event) override;
+    virtual void inputMethodEvent(QInputMethodEvent* event) override;
+    virtual QVariant inputMethodQuery(Qt::InputMethodQuery query) const override;
     virtual void enterEvent(QEnterEvent* event) override;
     virtual void leaveEvent(QEvent* event) override;
 
 protected:
-    void drawPoint(QPoint pointPos);
-    void drawLine(QPoint lastMousePos, QPoint mousePos);
+    QRectF drawPoint(QPoint pointPos);
+    // 采样和返回的脏区域都是画布坐标
+    QRectF drawLine(QPointF lastMousePos, const QVector<InputSample>& samples);
     QRectF drawPen(QPointF mousePos);
 
 private:
@@ -1,17 +1,43 @@
 #ifndef BOARDPRIVATE_H
 #define BOARDPRIVATE_H
 
+#include "floatingselection.h"
+#include "inputbuffer.h"
+#include "latencyprobe.h"
+#include "layer.h"
+#include "layerstack.h"
+#include "magnifier.h"
+#include "pen.h"
+#include "strokeprotocol.h"
+#include "strokerasterizer.h"
+#include "strokesimplifier.h"
+#include "timelapse.h"
+
+#include <QHash>
 #include <QImage>
+#include <QPainterPath>
 #include <QPixmap>
+#include <QRegion>
 #include <QStack>
+#include <QTransform>
 
 class QPainter;
 class QPoint;
+class QTimer;
 class QUndoStack;
+class QVariantAnimation;
 
 class Board;
 class Drawer;
+class FadingInk;
 class Preview;
+class StrokeShare;
+class TextBlock;
+class TilePyramid;
+
+namespace TOOLS {
+    class UndoRedoCommand;
+}
 
 class BoardPrivate{
 public:
@@ -25,31 +51,151 @@ public:
 
         READY_TO_DRAW = SHOW_BACKGROUND | SHOW_BOARD | SHOW_FOREGTOUND | SHOW_CONTROL,
     };
+    // 对端正在画的一笔，半透明和荧光笔先写入各自的预备层
+    struct RemoteStroke{
+        StrokeProtocol::PenState pen;
+        bool drawing = false;
+        // 本地落笔时被提前提交，抬起后接着画
+        bool resume = false;
+        QPointF last;
+        quint32 layerId = 0;
+        Layer::Tiles before;
+        Layer staging{QSize(), MemoryStats::STAGING};
+        StrokeRasterizer rasterizer;
+    };
+    // 本地笔画进行中收到的包，left 表示对端已断开
+    struct RemotePacket{
+        quint32 peer;
+        QVector<StrokeProtocol::Message> messages;
+        bool left;
+    };
 private:
     BoardPrivate(Board* _q);
     ~BoardPrivate();
 
 public:
-    void drawBackgroundImg(QPainter* p);
-    void drawBoardImg(QPainter* p);
-    void drawPreBoardImg(QPainter* p);
-    void drawForeGroundImg(QPainter* p);
+    void drawBackgroundImg(QPainter* p, const QRect& r = QRect());
+    void drawBoardImg(QPainter* p, const QRect& r = QRect());
+    void drawPreBoardImg(QPainter* p, const QRect& r = QRect());
+    void drawStaging(QPainter* p, const QRect& rect, const Layer& staging) const;
+    void drawForeGroundImg(QPainter* p, const QRect& r = QRect());
+    void drawDrawerSurface(QPainter* p);
+    // 在界面线程准备 r 内需要的合成缓存，之后的绘制只读
+    void prepareBoard(const QRect& r);
+    void commitPyramid(bool full = false);
     void pressPreBoard();
+    // 形状工具：拖动时只在叠加层预览，抬起时一次性写入图层
+    QPainterPath shapePath(Pen::Tool tool, const QPointF& from, const QPointF& to, qreal width) const;
+    void updateShapePreview(const QPointF& pos, Qt::KeyboardModifiers modifiers);
+    void drawShapePreview(QPainter* p, const QRect& r);
+    QRect commitShape();
+    // 文字工具：编辑中的文字只在叠加层显示，结束编辑时写入图层
+    void beginText(const QPointF& pos);
+    void editText(const QRectF& damage);
+    void drawTextPreview(QPainter* p, const QRect& r);
+    void commitText();
+    void drawFadingInk(QPainter* p, const QRect& r);
+    // 放大镜工具选中且画面冻结时在 pos 处显示镜片，否则隐藏
+    void updateMagnifier(const QPointF& pos);
+    void drawMagnifier(QPainter* p, const QRect& r);
+    // 以当前视口内看到的内容为参考填充，冻结时包含截图背景
+    void fillAt(const QPointF& pos);
+    // 套索工具：抬起和放下各记一次撤销，浮动期间只刷新选区前后的范围
+    bool selectionGesture() const;
+    void pressSelection(const QPointF& pos);
+    void moveSelection(const QPointF& pos, Qt::KeyboardModifiers modifiers);
+    void releaseSelection();
+    void commitSelection();
+    void deleteSelection();
+    void drawSelection(QPainter* p, const QRect& r);
+    QRect selectionWidgetRect() const;
+    // 改动已经生效，命令只保存改动瓦片的另一个版本，撤销和重做时与图层交换
+    TOOLS::UndoRedoCommand* createLayerChange(quint32 id, const Layer::Tiles& before, const Layer::Tiles& after);
+    void pushLayerChange(quint32 id, const Layer::Tiles& before, const Layer::Tiles& after);
+    void addLayer();
+    void removeLayer();
+    void moveLayer(int delta);
+    void clearLayer();
+    void syncLayers();
+    // 其他实例同步来的笔画，每个包渲染一次，抬笔时提交并记录撤销
+    StrokeProtocol::PenState sharedPen() const;
+    void applyRemote(quint32 peer, const QVector<StrokeProtocol::Message>& messages);
+    QRect drawRemote(RemoteStroke& stroke, const QVector<InputSample>& samples);
+    QRect commitRemote(RemoteStroke& stroke);
+    void removeRemote(quint32 peer);
+    // 本地落笔时提交对端画了一半的笔画，抬起前收到的包先排队，
+    // 两边的撤销记录都只包含自己的改动
+    void suspendRemote();
+    void resumeRemote();
+    void queueInput(const QPointF& pos, qreal pressure, quint64 timestamp);
+    void drainInput();
+    void updateCursorSprite();
+    void updateMemoryStats();
+    void enterPassThrough();
+    void leavePassThrough();
+    // 图层改动后调用，r 为窗口坐标，为空时整个画面失效
+    void invalidatePassThrough(const QRect& r = QRect());
+    void scheduleTrim();
+    void trimMemory();
+    void restoreMemory();
 
     void savaState();
     void restoreState();
     void setState(State s);
 
+    // 视图变换：窗口坐标 = 画布坐标 * viewZoom + viewOffset
+    QTransform viewTransform() const;
+    bool viewIsIdentity() const;
+    QPointF toCanvas(const QPointF& p) const;
+    QRect toCanvas(const QRect& r) const;
+    QRect toWidget(const QRectF& r) const;
+    void zoomView(qreal factor, const QPointF& anchor);
+    void panView(const QPointF& delta);
+    void resetView();
+
     bool showOrHideDrawer(QPoint p);
+    bool drawerVisible() const;
+    void hideDrawer();
+    void slideDrawer(const QRect& from, const QRect& to, int duration, bool hideOnFinished);
+    void stopDrawerAnimation();
 
 
     friend class Board;
     Board* q = nullptr;
 
-    QPixmap backgroundCanvas;
-    QPixmap boardCanvas;
-    QPixmap preBoradCanvas;
-    QPixmap foregroundCanvas;
+    QImage backgroundCanvas;
+    LayerStack layers;
+    TilePyramid* pyramid = nullptr;
+    // 与缩略层级共用提交后的合成结果
+    TimelapseRecorder recorder;
+    // 缩略层级中尚未更新、需要从第 0 级绘制的画布区域
+    QRegion viewStale;
+    qreal viewZoom = 1.0;
+    QPointF viewOffset;
+    bool panning = false;
+    QPointF panLastPos;
+    Layer preBoradCanvas;
+    // 预备层中是荧光笔笔画，绘制时以按下时的图层为底叠底写入图层，预备层本身不显示
+    bool preBoardMultiply = false;
+    QImage foregroundCanvas;
+    // 大面积刷新时由线程池合成，再整体贴到窗口
+    QImage backingImage;
+    MemoryTracker backgroundTracker{MemoryStats::BACKGROUND};
+    MemoryTracker foregroundTracker{MemoryStats::FOREGROUND};
+    MemoryTracker backingTracker{MemoryStats::BACKING};
+    MemoryTracker screenTracker{MemoryStats::SCREENSHOT};
+
+    // 穿透状态只显示一张静态画面，不跟踪鼠标
+    bool passThrough = false;
+    QImage passThroughFrame;
+    // 穿透期间图层被其他实例或控制命令改动的区域，下次绘制时重画到静态画面中
+    QRegion passThroughStale;
+
+    // 隐藏或穿透状态下空闲一段时间后回收内存
+    QTimer* idleTrimTimer = nullptr;
+    bool trimmed = false;
+    QByteArray screenCompressed;
+    QSize screenCompressedSize;
 
     QPixmap screenPixmap;
     bool freeze = false;
@@ -58,17 +204,73 @@ public:
     QStack<State> stateStack;
 
     bool mouseIsPress = false;
-    QPoint mouseLastPos;
+    QPointF mouseLastPos;
+
+    // 画布坐标；shapeRegion 为预览上一帧占用的窗口区域
+    bool shaping = false;
+    QPointF shapeAnchor;
+    QPointF shapeCurrent;
+    QRegion shapeRegion;
+
+    TextBlock* textBlock = nullptr;
+
+    // 激光笔迹，淡出期间逐帧只刷新各笔画的范围
+    FadingInk* fadingInk = nullptr;
+
+    Magnifier magnifier;
+
+    // 套索点为画布坐标；selectionGrab 为拖动开始时的位置和选区范围
+    bool lassoing = false;
+    QPolygonF lassoPolygon;
+    FloatingSelection selection;
+    FloatingSelection::Handle selectionDrag = FloatingSelection::NONE;
+    QPointF selectionGrab;
+    QRectF selectionGrabRect;
+    quint32 selectionLayer = 0;
+    bool selectionPushing = false;
+
+    StrokeShare* share = nullptr;
+    QHash<quint32, RemoteStroke> remoteStrokes;
+    QVector<RemotePacket> remoteQueue;
+
+    InputBuffer inputBuffer;
+    LatencyProbe latency;
+    QVector<InputSample> inputBatch;
+    QVector<InputSample> pointBatch;
+    // 化简后的采样，绘制、发送和激光笔迹都只用这些点
+    QVector<InputSample> strokeBatch;
+    StrokeSimplifier simplifier;
+    // 屏幕像素，0 表示不化简
+    qreal simplifyTolerance = 0;
+    StrokeRasterizer rasterizer;
 
     Drawer* controlPlatform = nullptr;
     QRect savedControlPlatformGeometry;
+    // 动画期间用缓存画面代替 Drawer 本身
+    QPixmap drawerSurface;
+    QRect drawerSurfaceRect;
+    QVariantAnimation* drawerAnimation = nullptr;
+    bool drawerTargetVisible = false;
 
     Preview* previewPort = nullptr;
 
-    std::function<void(void)> lastUndo = nullptr;
+    // 按下时的图层和快照，抬起时与之比较生成撤销记录
+    quint32 lastUndoLayer = 0;
+    Layer::Tiles lastUndoTiles;
 
     QPointF mousePosition;
     QRectF penRectF;
+
+    // 光标预先画成精灵，移动时只改位置；换笔、颜色或笔宽变化时重新生成
+    QImage cursorSprite;
+    QPoint cursorOffset;
+    QRectF cursorRect;
+    const Pen* cursorPen = nullptr;
+    QRgb cursorColor = 0;
+    int cursorWidth = -1;
+    bool displayPen = true;
+    // 前景画布上有调整笔宽或颜色时的预览点，光标移动时清除一次
+    bool foregroundPreview = false;
 };
 
 #endif // BOARDPRIVATE_H
@@ -0,0 +1,88 @@
+#include "compositor.h"
+#include "trace.h"
+
+#include <QAtomicInt>
+#include <QPainter>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
+
+namespace {
+const int STRIPE_HEIGHT = 64;
+// 线程池之外再限制的辅助线程数，-1 表示不限制
+int helperLimit = -1;
+
+QThreadPool* compositePool()
+{
+    static QThreadPool* pool = [](){
+        QThreadPool* p = new QThreadPool;
+        p->setMaxThreadCount(qMax(1, QThread::idealThreadCount() - 1));
+        p->setExpiryTimeout(5000);
+        return p;
+    }();
+    return pool;
+}
+}
+
+void Compositor::composite(QImage* target, const QRect& r, const StripePainter& paint)
+{
+    const QRect area = r & target->rect();
+    if(area.isEmpty())
+    {
+        return;
+    }
+    TRACE_SCOPE_ARG("Compositor::composite", "pixels", area.width() * area.height());
+
+    // 在当前线程完成 detach，之后各条带只写自己的行
+    uchar* bits = target->bits();
+    const qsizetype bpl = target->bytesPerLine();
+    const int stripeCount = (area.height() + STRIPE_HEIGHT - 1) / STRIPE_HEIGHT;
+
+    QAtomicInt next(0);
+    auto work = [&](){
+        int i;
+        while((i = next.fetchAndAddRelaxed(1)) < stripeCount)
+        {
+            TRACE_SCOPE("Compositor::stripe");
+            const int y0 = area.top() + i * STRIPE_HEIGHT;
+            const int h = qMin(STRIPE_HEIGHT, area.bottom() + 1 - y0);
+            QRect stripe(area.left(), y0, area.width(), h);
+
+            // 不拥有内存的视图，只覆盖本条带的行
+            QImage view(bits + y0 * bpl, target->width(), h, bpl, target->format());
+            QPainter p(&view);
+            p.translate(0, -y0);
+            p.setClipRect(stripe);
+            p.setCompositionMode(QPainter::CompositionMode_Source);
+            p.fillRect(stripe, Qt::transparent);
+            p.setCompositionMode(QPainter::CompositionMode_SourceOver);
+            paint(&p, stripe);
+        }
+    };
+
+    QThreadPool* pool = compositePool();
+    const int helpers = qMin(threadCount() - 1, stripeCount - 1);
+    QSemaphore done;
+    for(int i = 0; i < helpers; ++i)
+    {
+        pool->start([&work, &done](){
+            work();
+            done.release();
+        });
+    }
+
+    // 条带由共享计数器动态领取，空闲线程自动接手剩余部分
+    work();
+    done.acquire(helpers);
+}
+
+void Compositor::setThreadCount(int threads)
+{
+    helperLimit = threads > 0 ? threads - 1 : -1;
+}
+
+int Compositor::threadCount()
+{
+    const int helpers = compositePool()->maxThreadCount();
+    return 1 + (helperLimit < 0 ? helpers : qMin(helpers, helperLimit));
+}
@@ -0,0 +1,20 @@
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include <functional>
+
+#include <QImage>
+
+class QPainter;
+
+namespace Compositor {
+    using StripePainter = std::function<void(QPainter* p, const QRect& stripe)>;
+
+    // 把 r 切成条带并行合成到 target，调用线程也参与；paint 只能读取不可变的 QImage
+    void composite(QImage* target, const QRect& r, const StripePainter& paint);
+    // 参与合成的线程数上限，包括调用线程；不大于 0 时使用全部核心，用于测量扩展性
+    void setThreadCount(int threads);
+    int threadCount();
+}
+
+#endif // COMPOSITOR_H
@@ -1,5 +1,6 @@
 #include "config.h"
 #include "dbapplication.h"
+#include "trace.h"
 
 #include <QDir>
 #include <QJsonDocument>
@@ -24,7 +25,25 @@ const char * DEFAULT_CONFIG = R"({
 "language":"\u7b80\u4f53\u4e2d\u6587",
 "key.global.draw":"f4",
 "download.with.background":false,
-"display.pen":true
+"display.pen":true,
+"memory.budget":0,
+"idle.trim.delay":30,
+"laser.fade.duration":2000,
+"magnifier.zoom":2,
+"magnifier.radius":120,
+"fill.tolerance":32,
+"timelapse.frame.interval":40,
+"timelapse.stats":false,
+"share.mode":"off",
+"share.name":"DrawingBoard",
+"share.host":"",
+"share.bind":"127.0.0.1",
+"share.port":0,
+"control.name":"",
+"trace.file":"",
+"trace.capacity":65536,
+"latency.enabled":false,
+"stroke.simplify.tolerance":0.25
 })";
 
 DBApplication* app = static_cast<DBApplication*>(qApp);
@@ -121,6 +140,7 @@ QVariant Config::getValue(const QString& id)
 
 void Config::flush()
 {
+    TRACE_SCOPE("Config::flush");
     if(!settingFile.isOpen())
     {
         if(!settingFile.open(QIODevice::WriteOnly | QIODevice::Text))
@@ -0,0 +1,387 @@
+#include "controlserver.h"
+
+#include "allocationcounter.h"
+#include "board.h"
+#include "dbapplication.h"
+#include "drawer.h"
+#include "latencyprobe.h"
+#include "memorystats.h"
+#include "strokesimplifier.h"
+#include "trace.h"
+
+#include <QColor>
+#include <QFile>
+#include <QDebug>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QPixmap>
+#include <QTimer>
+#include <QUndoStack>
+#include <QtMath>
+
+#include <utility>
+
+ControlServer::ControlServer(QObject *parent)
+    : QObject{parent}
+{
+    applyTimer = new QTimer(this);
+    applyTimer->setSingleShot(true);
+    applyTimer->setInterval(0);
+    connect(applyTimer, &QTimer::timeout, this, &ControlServer::applyPending);
+
+    replayTimer = new QTimer(this);
+    replayTimer->setTimerType(Qt::PreciseTimer);
+    connect(replayTimer, &QTimer::timeout, this, &ControlServer::replayNext);
+}
+
+bool ControlServer::listen(const QString& name)
+{
+    server = new QLocalServer(this);
+    server->setSocketOptions(QLocalServer::UserAccessOption);
+    // 上次异常退出可能留下同名套接字文件
+    QLocalServer::removeServer(name);
+    if(!server->listen(name))
+    {
+        qDebug() << "control listen failed" << name << server->errorString();
+        return false;
+    }
+
+    connect(server, &QLocalServer::newConnection, this, [this](){
+        while(QLocalSocket* socket = server->nextPendingConnection())
+        {
+            connect(socket, &QLocalSocket::readyRead, this, [this, socket](){
+                read(socket);
+            });
+            connect(socket, &QLocalSocket::disconnected, socket, &QLocalSocket::deleteLater);
+        }
+    });
+    return true;
+}
+
+void ControlServer::setBoard(Board* board)
+{
+    this->board = board;
+}
+
+void ControlServer::read(QLocalSocket* socket)
+{
+    while(socket->canReadLine())
+    {
+        pending.append(Command{socket, socket->readLine().trimmed()});
+    }
+    if(!pending.isEmpty() && !applyTimer->isActive())
+    {
+        applyTimer->start();
+    }
+}
+
+void ControlServer::applyPending()
+{
+    ++batches;
+    const QVector<Command> batch = std::exchange(pending, QVector<Command>());
+    for(const Command& c : batch)
+    {
+        if(c.line.isEmpty())
+        {
+            continue;
+        }
+        ++commands;
+        const QByteArray reply = apply(c.line);
+        if(c.socket)
+        {
+            c.socket->write(reply + '\n');
+        }
+    }
+}
+
+QByteArray ControlServer::apply(const QByteArray& line)
+{
+    const QList<QByteArray> args = line.simplified().split(' ');
+    const QByteArray& cmd = args.first();
+
+    if(cmd == "open")
+    {
+        if(!board)
+        {
+            emit openRequested();
+        }
+        return board ? "ok" : "error board unavailable";
+    }
+    if(cmd == "stats")
+    {
+        return stats();
+    }
+    if(cmd == "trace")
+    {
+        // 导出到目前为止的追踪记录，之后继续记录
+        const QString path = QString::fromUtf8(line.mid(cmd.size()).trimmed());
+        if(path.isEmpty())
+        {
+            return "error missing path";
+        }
+        if(!Trace::isEnabled())
+        {
+            return "error tracing disabled";
+        }
+        return Trace::dump(path) ? "ok" : "error dump failed";
+    }
+    if(!board)
+    {
+        return "error board not open";
+    }
+
+    if(cmd == "close")
+    {
+        board->close();
+        return "ok";
+    }
+    if(cmd == "pen")
+    {
+        return board->drawer()->selectPen(QString::fromUtf8(args.value(1))) ? "ok" : "error unknown pen";
+    }
+    if(cmd == "color")
+    {
+        const QColor c(QString::fromLatin1(args.value(1)));
+        if(!c.isValid())
+        {
+            return "error invalid color";
+        }
+        board->drawer()->setPenColor(c);
+        return "ok";
+    }
+    if(cmd == "size")
+    {
+        bool ok = false;
+        const int size = args.value(1).toInt(&ok);
+        if(!ok || size < 1 || size > 100)
+        {
+            return "error size out of range";
+        }
+        board->drawer()->setPenSize(size);
+        return "ok";
+    }
+    if(cmd == "down" || cmd == "move" || cmd == "up" || cmd == "stroke")
+    {
+        if(!parsePoints(args, 1, &points) || ((cmd == "down" || cmd == "up") && points.size() != 1))
+        {
+            return "error invalid points";
+        }
+        injectedPoints += points.size();
+
+        if(cmd == "down")
+        {
+            board->injectPress(points.first());
+        }
+        else if(cmd == "move")
+        {
+            board->injectMove(points);
+        }
+        else if(cmd == "up")
+        {
+            board->injectRelease(points.first());
+        }
+        else
+        {
+            // 首点落笔，末点抬笔，中间的点一次注入
+            const QPointF last = points.last();
+            board->injectPress(points.first());
+            points.removeFirst();
+            board->injectMove(points);
+            board->injectRelease(last);
+        }
+        return "ok";
+    }
+    if(cmd == "clear")
+    {
+        board->clearLayer();
+        return "ok";
+    }
+    if(cmd == "latency")
+    {
+        return latency(args);
+    }
+    if(cmd == "undo" || cmd == "redo")
+    {
+        QUndoStack* undoStack = static_cast<DBApplication*>(qApp)->getSingleton<QUndoStack>();
+        Q_ASSERT(undoStack);
+        if(cmd == "undo")
+        {
+            undoStack->undo();
+        }
+        else
+        {
+            undoStack->redo();
+        }
+        return "ok";
+    }
+    if(cmd == "export")
+    {
+        // 路径可以包含空格，取命令之后的整行
+        const QString path = QString::fromUtf8(line.mid(cmd.size()).trimmed());
+        if(path.isEmpty())
+        {
+            return "error missing path";
+        }
+        return board->save(true).save(path) ? "ok" : "error save failed";
+    }
+    return "error unknown command";
+}
+
+bool ControlServer::parsePoints(const QList<QByteArray>& args, int from, QVector<QPointF>* out)
+{
+    out->resize(0);
+    if(args.size() <= from || (args.size() - from) % 2 != 0)
+    {
+        return false;
+    }
+
+    for(int i = from; i < args.size(); i += 2)
+    {
+        bool okx = false;
+        bool oky = false;
+        const qreal x = args.at(i).toDouble(&okx);
+        const qreal y = args.at(i + 1).toDouble(&oky);
+        if(!okx || !oky)
+        {
+            return false;
+        }
+        out->append(QPointF(x, y));
+    }
+    return true;
+}
+
+QByteArray ControlServer::latency(const QList<QByteArray>& args)
+{
+    LatencyProbe* probe = board->latency();
+    const QByteArray sub = args.value(1, "report");
+    if(sub == "on" || sub == "off")
+    {
+        probe->setEnabled(sub == "on");
+        return "ok";
+    }
+    if(sub == "reset")
+    {
+        probe->reset();
+        return "ok";
+    }
+    if(sub == "report")
+    {
+        // 合成输入或回放结束前 replaying 为真，调用方据此等待
+        QJsonObject report = probe->toJson();
+        report.insert("replaying", replayTimer->isActive());
+        return QJsonDocument(report).toJson(QJsonDocument::Compact);
+    }
+    if(replayTimer->isActive())
+    {
+        return "error replay running";
+    }
+
+    if(sub == "synthetic")
+    {
+        bool ok = false;
+        const int width = args.value(2).toInt(&ok);
+        const int count = args.value(3, "2000").toInt();
+        const int hz = args.value(4, "1000").toInt();
+        if(!ok || width < 1 || width > 100 || count < 2 || hz < 1)
+        {
+            return "error invalid arguments";
+        }
+
+        // 李萨如曲线铺满画板中部，方向不断变化，覆盖各个瓦片
+        const QSizeF size = board->size();
+        const QPointF center(size.width() / 2, size.height() / 2);
+        auto point = [&](int i){
+            const qreal t = 2 * M_PI * i / count;
+            const QPointF p = center + QPointF(qSin(3 * t) * size.width() * 0.4, qSin(2 * t) * size.height() * 0.4);
+            return QByteArray::number(p.x(), 'f', 1) + ' ' + QByteArray::number(p.y(), 'f', 1);
+        };
+
+        QList<QByteArray> lines;
+        lines << "pen pencil" << "size " + QByteArray::number(width) << "down " + point(0);
+        for(int i = 1; i < count - 1; ++i)
+        {
+            lines << "move " + point(i);
+        }
+        lines << "up " + point(count - 1);
+        startReplay(lines, hz);
+        return "ok";
+    }
+    if(sub == "replay")
+    {
+        QFile file(QString::fromUtf8(args.value(2)));
+        if(!file.open(QIODevice::ReadOnly))
+        {
+            return "error " + file.errorString().toUtf8();
+        }
+        const int hz = args.value(3, "1000").toInt();
+        if(hz < 1)
+        {
+            return "error invalid arguments";
+        }
+
+        QList<QByteArray> lines;
+        while(!file.atEnd())
+        {
+            const QByteArray line = file.readLine().trimmed();
+            if(!line.isEmpty() && !line.startsWith('#'))
+            {
+                lines << line;
+            }
+        }
+        startReplay(lines, hz);
+        return "ok";
+    }
+    return "error unknown latency command";
+}
+
+void ControlServer::startReplay(const QList<QByteArray>& lines, int hz)
+{
+    board->latency()->setEnabled(true);
+    replay = lines;
+    // QTimer 精度为毫秒，更高的频率按 1ms 执行
+    replayTimer->start(qMax(1, 1000 / hz));
+}
+
+void ControlServer::replayNext()
+{
+    if(replay.isEmpty() || !board)
+    {
+        // 结果由 latency report 读取
+        replayTimer->stop();
+        replay.clear();
+        return;
+    }
+
+    const QByteArray line = replay.takeFirst();
+    const QByteArray reply = apply(line);
+    if(reply != "ok")
+    {
+        qDebug() << "replay" << line << reply;
+    }
+}
+
+QByteArray ControlServer::stats() const
+{
+    QJsonObject control;
+    control.insert("commands", qint64(commands));
+    control.insert("points", qint64(injectedPoints));
+    control.insert("batches", qint64(batches));
+
+    QJsonObject simplify;
+    if(board)
+    {
+        simplify.insert("input", qint64(board->simplifier().inputPoints()));
+        simplify.insert("kept", qint64(board->simplifier().outputPoints()));
+    }
+
+    QJsonObject obj;
+    obj.insert("board", !board.isNull());
+    obj.insert("recording", board && board->isRecording());
+    obj.insert("control", control);
+    obj.insert("simplify", simplify);
+    obj.insert("memory", MemoryStats::instance()->toJson());
+    obj.insert("allocations", AllocationCounter::toJson());
+    return QJsonDocument(obj).toJson(QJsonDocument::Compact);
+}
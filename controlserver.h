@@ -0,0 +1,64 @@
+#ifndef CONTROLSERVER_H
+#define CONTROLSERVER_H
+
+#include <QObject>
+#include <QPointF>
+#include <QPointer>
+#include <QVector>
+
+class Board;
+class QLocalServer;
+class QLocalSocket;
+class QTimer;
+
+// 本地套接字上的自动化命令，每行一条，按收到的顺序各回复一行
+// 同一轮事件循环内收到的命令集中执行，连续的 move 只触发一次绘制
+//   open | close | pen <name> | color <#rrggbb|#aarrggbb> | size <n>
+//   down <x> <y> | move <x> <y> [<x> <y> ...] | up <x> <y> | stroke <x> <y> ...
+//   clear | undo | redo | export <path> | stats | trace <path>
+//   latency [on | off | reset | report] | latency synthetic <width> [<points>] [<hz>] | latency replay <path> [<hz>]
+// 合成输入和回放按固定频率逐行执行，延迟分布用 latency report 读取，其中 replaying 表示是否仍在执行
+class ControlServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ControlServer(QObject *parent = nullptr);
+
+    bool listen(const QString& name);
+    void setBoard(Board* board);
+    // args[from] 起成对的坐标，离线渲染读取记录时也使用
+    static bool parsePoints(const QList<QByteArray>& args, int from, QVector<QPointF>* out);
+
+signals:
+    // 由托盘创建画板，之后通过 setBoard 传回
+    void openRequested();
+
+private:
+    struct Command{
+        QPointer<QLocalSocket> socket;
+        QByteArray line;
+    };
+
+    void read(QLocalSocket* socket);
+    void applyPending();
+    QByteArray apply(const QByteArray& line);
+    QByteArray latency(const QList<QByteArray>& args);
+    void startReplay(const QList<QByteArray>& lines, int hz);
+    void replayNext();
+    QByteArray stats() const;
+
+private:
+    QLocalServer* server = nullptr;
+    QPointer<Board> board;
+    QVector<Command> pending;
+    QTimer* applyTimer = nullptr;
+    QVector<QPointF> points;
+    QTimer* replayTimer = nullptr;
+    QList<QByteArray> replay;
+
+    quint64 commands = 0;
+    quint64 injectedPoints = 0;
+    quint64 batches = 0;
+};
+
+#endif // CONTROLSERVER_H
@@ -1,5 +1,8 @@
 #include "config.h"
 #include "dbapplication.h"
+#include "glyphcache.h"
+#include "memorystats.h"
+#include "trace.h"
 
 #include <QDir>
 #include <QStandardPaths>
@@ -9,8 +12,23 @@
 DBApplication::DBApplication(int& argc, char** argv)
     :QApplication(argc, argv)
 {
-    registerSingleton(new Config(this));
+    Config* config = new Config(this);
+    registerSingleton(config);
     registerSingleton(new QUndoStack(this));
+
+    MemoryStats* memoryStats = new MemoryStats(this);
+    memoryStats->setBudget(qint64(config->getConfigHandle(Config::INTERNAL)->getInt("memory.budget")) * 1024 * 1024);
+    registerSingleton(memoryStats);
+
+    // 配置了追踪文件时从启动开始记录，退出时导出
+    ConfigHandle* handle = config->getConfigHandle(Config::INTERNAL);
+    if(!handle->getString("trace.file").isEmpty())
+    {
+        Trace::start(handle->getInt("trace.capacity"));
+    }
+
+    // 文字批注共用的字形图集
+    registerSingleton(new GlyphCache(this));
 }
 
 QString DBApplication::applicationDataDir(bool mk)
@@ -3,10 +3,13 @@
 #include "dbapplication.h"
 #include "tools.h"
 #include "config.h"
+#include "trace.h"
 
 #include <capabilitybutton.h>
 
 #include <QButtonGroup>
+#include <QCheckBox>
+#include <QComboBox>
 #include <QColorDialog>
 #include <QHBoxLayout>
 #include <QKeyEvent>
@@ -17,6 +20,7 @@
 #include <QBoxLayout>
 #include <QDateTime>
 #include <QLineEdit>
+#include <QResizeEvent>
 #include <QSpinBox>
 
 
@@ -102,22 +106,229 @@ public:
     }
 
     QPixmap shape() const override{
-        return QPixmap(penShapeFile);
+        if(shapeCache.isNull())
+        {
+            shapeCache = QPixmap(penShapeFile);
+            updateTracker();
+        }
+        return shapeCache;
     }
 
     QPixmap staticShape() const override{
-        return QPixmap(penStaticShapeFile);
+        if(staticShapeCache.isNull())
+        {
+            staticShapeCache = QPixmap(penStaticShapeFile);
+            updateTracker();
+        }
+        return staticShapeCache;
     }
 
     bool isEraser() const override{
         return isEr;
     }
 
+private:
+    void updateTracker() const{
+        auto bytes = [](const QPixmap& pix){
+            return qint64(pix.width()) * pix.height() * pix.depth() / 8;
+        };
+        tracker.update(bytes(shapeCache) + bytes(staticShapeCache));
+    }
+
 private:
     QString penName;
     QString penShapeFile;
     QString penStaticShapeFile;
     bool isEr = false;
+
+    // 解码后的图标只保留一份
+    mutable QPixmap shapeCache;
+    mutable QPixmap staticShapeCache;
+    mutable MemoryTracker tracker{MemoryStats::PEN_SHAPE};
+};
+
+
+// 形状工具的图标直接绘制，不需要图片资源
+class ShapePen : public Pen
+{
+public:
+    ShapePen(const QString& name, Tool t)
+        :Pen(Qt::SolidPattern, 1, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin)
+        ,penName(name), penTool(t)
+    {}
+
+    QString name() const override{
+        return penName;
+    }
+
+    QPixmap shape() const override{
+        if(shapeCache.isNull())
+        {
+            shapeCache = QPixmap(32, 32);
+            shapeCache.fill(Qt::transparent);
+
+            QPainter p(&shapeCache);
+            p.setRenderHint(QPainter::Antialiasing);
+            drawGlyph(&p, QRectF(4, 4, 24, 24), QColor(60, 60, 60));
+            updateTracker();
+        }
+        return shapeCache;
+    }
+
+    QPixmap staticShape() const override{
+        if(staticShapeCache.isNull())
+        {
+            // 与其他笔的图标一样是竖直的笔身，顶部画出形状
+            staticShapeCache = QPixmap(30, 80);
+            staticShapeCache.fill(Qt::transparent);
+
+            QPainter p(&staticShapeCache);
+            p.setRenderHint(QPainter::Antialiasing);
+            p.setPen(QPen(QColor(90, 90, 90), 1));
+            p.setBrush(QColor(235, 235, 235));
+            p.drawRoundedRect(QRectF(3.5, 0.5, 23, 79), 4, 4);
+            drawGlyph(&p, QRectF(7, 6, 16, 16), QColor(40, 40, 40));
+            updateTracker();
+        }
+        return staticShapeCache;
+    }
+
+    bool isEraser() const override{
+        return false;
+    }
+
+    Tool tool() const override{
+        return penTool;
+    }
+
+protected:
+    virtual void drawGlyph(QPainter* p, const QRectF& r, const QColor& c) const{
+        p->save();
+        p->setPen(QPen(c, 2, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
+        p->setBrush(Qt::NoBrush);
+        switch (penTool) {
+        case LINE:
+            p->drawLine(r.bottomLeft(), r.topRight());
+            break;
+        case ARROW:
+        {
+            p->drawLine(r.bottomLeft(), r.topRight());
+            const qreal h = r.width() * 0.4;
+            p->drawPolyline(QPolygonF() << r.topRight() + QPointF(-h, 0) << r.topRight() << r.topRight() + QPointF(0, h));
+            break;
+        }
+        case RECTANGLE:
+            p->drawRect(r.adjusted(1, 3, -1, -3));
+            break;
+        case ELLIPSE:
+            p->drawEllipse(r.adjusted(1, 3, -1, -3));
+            break;
+        case TEXT:
+            p->drawLine(QPointF(r.left() + 2, r.top() + 2), QPointF(r.right() - 2, r.top() + 2));
+            p->drawLine(QPointF(r.center().x(), r.top() + 2), QPointF(r.center().x(), r.bottom() - 1));
+            break;
+        case FILL:
+        {
+            // 倾斜的桶和一滴颜料
+            p->drawPolygon(QPolygonF() << QPointF(r.left() + 2, r.top() + r.height() * 0.45) << QPointF(r.left() + r.width() * 0.45, r.top() + 2)
+                           << QPointF(r.right() - 4, r.top() + r.height() * 0.5) << QPointF(r.left() + r.width() * 0.5, r.bottom() - 2));
+            p->drawEllipse(QRectF(r.right() - 4, r.bottom() - 7, 4, 6));
+            break;
+        }
+        case SELECT:
+        {
+            // 虚线套索
+            QPen pen = p->pen();
+            pen.setWidthF(1.5);
+            pen.setDashPattern({2, 2});
+            p->setPen(pen);
+            p->drawEllipse(r.adjusted(1, 4, -1, -4));
+            break;
+        }
+        case MAGNIFIER:
+        {
+            const QRectF lens(r.topLeft(), r.size() * 0.65);
+            p->drawEllipse(lens);
+            p->drawLine(lens.center() + QPointF(lens.width(), lens.height()) * 0.35, r.bottomRight());
+            break;
+        }
+        default:
+            break;
+        }
+        p->restore();
+    }
+
+private:
+    void updateTracker() const{
+        auto bytes = [](const QPixmap& pix){
+            return qint64(pix.width()) * pix.height() * pix.depth() / 8;
+        };
+        tracker.update(bytes(shapeCache) + bytes(staticShapeCache));
+    }
+
+private:
+    QString penName;
+    Tool penTool = FREEHAND;
+
+    mutable QPixmap shapeCache;
+    mutable QPixmap staticShapeCache;
+    mutable MemoryTracker tracker{MemoryStats::PEN_SHAPE};
+};
+
+
+// 荧光笔沿用自由笔画，默认半透明黄色，切换颜色时保留透明度
+class HighlighterPen : public ShapePen
+{
+public:
+    HighlighterPen()
+        :ShapePen("highlighter", FREEHAND)
+    {
+        setColor(QColor(255, 214, 0, 160));
+    }
+
+    bool isHighlighter() const override{
+        return true;
+    }
+
+protected:
+    void drawGlyph(QPainter* p, const QRectF& r, const QColor& c) const override{
+        // 一道半透明的宽笔迹
+        p->save();
+        p->setPen(QPen(QColor(255, 214, 0, 180), r.height() / 3, Qt::SolidLine, Qt::FlatCap));
+        p->drawLine(QPointF(r.left(), r.center().y()), QPointF(r.right(), r.center().y()));
+        p->setPen(QPen(c, 1));
+        p->drawLine(QPointF(r.left() + 2, r.center().y()), QPointF(r.right() - 2, r.center().y()));
+        p->restore();
+    }
+};
+
+
+// 激光笔：笔迹不写入图层，抬起后逐渐淡出
+class LaserPen : public ShapePen
+{
+public:
+    LaserPen()
+        :ShapePen("laser", FREEHAND)
+    {
+        setColor(QColor(255, 40, 40));
+    }
+
+    bool isLaser() const override{
+        return true;
+    }
+
+protected:
+    void drawGlyph(QPainter* p, const QRectF& r, const QColor&) const override{
+        p->save();
+        p->setPen(Qt::NoPen);
+        QRadialGradient glow(r.center(), r.width() / 2);
+        glow.setColorAt(0, QColor(255, 40, 40));
+        glow.setColorAt(0.35, QColor(255, 40, 40, 160));
+        glow.setColorAt(1, Qt::transparent);
+        p->setBrush(glow);
+        p->drawEllipse(r);
+        p->restore();
+    }
 };
 
 
@@ -153,11 +364,40 @@ Drawer::Drawer(QWidget *parent, Qt::WindowFlags f)
     pensContainer
             // << new InternalPen("default",":/res/pens/pen_default.png",":/res/pens/pen_default_static.png")
             << new InternalPen("pencil",":/res/pens/pen_pencil.png",":/res/pens/pen_pencil_static.png"/*, false ,Qt::SolidPattern,1,Qt::SolidLine,Qt::SquareCap,Qt::RoundJoin*/)
-            << new InternalPen("eraser",":/res/pens/eraser.png",":/res/pens/eraser_static.png", true);
+            << new InternalPen("eraser",":/res/pens/eraser.png",":/res/pens/eraser_static.png", true)
+            << new HighlighterPen
+            << new LaserPen
+            << new ShapePen("line", Pen::LINE)
+            << new ShapePen("arrow", Pen::ARROW)
+            << new ShapePen("rectangle", Pen::RECTANGLE)
+            << new ShapePen("ellipse", Pen::ELLIPSE)
+            << new ShapePen("text", Pen::TEXT)
+            << new ShapePen("magnifier", Pen::MAGNIFIER)
+            << new ShapePen("fill", Pen::FILL)
+            << new ShapePen("lasso", Pen::SELECT);
     curPen = pensContainer.first();
 
     setupUi();
 
+    // 子控件重绘时标记缓存失效，之后新增的子控件在 ChildAdded 时补上
+    this->installEventFilter(this);
+    for(QWidget* w : this->findChildren<QWidget*>())
+    {
+        w->installEventFilter(this);
+    }
+
+    // 隐藏时改动的数值不会触发子控件重绘，按信号标记缓存失效
+    auto invalidate = [this](){
+        d->surfaceDirty = true;
+    };
+    connect(this, &Drawer::backgroundOpacityChanged, this, invalidate);
+    connect(this, &Drawer::backgroundColorChanged, this, invalidate);
+    connect(this, &Drawer::penSizeChanged, this, invalidate);
+    connect(this, &Drawer::penColorChanged, this, invalidate);
+    connect(this, &Drawer::currentPenChanged, this, invalidate);
+    connect(this, &Drawer::currentLayerChanged, this, invalidate);
+    connect(this, &Drawer::layerVisibleChanged, this, invalidate);
+
     ConfigHandle* handle = static_cast<DBApplication*>(qApp)->getSingleton<Config>()->getConfigHandle(Config::INTERNAL);
     Q_ASSERT(handle);
 
@@ -192,30 +432,148 @@ const Pen* Drawer::currentPen()
     return curPen;
 }
 
+bool Drawer::selectPen(const QString& name)
+{
+    for(PenButton* btn : this->findChildren<PenButton*>())
+    {
+        if(btn->getPen()->name() == name)
+        {
+            btn->click();
+            return true;
+        }
+    }
+    return false;
+}
+
+void Drawer::setPenColor(const QColor& c)
+{
+    ConfigHandle* handle = static_cast<DBApplication*>(qApp)->getSingleton<Config>()->getConfigHandle(Config::INTERNAL);
+    Q_ASSERT(handle);
+
+    // 透明度走滑块，与手动调整一样写入配置
+    d->penAlphaSlider->setValue(c.alpha());
+    foreachPen([c](Pen* pen){
+        pen->setColor(c);
+    });
+    handle->setValue("color.pen", c.name());
+    emit penColorChanged(c);
+}
+
+void Drawer::setPenSize(int size)
+{
+    d->penSizeSlider->setValue(size);
+}
+
 QColor Drawer::backgroundColor() const
 {
     return d->backgroundColor;
 }
 
+QPixmap Drawer::surface()
+{
+    if(d->surfaceDirty || d->surfaceCache.isNull())
+    {
+        TRACE_SCOPE("Drawer::surface");
+        if(this->layout())
+        {
+            this->layout()->activate();
+        }
+
+        d->grabbing = true;
+        d->surfaceCache = this->grab();
+        d->grabbing = false;
+        d->surfaceDirty = false;
+    }
+    return d->surfaceCache;
+}
+
+void Drawer::setLayers(const QStringList& names, const QList<bool>& visible, int current)
+{
+    d->layerVisibility = visible;
+
+    d->layerCombo->blockSignals(true);
+    d->layerCombo->clear();
+    for(int i = names.size() - 1; i >= 0; --i)
+    {
+        d->layerCombo->addItem(names.at(i));
+    }
+    d->layerCombo->setCurrentIndex(names.size() - 1 - current);
+    d->layerCombo->blockSignals(false);
+
+    d->layerVisible->blockSignals(true);
+    d->layerVisible->setChecked(visible.value(current, true));
+    d->layerVisible->blockSignals(false);
+
+    // 屏蔽了信号，图层列表变化要单独标记
+    d->surfaceDirty = true;
+}
+
+void Drawer::releaseSurface()
+{
+    d->surfaceCache = QPixmap();
+    d->panelCache = QPixmap();
+    d->surfaceDirty = true;
+}
+
+bool Drawer::eventFilter(QObject* watched, QEvent* event)
+{
+    if(!d->grabbing && event->type() == QEvent::Paint)
+    {
+        d->surfaceDirty = true;
+    }
+    else if(event->type() == QEvent::ChildAdded)
+    {
+        QObject* child = static_cast<QChildEvent*>(event)->child();
+        if(child->isWidgetType())
+        {
+            child->installEventFilter(this);
+            for(QWidget* w : child->findChildren<QWidget*>())
+            {
+                w->installEventFilter(this);
+            }
+            d->surfaceDirty = true;
+        }
+    }
+    return QWidget::eventFilter(watched, event);
+}
+
 void Drawer::paintEvent(QPaintEvent* event)
 {
     Q_UNUSED(event);
     qint64 start =  QDateTime::currentMSecsSinceEpoch();
     // qDebug() << "drawer start" << start;
 
-    QPainter p(this);
-    p.setOpacity(0.5);
-    p.setPen(Qt::transparent);
-    p.setBrush(QColor(125,125,125,120));
-
-    QRect r = this->rect().marginsRemoved(QMargins(1,d->isExpand ? 25 : 1,1,1));
-    p.drawRoundedRect(r,5,5);
+    if(d->panelCache.isNull() || d->panelCacheSize != this->size() || d->panelCacheExpand != d->isExpand)
+    {
+        qreal dpr = this->devicePixelRatioF();
+        d->panelCache = QPixmap(this->size() * dpr);
+        d->panelCache.setDevicePixelRatio(dpr);
+        d->panelCache.fill(Qt::transparent);
+        d->panelCacheSize = this->size();
+        d->panelCacheExpand = d->isExpand;
+
+        QPainter cp(&d->panelCache);
+        cp.setOpacity(0.5);
+        cp.setPen(Qt::transparent);
+        cp.setBrush(QColor(125,125,125,120));
+
+        QRect r = this->rect().marginsRemoved(QMargins(1,d->isExpand ? 25 : 1,1,1));
+        cp.drawRoundedRect(r,5,5);
+    }
 
+    QPainter p(this);
+    p.drawPixmap(0, 0, d->panelCache);
 
     // qDebug() << "drawer spent" << QDateTime::currentMSecsSinceEpoch() - start;
     // this->setMask(QRegion(r));
 }
 
+void Drawer::resizeEvent(QResizeEvent* event)
+{
+    d->surfaceDirty = true;
+    QWidget::resizeEvent(event);
+}
+
 void Drawer::mousePressEvent(QMouseEvent* event)
 {
     event->accept();
@@ -245,10 +603,12 @@ void Drawer::collapse()
 {
     if(d->collapse)
     {
+        // 先发信号，让 Board 缓存展开状态的画面
+        emit collapsed();
+
         d->collapse();
         d->isExpand = false;
-
-        emit collapsed();
+        d->surfaceDirty = true;
     }
 }
 
@@ -256,10 +616,11 @@ void Drawer::expand()
 {
     if(d->expand)
     {
-        emit expanded();
-
         d->expand();
         d->isExpand = true;
+        d->surfaceDirty = true;
+
+        emit expanded();
     }
 }
 
@@ -272,6 +633,7 @@ void Drawer::setupUi()
     QBoxLayout* layout = createLayout(Qt::Vertical, 10, QMargins(10,0,10,10));
     layout->addLayout(setupPenUi(),1);
     layout->addLayout(controlLayout,1);
+    layout->addLayout(setupLayerUi(), 0);
     layout->addLayout(setupCapabilityButtonUi(), 1);
 
     this->setLayout(layout);
@@ -365,6 +727,7 @@ QBoxLayout* Drawer::setupSliderUi()
         emit penSizeChanged(value);
     });
     connect(penSizeEdit, &QSpinBox::valueChanged, penSizeSlider, &QSlider::setValue);
+    d->penSizeSlider = penSizeSlider;
     QBoxLayout* penSizeSliderGroupLayout = createLayout(Qt::Vertical,0, QMargins(10,0,10,0));
     penSizeSliderGroupLayout->addWidget(penSizeSlider, 1);
     penSizeSliderGroupLayout->addWidget(penSizeEdit, 0);
@@ -393,6 +756,7 @@ QBoxLayout* Drawer::setupSliderUi()
         blockSignals(false);
     });
     connect(penAlphaEdit, &QSpinBox::valueChanged, penAlphaSlider, &QSlider::setValue);
+    d->penAlphaSlider = penAlphaSlider;
     QBoxLayout* penAlphaSliderGroupLayout = createLayout(Qt::Vertical,0, QMargins(10,0,10,0));
     penAlphaSliderGroupLayout->addWidget(penAlphaSlider, 1);
     penAlphaSliderGroupLayout->addWidget(penAlphaEdit, 0);
@@ -575,6 +939,77 @@ QBoxLayout* Drawer::setupCapabilityButtonUi()
     return layout;
 }
 
+QBoxLayout* Drawer::setupLayerUi()
+{
+    // 列表自顶向下显示，对外的序号按自底向上计算
+    auto layerIndex = [this](int row){
+        return d->layerCombo->count() - 1 - row;
+    };
+
+    d->layerCombo = new QComboBox(this);
+    d->layerCombo->setMinimumWidth(120);
+    connect(d->layerCombo, &QComboBox::currentIndexChanged, this, [this, layerIndex](int row){
+        if(row < 0)
+        {
+            return;
+        }
+
+        int index = layerIndex(row);
+        d->layerVisible->blockSignals(true);
+        d->layerVisible->setChecked(d->layerVisibility.value(index, true));
+        d->layerVisible->blockSignals(false);
+        emit currentLayerChanged(index);
+    });
+
+    d->layerVisible = new QCheckBox(tr("checkbox.text.layer.visible"), this);
+    d->layerVisible->setChecked(true);
+    connect(d->layerVisible, &QCheckBox::toggled, this, [this, layerIndex](bool checked){
+        int index = layerIndex(d->layerCombo->currentIndex());
+        if(index >= 0 && index < d->layerVisibility.size())
+        {
+            d->layerVisibility[index] = checked;
+        }
+        emit layerVisibleChanged(index, checked);
+    });
+
+    auto createButton = [this](const QString& text, void (Drawer::*signal)()){
+        QPushButton* btn = new QPushButton(text, this);
+        btn->setFixedHeight(24);
+        connect(btn, &QPushButton::clicked, this, signal);
+        return btn;
+    };
+    QList<QPushButton*> buttons;
+    buttons << createButton(tr("button.text.layer.add"), &Drawer::layerAddClicked)
+            << createButton(tr("button.text.layer.remove"), &Drawer::layerRemoveClicked)
+            << createButton(tr("button.text.layer.raise"), &Drawer::layerRaiseClicked)
+            << createButton(tr("button.text.layer.lower"), &Drawer::layerLowerClicked)
+            << createButton(tr("button.text.layer.clear"), &Drawer::layerClearClicked);
+
+    QBoxLayout* layout = createLayout(Qt::Horizontal, 10, QMargins(10, 0, 10, 0));
+    layout->addWidget(d->layerCombo);
+    layout->addWidget(d->layerVisible);
+    for(auto btn : buttons)
+    {
+        layout->addWidget(btn);
+    }
+    layout->addStretch();
+
+    d->addShowOrHide([=](std::function<void()> oldCall, bool v){
+        if(oldCall){
+            oldCall();
+        }
+
+        d->layerCombo->setVisible(v);
+        d->layerVisible->setVisible(v);
+        for(auto btn : buttons)
+        {
+            btn->setVisible(v);
+        }
+    });
+
+    return layout;
+}
+
 QBoxLayout* Drawer::createLayout(Qt::Orientation o, int spacing, const QMargins& m)
 {
     QBoxLayout* layout = new QBoxLayout(o == Qt::Horizontal ? QBoxLayout::LeftToRight : QBoxLayout::TopToBottom);
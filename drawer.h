@@ -50,9 +50,21 @@ public:
 
     const Pen* currentPen();
     QColor backgroundColor() const;
+    // 整个面板渲染成的画面，只在滑入滑出的动画中代替面板绘制；
+    // 静止显示时面板仍是半透明的子控件，子控件重绘时画板会重新合成其下方的区域
+    QPixmap surface();
+    void releaseSurface();
+    // 图层自底向上排列，列表中按自顶向下显示
+    void setLayers(const QStringList& names, const QList<bool>& visible, int current);
+    // 自动化接口，效果与操作对应的控件相同
+    bool selectPen(const QString& name);
+    void setPenColor(const QColor& c);
+    void setPenSize(int size);
 
 protected:
+    virtual bool eventFilter(QObject* watched, QEvent* event) override;
     virtual void paintEvent(QPaintEvent* event) override;
+    virtual void resizeEvent(QResizeEvent* event) override;
     virtual void mousePressEvent(QMouseEvent* event) override;
     virtual void mouseMoveEvent(QMouseEvent* event) override;
     virtual void mouseReleaseEvent(QMouseEvent* event) override;
@@ -70,6 +82,13 @@ signals:
     void downClicked();
     void leave();
     void freeze(bool);
+    void layerAddClicked();
+    void layerRemoveClicked();
+    void layerClearClicked();
+    void layerRaiseClicked();
+    void layerLowerClicked();
+    void currentLayerChanged(int index);
+    void layerVisibleChanged(int index, bool visible);
 
 public slots:
     void collapse();
@@ -80,6 +99,7 @@ private:
     QBoxLayout* setupSliderUi();
     QBoxLayout* setupColorButtonUi();
     QBoxLayout* setupCapabilityButtonUi();
+    QBoxLayout* setupLayerUi();
     QBoxLayout* createLayout(Qt::Orientation o, int spacing = 0, const QMargins& m = QMargins(0,0,0,0));
 
     PenButton* createPenButton(Pen* p);
@@ -2,7 +2,10 @@
 #define DRAWERPRIVATE_H
 
 #include <QColor>
+#include <QPixmap>
 
+class QCheckBox;
+class QComboBox;
 class QSlider;
 
 class DrawerPrivate{
@@ -18,6 +21,21 @@ class DrawerPrivate{
     std::function<void()> expand = nullptr;
     bool isExpand = true;
     QByteArray lastGeometry;
+
+    QPixmap panelCache;
+    QSize panelCacheSize;
+    bool panelCacheExpand = true;
+
+    QSlider* penSizeSlider = nullptr;
+    QSlider* penAlphaSlider = nullptr;
+
+    QComboBox* layerCombo = nullptr;
+    QCheckBox* layerVisible = nullptr;
+    QList<bool> layerVisibility;
+
+    QPixmap surfaceCache;
+    bool surfaceDirty = true;
+    bool grabbing = false;
 };
 
 
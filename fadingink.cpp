@@ -0,0 +1,178 @@
+#include "fadingink.h"
+
+#include "allocationcounter.h"
+
+#include <QPainter>
+
+namespace {
+// 一笔预留的顶点数，超出后按倍数增长
+const int RESERVED_POINTS = 1024;
+}
+
+FadingInk::FadingInk(QObject *parent)
+    : QObject{parent}
+{
+    timer.setInterval(16);
+    timer.setTimerType(Qt::PreciseTimer);
+    connect(&timer, &QTimer::timeout, this, &FadingInk::tick);
+    clock.start();
+}
+
+void FadingInk::setDuration(int ms)
+{
+    duration = qMax(1, ms);
+}
+
+void FadingInk::begin(const QColor& color, qreal width)
+{
+    Stroke s;
+    s.color = color;
+    s.width = width;
+    s.points.reserve(RESERVED_POINTS);
+    strokes.append(s);
+    drawing = true;
+}
+
+QRectF FadingInk::lineTo(const QPointF& from, const QVector<InputSample>& samples)
+{
+    if(!drawing || samples.isEmpty())
+    {
+        return QRectF();
+    }
+
+    // 在 Board::drawLine 的无分配检查内调用，只在容量用完时增长一次
+    Stroke& s = strokes.last();
+    const int needed = s.points.size() + samples.size() + 1;
+    if(needed > s.points.capacity())
+    {
+        ALLOCATION_EXPECTED_SCOPE();
+        s.points.reserve(qMax(needed, int(s.points.capacity()) * 2));
+    }
+    if(s.points.isEmpty())
+    {
+        s.points.append(from);
+    }
+
+    qreal left = from.x();
+    qreal right = from.x();
+    qreal top = from.y();
+    qreal bottom = from.y();
+    for(const InputSample& sample : samples)
+    {
+        s.points.append(sample.pos);
+        left = qMin(left, sample.pos.x());
+        right = qMax(right, sample.pos.x());
+        top = qMin(top, sample.pos.y());
+        bottom = qMax(bottom, sample.pos.y());
+    }
+
+    const qreal m = margin(s);
+    const QRectF dirty = QRectF(QPointF(left, top), QPointF(right, bottom)).adjusted(-m, -m, m, m);
+    s.bounds |= dirty;
+    return dirty;
+}
+
+void FadingInk::end()
+{
+    if(!drawing)
+    {
+        return;
+    }
+
+    drawing = false;
+    if(strokes.last().points.isEmpty())
+    {
+        strokes.removeLast();
+        return;
+    }
+
+    strokes.last().fadeStart = clock.elapsed();
+    if(!timer.isActive())
+    {
+        timer.start();
+    }
+}
+
+void FadingInk::clear()
+{
+    for(const Stroke& s : std::as_const(strokes))
+    {
+        emit damaged(s.bounds);
+    }
+    strokes.clear();
+    drawing = false;
+    timer.stop();
+}
+
+bool FadingInk::isEmpty() const
+{
+    return strokes.isEmpty();
+}
+
+void FadingInk::draw(QPainter* p, const QRectF& clip) const
+{
+    if(strokes.isEmpty())
+    {
+        return;
+    }
+
+    p->save();
+    p->setRenderHint(QPainter::Antialiasing);
+    p->setBrush(Qt::NoBrush);
+    for(const Stroke& s : strokes)
+    {
+        if(!s.bounds.intersects(clip))
+        {
+            continue;
+        }
+
+        // 外圈半透明的光晕加上实心的笔芯
+        QColor c = s.color;
+        c.setAlphaF(c.alphaF() * s.opacity * 0.35);
+        p->setPen(QPen(c, s.width * 2.4, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
+        p->drawPolyline(s.points.constData(), int(s.points.size()));
+
+        c = s.color;
+        c.setAlphaF(c.alphaF() * s.opacity);
+        p->setPen(QPen(c, s.width, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
+        p->drawPolyline(s.points.constData(), int(s.points.size()));
+    }
+    p->restore();
+}
+
+void FadingInk::tick()
+{
+    const qint64 now = clock.elapsed();
+    bool fading = false;
+    for(auto it = strokes.begin(); it != strokes.end();)
+    {
+        if(it->fadeStart < 0)
+        {
+            ++it;
+            continue;
+        }
+
+        // 只刷新这一笔的范围，多笔同时淡出时各自报告
+        emit damaged(it->bounds);
+        const qreal t = qreal(now - it->fadeStart) / duration;
+        if(t >= 1)
+        {
+            it = strokes.erase(it);
+            continue;
+        }
+
+        it->opacity = 1 - t * t;
+        fading = true;
+        ++it;
+    }
+
+    if(!fading)
+    {
+        timer.stop();
+    }
+}
+
+qreal FadingInk::margin(const Stroke& s) const
+{
+    return s.width * 1.2 + 2;
+}
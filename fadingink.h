@@ -0,0 +1,62 @@
+#ifndef FADINGINK_H
+#define FADINGINK_H
+
+#include "inputbuffer.h"
+
+#include <QColor>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QPointF>
+#include <QTimer>
+#include <QVector>
+
+class QPainter;
+
+// 激光笔迹，只保存路径不占用图层；所有正在淡出的笔画共用一个逐帧定时器，全部消失后定时器停止
+class FadingInk : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FadingInk(QObject *parent = nullptr);
+
+    // 淡出持续的毫秒数
+    void setDuration(int ms);
+
+    // 坐标都是画布坐标，width 为画布上的宽度
+    void begin(const QColor& color, qreal width);
+    QRectF lineTo(const QPointF& from, const QVector<InputSample>& samples);
+    // 松开后开始淡出
+    void end();
+    void clear();
+
+    bool isEmpty() const;
+    void draw(QPainter* p, const QRectF& clip) const;
+
+signals:
+    // 每帧只报告仍在淡出的笔画的范围
+    void damaged(const QRectF& r);
+
+private:
+    struct Stroke{
+        // 折线的顶点，落笔时预留容量，绘制过程中通常不再分配
+        QVector<QPointF> points;
+        QColor color;
+        qreal width = 1;
+        QRectF bounds;
+        // 开始淡出的时间，-1 表示还在绘制
+        qint64 fadeStart = -1;
+        qreal opacity = 1;
+    };
+
+    void tick();
+    qreal margin(const Stroke& s) const;
+
+private:
+    QVector<Stroke> strokes;
+    bool drawing = false;
+    int duration = 2000;
+    QTimer timer;
+    QElapsedTimer clock;
+};
+
+#endif // FADINGINK_H
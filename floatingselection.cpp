@@ -0,0 +1,150 @@
+#include "floatingselection.h"
+#include "layer.h"
+
+#include <QPainter>
+#include <QPainterPath>
+
+#include <algorithm>
+
+bool FloatingSelection::isActive() const
+{
+    return !buffer.isNull();
+}
+
+bool FloatingSelection::lift(Layer* layer, const QPolygonF& lasso)
+{
+    discard();
+
+    const QRect bounds = lasso.boundingRect().toAlignedRect() & Layer::extent();
+    if(bounds.isEmpty())
+    {
+        return false;
+    }
+
+    QPainterPath path;
+    path.addPolygon(lasso);
+    path.closeSubpath();
+
+    QImage mask(bounds.size(), QImage::Format_ARGB32_Premultiplied);
+    mask.fill(Qt::transparent);
+    {
+        QPainter mp(&mask);
+        mp.setRenderHint(QPainter::Antialiasing);
+        mp.translate(-bounds.topLeft());
+        mp.fillPath(path, Qt::black);
+    }
+
+    QImage img(bounds.size(), QImage::Format_ARGB32_Premultiplied);
+    img.fill(Qt::transparent);
+    {
+        QPainter bp(&img);
+        bp.translate(-bounds.topLeft());
+        layer->draw(&bp, bounds);
+        bp.resetTransform();
+        bp.setCompositionMode(QPainter::CompositionMode_DestinationIn);
+        bp.drawImage(0, 0, mask);
+    }
+
+    const quint32* px = reinterpret_cast<const quint32*>(img.constBits());
+    if(std::all_of(px, px + img.sizeInBytes() / 4, [](quint32 v){ return v == 0; }))
+    {
+        return false;
+    }
+
+    // 原位置按同一遮罩挖空，只处理已有瓦片
+    layer->forEachTile(bounds, false, [&path](QImage* tile, const QPoint& origin){
+        QPainter tp(tile);
+        tp.setRenderHint(QPainter::Antialiasing);
+        tp.setCompositionMode(QPainter::CompositionMode_DestinationOut);
+        tp.translate(-origin);
+        tp.fillPath(path, Qt::black);
+    });
+
+    buffer = img;
+    target = bounds;
+    updateTracker();
+    return true;
+}
+
+QRect FloatingSelection::drop(Layer* layer)
+{
+    if(!isActive())
+    {
+        return QRect();
+    }
+
+    const QRect dirty = target.toAlignedRect();
+    // 没有缩放且落在整数位置时逐像素复制，否则平滑缩放
+    const bool scaled = target.size() != QSizeF(buffer.size()) || target.topLeft() != QPointF(target.toAlignedRect().topLeft());
+    layer->forEachTile(dirty, true, [this, scaled](QImage* tile, const QPoint& origin){
+        QPainter tp(tile);
+        tp.setRenderHint(QPainter::SmoothPixmapTransform, scaled);
+        tp.translate(-origin);
+        tp.drawImage(target, buffer);
+    });
+
+    discard();
+    return dirty;
+}
+
+void FloatingSelection::discard()
+{
+    buffer = QImage();
+    target = QRectF();
+    updateTracker();
+}
+
+QRectF FloatingSelection::rect() const
+{
+    return target;
+}
+
+void FloatingSelection::setRect(const QRectF& r)
+{
+    target = r;
+}
+
+FloatingSelection::Handle FloatingSelection::hitTest(const QPointF& pos, qreal handleSize) const
+{
+    if(!isActive())
+    {
+        return NONE;
+    }
+    if(handleRect(handleSize).contains(pos))
+    {
+        return SCALE;
+    }
+    return target.contains(pos) ? MOVE : NONE;
+}
+
+QRectF FloatingSelection::handleRect(qreal handleSize) const
+{
+    return QRectF(target.bottomRight() - QPointF(handleSize, handleSize) / 2, QSizeF(handleSize, handleSize));
+}
+
+void FloatingSelection::draw(QPainter* p, const QRectF& clip, qreal handleSize) const
+{
+    if(!isActive() || !target.adjusted(-handleSize, -handleSize, handleSize, handleSize).intersects(clip))
+    {
+        return;
+    }
+
+    p->save();
+    p->setRenderHint(QPainter::SmoothPixmapTransform);
+    p->drawImage(target, buffer);
+
+    // 虚线外框和右下角的缩放控制点，线宽不随缩放变化
+    QPen pen(QColor(255, 255, 255, 220), 0, Qt::DashLine);
+    pen.setCosmetic(true);
+    p->setPen(pen);
+    p->setBrush(Qt::NoBrush);
+    p->drawRect(target);
+    p->setBrush(QColor(255, 255, 255, 220));
+    p->drawRect(handleRect(handleSize));
+    p->restore();
+}
+
+void FloatingSelection::updateTracker()
+{
+    tracker.update(buffer.sizeInBytes());
+}
@@ -0,0 +1,50 @@
+#ifndef FLOATINGSELECTION_H
+#define FLOATINGSELECTION_H
+
+#include "memorystats.h"
+
+#include <QImage>
+#include <QPolygonF>
+#include <QRectF>
+
+class Layer;
+class QPainter;
+
+// 从图层中抬起的一块像素；移动和缩放时只改变目标矩形，作为叠加层显示，放下时一次性写回图层
+class FloatingSelection
+{
+public:
+    enum Handle{
+        NONE,
+        MOVE,
+        SCALE,
+    };
+
+    bool isActive() const;
+
+    // 按套索多边形（画布坐标）取出像素并清空原位置，选区内没有内容时返回 false
+    bool lift(Layer* layer, const QPolygonF& lasso);
+    // 按当前目标矩形写回，返回写入的画布范围
+    QRect drop(Layer* layer);
+    void discard();
+
+    QRectF rect() const;
+    void setRect(const QRectF& r);
+    // 只按外接矩形判断，选区再大也是常数时间；handleSize 为画布上的控制点边长
+    Handle hitTest(const QPointF& pos, qreal handleSize) const;
+    QRectF handleRect(qreal handleSize) const;
+
+    // painter 已经设置好画布到窗口的变换
+    void draw(QPainter* p, const QRectF& clip, qreal handleSize) const;
+
+private:
+    void updateTracker();
+
+private:
+    QImage buffer;
+    QRectF target;
+
+    MemoryTracker tracker{MemoryStats::SELECTION};
+};
+
+#endif // FLOATINGSELECTION_H
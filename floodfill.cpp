@@ -0,0 +1,139 @@
+#include "floodfill.h"
+
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+inline int mul255(int a, int b)
+{
+    int t = a * b + 128;
+    return (t + (t >> 8)) >> 8;
+}
+}
+
+FloodFill::FloodFill(const QImage& reference, const QPoint& offset, int tolerance)
+    :ref(reference.convertToFormat(QImage::Format_ARGB32_Premultiplied))
+    ,offset(offset)
+    ,tolerance(qBound(0, tolerance, 255))
+    ,mask(qsizetype(reference.width()) * reference.height(), OTHER)
+    ,rowReady(reference.height(), false)
+{}
+
+QRect FloodFill::fill(const QPoint& seed)
+{
+    const QPoint s = seed - offset;
+    if(!ref.rect().contains(s))
+    {
+        return QRect();
+    }
+    target = reinterpret_cast<const QRgb*>(ref.constScanLine(s.y()))[s.x()];
+
+    const int w = ref.width();
+    const int h = ref.height();
+    QVector<QPoint> stack;
+    stack.append(s);
+    while(!stack.isEmpty())
+    {
+        const QPoint p = stack.takeLast();
+        quint8* line = row(p.y());
+        if(line[p.x()] != MATCH)
+        {
+            continue;
+        }
+
+        int x0 = p.x();
+        int x1 = p.x();
+        while(x0 > 0 && line[x0 - 1] == MATCH)
+        {
+            --x0;
+        }
+        while(x1 < w - 1 && line[x1 + 1] == MATCH)
+        {
+            ++x1;
+        }
+        std::memset(line + x0, FILLED, size_t(x1 - x0 + 1));
+        filled |= QRect(x0, p.y(), x1 - x0 + 1, 1);
+
+        // 上下两行中与本段相接的每一段只压入一个种子
+        for(int ny : {p.y() - 1, p.y() + 1})
+        {
+            if(ny < 0 || ny >= h)
+            {
+                continue;
+            }
+            const quint8* next = row(ny);
+            for(int x = x0; x <= x1; ++x)
+            {
+                if(next[x] != MATCH)
+                {
+                    continue;
+                }
+                stack.append(QPoint(x, ny));
+                while(x <= x1 && next[x] == MATCH)
+                {
+                    ++x;
+                }
+            }
+        }
+    }
+    return filled.translated(offset);
+}
+
+void FloodFill::composite(QImage* image, const QPoint& origin, const QColor& color) const
+{
+    Q_ASSERT(image->format() == QImage::Format_ARGB32_Premultiplied);
+
+    const QRect r = filled.translated(offset) & QRect(origin, image->size());
+    if(r.isEmpty())
+    {
+        return;
+    }
+
+    const QRgb src = qPremultiply(color.rgba());
+    const int k = 255 - qAlpha(src);
+    const int w = ref.width();
+    for(int y = r.top(); y <= r.bottom(); ++y)
+    {
+        QRgb* dst = reinterpret_cast<QRgb*>(image->scanLine(y - origin.y())) - origin.x();
+        const quint8* m = mask.constData() + qsizetype(y - offset.y()) * w - offset.x();
+        for(int x = r.left(); x <= r.right(); ++x)
+        {
+            if(m[x] != FILLED)
+            {
+                continue;
+            }
+            const QRgb d = dst[x];
+            dst[x] = k == 0 ? src : qRgba(qRed(src) + mul255(qRed(d), k), qGreen(src) + mul255(qGreen(d), k),
+                                          qBlue(src) + mul255(qBlue(d), k), qAlpha(src) + mul255(qAlpha(d), k));
+        }
+    }
+}
+
+quint8* FloodFill::row(int y)
+{
+    const int w = ref.width();
+    quint8* line = mask.data() + qsizetype(y) * w;
+    if(rowReady.at(y))
+    {
+        return line;
+    }
+    rowReady[y] = true;
+
+    // 整行逐像素比较，循环内没有分支，编译器可以向量化
+    const QRgb* px = reinterpret_cast<const QRgb*>(ref.constScanLine(y));
+    const int ta = qAlpha(target);
+    const int tr = qRed(target);
+    const int tg = qGreen(target);
+    const int tb = qBlue(target);
+    const int tol = tolerance;
+    for(int x = 0; x < w; ++x)
+    {
+        const QRgb p = px[x];
+        const int da = std::abs(qAlpha(p) - ta);
+        const int dr = std::abs(qRed(p) - tr);
+        const int dg = std::abs(qGreen(p) - tg);
+        const int db = std::abs(qBlue(p) - tb);
+        line[x] = quint8((da <= tol) & (dr <= tol) & (dg <= tol) & (db <= tol));
+    }
+    return line;
+}
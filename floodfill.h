@@ -0,0 +1,43 @@
+#ifndef FLOODFILL_H
+#define FLOODFILL_H
+
+#include <QColor>
+#include <QImage>
+#include <QPoint>
+#include <QRect>
+#include <QVector>
+
+// 在参考图上按扫描线填充与落点颜色相近的连通区域
+// 每行第一次访问时整行比较颜色生成匹配掩码，之后的扩展只扫描字节掩码
+class FloodFill
+{
+public:
+    // offset 为参考图左上角在画布中的坐标；tolerance 为各通道允许的最大差值
+    FloodFill(const QImage& reference, const QPoint& offset, int tolerance);
+
+    // seed 为画布坐标，返回填充区域在画布中的外接矩形
+    QRect fill(const QPoint& seed);
+    // 把填充区域按 SourceOver 合成到 image，origin 为其左上角在画布中的坐标
+    void composite(QImage* image, const QPoint& origin, const QColor& color) const;
+
+private:
+    enum : quint8{
+        OTHER = 0,
+        MATCH = 1,
+        FILLED = 2,
+    };
+
+    quint8* row(int y);
+
+private:
+    QImage ref;
+    QPoint offset;
+    int tolerance;
+    QRgb target = 0;
+
+    QVector<quint8> mask;
+    QVector<bool> rowReady;
+    QRect filled;
+};
+
+#endif // FLOODFILL_H
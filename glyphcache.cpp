@@ -0,0 +1,137 @@
+#include "glyphcache.h"
+
+#include <QFontMetrics>
+#include <QFontMetricsF>
+#include <QPainter>
+
+size_t qHash(const GlyphCache::Key& k, size_t seed)
+{
+    return qHashMulti(seed, k.font, k.color, quint32(k.ch));
+}
+
+GlyphCache::GlyphCache(QObject *parent)
+    : QObject{parent}
+{}
+
+int GlyphCache::fontId(const QFont& font)
+{
+    const QString key = font.key();
+    auto it = fontIds.constFind(key);
+    if(it != fontIds.constEnd())
+    {
+        return it.value();
+    }
+
+    int id = fonts.size();
+    fonts.append(font);
+    fontIds.insert(key, id);
+    return id;
+}
+
+QFont GlyphCache::font(int id) const
+{
+    return fonts.value(id);
+}
+
+GlyphCache::Glyph GlyphCache::glyph(int fontId, const QColor& color, char32_t ch)
+{
+    const Key key{fontId, color.rgba(), ch};
+    auto it = glyphs.constFind(key);
+    if(it != glyphs.constEnd())
+    {
+        return it.value();
+    }
+
+    const QFont f = fonts.value(fontId);
+    const QString text = QString::fromUcs4(&ch, 1);
+
+    Glyph g;
+    g.advance = QFontMetricsF(f).horizontalAdvance(text);
+
+    // 留一像素边距，避免抗锯齿边缘被相邻字形覆盖
+    QRect box = QFontMetrics(f).boundingRect(text).adjusted(-1, -1, 1, 1);
+    if(!QChar::isSpace(ch) && !box.isEmpty() && (box.width() >= PAGE_SIZE || box.height() >= PAGE_SIZE))
+    {
+        g.direct = true;
+    }
+    else if(!QChar::isSpace(ch) && !box.isEmpty())
+    {
+        QRect source = allocate(box.size(), &g.page);
+        g.source = source;
+        g.offset = box.topLeft();
+
+        QPainter p(&pages[g.page]);
+        p.setCompositionMode(QPainter::CompositionMode_Source);
+        p.fillRect(source, Qt::transparent);
+        p.setCompositionMode(QPainter::CompositionMode_SourceOver);
+        p.setRenderHint(QPainter::TextAntialiasing);
+        p.setFont(f);
+        p.setPen(color);
+        p.setClipRect(source);
+        p.drawText(source.topLeft() - box.topLeft(), text);
+    }
+
+    glyphs.insert(key, g);
+    return g;
+}
+
+const QImage& GlyphCache::page(int index) const
+{
+    return pages.at(index);
+}
+
+quint64 GlyphCache::generation() const
+{
+    return gen;
+}
+
+void GlyphCache::trim()
+{
+    if(pages.size() <= MAX_PAGES)
+    {
+        return;
+    }
+
+    glyphs.clear();
+    pages.clear();
+    shelfX = shelfY = shelfHeight = 0;
+    ++gen;
+    updateTracker();
+}
+
+QRect GlyphCache::allocate(const QSize& s, int* page)
+{
+    if(pages.isEmpty())
+    {
+        QImage img(PAGE_SIZE, PAGE_SIZE, QImage::Format_ARGB32_Premultiplied);
+        img.fill(Qt::transparent);
+        pages.append(img);
+        updateTracker();
+    }
+
+    if(shelfX + s.width() > PAGE_SIZE)
+    {
+        shelfX = 0;
+        shelfY += shelfHeight;
+        shelfHeight = 0;
+    }
+    if(shelfY + s.height() > PAGE_SIZE)
+    {
+        QImage img(PAGE_SIZE, PAGE_SIZE, QImage::Format_ARGB32_Premultiplied);
+        img.fill(Qt::transparent);
+        pages.append(img);
+        shelfX = shelfY = shelfHeight = 0;
+        updateTracker();
+    }
+
+    QRect r(QPoint(shelfX, shelfY), s);
+    shelfX += s.width();
+    shelfHeight = qMax(shelfHeight, s.height());
+    *page = pages.size() - 1;
+    return r;
+}
+
+void GlyphCache::updateTracker()
+{
+    tracker.update(qint64(pages.size()) * PAGE_SIZE * PAGE_SIZE * 4);
+}
@@ -0,0 +1,74 @@
+#ifndef GLYPHCACHE_H
+#define GLYPHCACHE_H
+
+#include "memorystats.h"
+
+#include <QColor>
+#include <QFont>
+#include <QHash>
+#include <QImage>
+#include <QObject>
+#include <QVector>
+
+// 按字体、字号和颜色缓存已经渲染好的字形，所有文字批注共用同一组图集
+class GlyphCache : public QObject
+{
+    Q_OBJECT
+public:
+    static const int PAGE_SIZE = 1024;
+    // 图集超过这个数量时在下次空闲清理中整体丢弃
+    static const int MAX_PAGES = 8;
+
+    struct Glyph{
+        // page < 0 表示不在图集中：空白字符只占位置，direct 为真时由使用者直接绘制文字
+        int page = -1;
+        // 字形超出一页图集，缩小视图时的大号文字会出现这种情况
+        bool direct = false;
+        QRect source;
+        // 位图左上角相对基线起点的偏移
+        QPoint offset;
+        qreal advance = 0;
+    };
+
+    explicit GlyphCache(QObject *parent = nullptr);
+
+    // 字体对应的编号，之后的查询只需比较整数
+    int fontId(const QFont& font);
+    QFont font(int id) const;
+
+    // 第一次访问时渲染到图集，只能在界面线程调用
+    Glyph glyph(int fontId, const QColor& color, char32_t ch);
+    const QImage& page(int index) const;
+
+    // 清空后已取得的 Glyph 全部失效，使用者通过 generation 判断是否需要重新查询
+    quint64 generation() const;
+    void trim();
+
+private:
+    struct Key{
+        int font;
+        QRgb color;
+        char32_t ch;
+        bool operator==(const Key& o) const{ return font == o.font && color == o.color && ch == o.ch;}
+    };
+    friend size_t qHash(const Key& k, size_t seed);
+
+    QRect allocate(const QSize& s, int* page);
+    void updateTracker();
+
+private:
+    QHash<QString, int> fontIds;
+    QVector<QFont> fonts;
+    QHash<Key, Glyph> glyphs;
+
+    QVector<QImage> pages;
+    // 按行（shelf）依次排放，当前行放不下时换行或换页
+    int shelfX = 0;
+    int shelfY = 0;
+    int shelfHeight = 0;
+    quint64 gen = 0;
+
+    MemoryTracker tracker{MemoryStats::GLYPH};
+};
+
+#endif // GLYPHCACHE_H
@@ -0,0 +1,56 @@
+#include "inputbuffer.h"
+
+InputBuffer::InputBuffer(int capacity)
+{
+    // 容量取 2 的幂，下标用掩码回绕
+    quint32 c = 1;
+    while(c < quint32(qMax(capacity, 2)))
+    {
+        c <<= 1;
+    }
+    ring.resize(c);
+    mask = c - 1;
+}
+
+bool InputBuffer::push(const InputSample& sample)
+{
+    if(isFull())
+    {
+        return false;
+    }
+
+    ring[head & mask] = sample;
+    ++head;
+    return true;
+}
+
+int InputBuffer::drain(QVector<InputSample>& out)
+{
+    out.resize(0);
+    while(tail != head)
+    {
+        out.append(ring.at(tail & mask));
+        ++tail;
+    }
+    return out.size();
+}
+
+int InputBuffer::size() const
+{
+    return int(head - tail);
+}
+
+int InputBuffer::capacity() const
+{
+    return ring.size();
+}
+
+bool InputBuffer::isEmpty() const
+{
+    return head == tail;
+}
+
+bool InputBuffer::isFull() const
+{
+    return size() == capacity();
+}
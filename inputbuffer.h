@@ -0,0 +1,37 @@
+#ifndef INPUTBUFFER_H
+#define INPUTBUFFER_H
+
+#include <QPointF>
+#include <QVector>
+
+struct InputSample
+{
+    QPointF pos;
+    qreal pressure = 1.0;
+    quint64 timestamp = 0;
+    // 进入输入缓冲的时刻，只在测量延迟时记录
+    qint64 received = 0;
+};
+
+// 单线程环形缓冲：事件里写入，绘制时整批取出
+class InputBuffer
+{
+public:
+    explicit InputBuffer(int capacity = 1024);
+
+    bool push(const InputSample& sample);
+    int drain(QVector<InputSample>& out);
+
+    int size() const;
+    int capacity() const;
+    bool isEmpty() const;
+    bool isFull() const;
+
+private:
+    QVector<InputSample> ring;
+    quint32 mask = 0;
+    quint32 head = 0;
+    quint32 tail = 0;
+};
+
+#endif // INPUTBUFFER_H
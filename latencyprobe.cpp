@@ -0,0 +1,193 @@
+#include "latencyprobe.h"
+
+#include <QJsonArray>
+
+namespace {
+// 同时在途的采样上限，足够覆盖 1000Hz 输入下几十毫秒的积压
+const int IN_FLIGHT_CAPACITY = 8192;
+}
+
+void LatencyProbe::Histogram::add(qint64 usecs)
+{
+    usecs = qMax<qint64>(0, usecs);
+    ++counts[qMin<qint64>(usecs / BUCKET_USECS, BUCKETS - 1)];
+    ++total;
+    maxUsecs = qMax(maxUsecs, usecs);
+}
+
+qint64 LatencyProbe::Histogram::percentile(double p) const
+{
+    if(total == 0)
+    {
+        return 0;
+    }
+
+    const quint64 target = qMax<quint64>(1, quint64(p * total + 0.5));
+    quint64 seen = 0;
+    for(int i = 0; i < BUCKETS; ++i)
+    {
+        seen += counts[i];
+        if(seen >= target)
+        {
+            // 取所在格的上沿，最后一格用实际最大值
+            return i == BUCKETS - 1 ? maxUsecs : qMin(maxUsecs, qint64(i + 1) * BUCKET_USECS);
+        }
+    }
+    return maxUsecs;
+}
+
+QJsonObject LatencyProbe::Histogram::toJson() const
+{
+    QJsonObject obj;
+    obj.insert("count", qint64(total));
+    obj.insert("p50", percentile(0.5) / 1000.0);
+    obj.insert("p90", percentile(0.9) / 1000.0);
+    obj.insert("p99", percentile(0.99) / 1000.0);
+    obj.insert("max", maxUsecs / 1000.0);
+    return obj;
+}
+
+LatencyProbe::LatencyProbe()
+{
+    clock.start();
+}
+
+void LatencyProbe::setEnabled(bool enabled)
+{
+    this->enabled = enabled;
+    if(enabled && inFlight.isEmpty())
+    {
+        inFlight.resize(IN_FLIGHT_CAPACITY);
+    }
+    inFlightCount = 0;
+    paintedAt = -1;
+}
+
+bool LatencyProbe::isEnabled() const
+{
+    return enabled;
+}
+
+void LatencyProbe::reset()
+{
+    groups.clear();
+    inFlightCount = 0;
+    paintedAt = -1;
+    hasMinAge = false;
+    total = 0;
+    dropped = 0;
+}
+
+void LatencyProbe::stamp(InputSample* sample)
+{
+    if(enabled)
+    {
+        sample->received = now();
+    }
+}
+
+void LatencyProbe::rasterized(const QVector<InputSample>& samples)
+{
+    if(!enabled)
+    {
+        return;
+    }
+
+    const qint64 t = now();
+    for(const InputSample& s : samples)
+    {
+        if(s.received == 0)
+        {
+            continue;
+        }
+        if(inFlightCount == inFlight.size())
+        {
+            ++dropped;
+            continue;
+        }
+
+        InFlight& f = inFlight[inFlightCount++];
+        f.received = s.received;
+        f.rasterized = t;
+        f.hasAge = s.timestamp != 0;
+        f.age = f.hasAge ? s.received - qint64(s.timestamp) * 1000000 : 0;
+        if(f.hasAge && (!hasMinAge || f.age < minAge))
+        {
+            minAge = f.age;
+            hasMinAge = true;
+        }
+    }
+}
+
+void LatencyProbe::painted()
+{
+    if(enabled && inFlightCount > 0)
+    {
+        paintedAt = now();
+    }
+}
+
+void LatencyProbe::flushed(int penWidth, const QSize& screen)
+{
+    // 采样所在区域还没有画到窗口上，留到下一次刷新
+    if(!enabled || inFlightCount == 0 || paintedAt < 0)
+    {
+        return;
+    }
+
+    const qint64 t = now();
+    Group& g = groups[groupKey(penWidth, screen)];
+    for(int i = 0; i < inFlightCount; ++i)
+    {
+        const InFlight& f = inFlight.at(i);
+        if(f.hasAge)
+        {
+            g.delivery.add((f.age - minAge) / 1000);
+        }
+        g.raster.add((f.rasterized - f.received) / 1000);
+        g.paint.add((paintedAt - f.received) / 1000);
+        g.flush.add((t - f.received) / 1000);
+    }
+    total += inFlightCount;
+    inFlightCount = 0;
+    paintedAt = -1;
+}
+
+qint64 LatencyProbe::samples() const
+{
+    return total;
+}
+
+QJsonObject LatencyProbe::toJson() const
+{
+    QJsonArray list;
+    for(auto it = groups.cbegin(); it != groups.cend(); ++it)
+    {
+        QJsonObject group;
+        group.insert("width", int(it.key() >> 32));
+        group.insert("screen", QString("%1x%2").arg((it.key() >> 16) & 0xffff).arg(it.key() & 0xffff));
+        group.insert("delivery", it->delivery.toJson());
+        group.insert("raster", it->raster.toJson());
+        group.insert("paint", it->paint.toJson());
+        group.insert("flush", it->flush.toJson());
+        list.append(group);
+    }
+
+    QJsonObject obj;
+    obj.insert("enabled", enabled);
+    obj.insert("samples", total);
+    obj.insert("dropped", dropped);
+    obj.insert("groups", list);
+    return obj;
+}
+
+qint64 LatencyProbe::now() const
+{
+    // 0 表示未打点
+    return clock.nsecsElapsed() + 1;
+}
+
+quint64 LatencyProbe::groupKey(int penWidth, const QSize& screen)
+{
+    return (quint64(penWidth) << 32) | (quint64(screen.width() & 0xffff) << 16) | quint64(screen.height() & 0xffff);
+}
@@ -0,0 +1,86 @@
+#ifndef LATENCYPROBE_H
+#define LATENCYPROBE_H
+
+#include "inputbuffer.h"
+
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QMap>
+#include <QSize>
+#include <QVector>
+
+// 输入到上屏的延迟：采样进入输入缓冲时打点，绘制进图层、paintEvent 结束、
+// 后备缓冲刷到窗口后各记一次，按笔宽和画板尺寸分组统计分布
+// 事件时间戳与本地时钟没有共同起点，投递延迟按观察到的最小值为基线计算抖动
+class LatencyProbe
+{
+public:
+    // 柱状图精度 0.1ms，超过上限的计入最后一格
+    static const int BUCKETS = 2000;
+    static const int BUCKET_USECS = 100;
+
+    struct Histogram{
+        quint64 counts[BUCKETS] = {};
+        quint64 total = 0;
+        qint64 maxUsecs = 0;
+
+        void add(qint64 usecs);
+        qint64 percentile(double p) const;
+        QJsonObject toJson() const;
+    };
+
+    struct Group{
+        Histogram delivery;
+        Histogram raster;
+        Histogram paint;
+        Histogram flush;
+    };
+
+    LatencyProbe();
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const;
+    void reset();
+
+    // 采样入队时调用，记录进入缓冲的时刻
+    void stamp(InputSample* sample);
+    // 一批采样绘制进图层后
+    void rasterized(const QVector<InputSample>& samples);
+    // paintEvent 结束
+    void painted();
+    // 刷新结束，后备缓冲已经交给窗口系统
+    void flushed(int penWidth, const QSize& screen);
+
+    qint64 samples() const;
+    QJsonObject toJson() const;
+
+private:
+    // 纳秒；age 为接收时刻减去事件时间戳，两者起点不同，只有差值有意义
+    struct InFlight{
+        qint64 received;
+        qint64 rasterized;
+        qint64 age;
+        // 注入的合成输入没有事件时间戳
+        bool hasAge;
+    };
+
+    qint64 now() const;
+    static quint64 groupKey(int penWidth, const QSize& screen);
+
+private:
+    bool enabled = false;
+    QElapsedTimer clock;
+    // 预先分配，测量本身不在输入路径上分配内存，超出容量的采样不统计
+    QVector<InFlight> inFlight;
+    int inFlightCount = 0;
+    qint64 paintedAt = -1;
+    // age 的最小值，作为投递延迟的基线
+    qint64 minAge = 0;
+    bool hasMinAge = false;
+    // 键为笔宽和画板尺寸
+    QMap<quint64, Group> groups;
+    qint64 total = 0;
+    qint64 dropped = 0;
+};
+
+#endif // LATENCYPROBE_H
@@ -0,0 +1,427 @@
+#include "layer.h"
+#include "allocationcounter.h"
+
+#include <QPainter>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+// 预乘格式的正片叠底 s*d + s*(1-da) + d*(1-sa)，循环内没有分支，编译器可以向量化
+void multiplyRow(const QRgb* src, QRgb* dst, int n)
+{
+    for(int x = 0; x < n; ++x)
+    {
+        const quint32 s = src[x];
+        const quint32 d = dst[x];
+        const quint32 sa = s >> 24;
+        const quint32 da = d >> 24;
+        quint32 out = 0;
+        for(int shift = 0; shift < 32; shift += 8)
+        {
+            const quint32 sc = (s >> shift) & 0xff;
+            const quint32 dc = (d >> shift) & 0xff;
+            quint32 t = sc * dc + sc * (255 - da) + dc * (255 - sa) + 128;
+            t = (t + (t >> 8)) >> 8;
+            out |= qMin<quint32>(t, 255) << shift;
+        }
+        dst[x] = out;
+    }
+}
+}
+
+Layer::Layer(const QSize& s, MemoryStats::Category c)
+    :layerSize(s)
+    ,tracker(c)
+{}
+
+QSize Layer::size() const
+{
+    return layerSize;
+}
+
+void Layer::resize(const QSize& s)
+{
+    layerSize = s;
+}
+
+QRect Layer::extent()
+{
+    return QRect(-32768 * TILE_SIZE, -32768 * TILE_SIZE, 65536 * TILE_SIZE, 65536 * TILE_SIZE);
+}
+
+quint32 Layer::tileKey(int tx, int ty)
+{
+    return (quint32(quint16(ty)) << 16) | quint32(quint16(tx));
+}
+
+QPoint Layer::tileIndex(quint32 key)
+{
+    return QPoint(qint16(key & 0xffff), qint16(key >> 16));
+}
+
+int Layer::floorDiv(int v, int d)
+{
+    return v >= 0 ? v / d : -((-v + d - 1) / d);
+}
+
+bool Layer::isEmpty() const
+{
+    return tiles.isEmpty() && compressed.isEmpty();
+}
+
+quint64 Layer::epoch() const
+{
+    return contentEpoch;
+}
+
+QRect Layer::bounds() const
+{
+    QRect r;
+    for(auto it = tiles.constBegin(); it != tiles.constEnd(); ++it)
+    {
+        r |= tileRect(it.key());
+    }
+    for(auto it = compressed.constBegin(); it != compressed.constEnd(); ++it)
+    {
+        r |= tileRect(it.key());
+    }
+    return r;
+}
+
+void Layer::clear()
+{
+    changed |= bounds();
+    tiles.clear();
+    compressed.clear();
+    ++contentEpoch;
+    contentChanged();
+}
+
+Layer::Tiles Layer::snapshot() const
+{
+    ensureResident();
+    return tiles;
+}
+
+void Layer::restore(const Tiles& t)
+{
+    changed |= bounds();
+    tiles = t;
+    compressed.clear();
+    changed |= bounds();
+    ++contentEpoch;
+    contentChanged();
+}
+
+Layer::Tiles Layer::diff(const Tiles& from, const Tiles& to)
+{
+    Tiles patch;
+    for(auto it = from.cbegin(); it != from.cend(); ++it)
+    {
+        auto found = to.constFind(it.key());
+        if(found == to.cend() || found->constBits() != it->constBits())
+        {
+            patch.insert(it.key(), it.value());
+        }
+    }
+    for(auto it = to.cbegin(); it != to.cend(); ++it)
+    {
+        if(!from.contains(it.key()))
+        {
+            patch.insert(it.key(), QImage());
+        }
+    }
+    return patch;
+}
+
+Layer::Tiles Layer::swap(const Tiles& patch)
+{
+    ensureResident();
+
+    Tiles out;
+    for(auto it = patch.cbegin(); it != patch.cend(); ++it)
+    {
+        out.insert(it.key(), tiles.take(it.key()));
+        if(!it->isNull())
+        {
+            tiles.insert(it.key(), it.value());
+        }
+        changed |= tileRect(it.key());
+    }
+    ++contentEpoch;
+    contentChanged();
+    return out;
+}
+
+qint64 Layer::bytes(const Tiles& t)
+{
+    qint64 total = 0;
+    for(const QImage& tile : t)
+    {
+        total += tile.sizeInBytes();
+    }
+    return total;
+}
+
+qint64 Layer::changedBytes(const Tiles& before, const Tiles& after)
+{
+    // 共享的瓦片指向同一块像素，constBits 不会触发复制
+    auto unique = [](const Tiles& from, const Tiles& other){
+        qint64 total = 0;
+        for(auto it = from.cbegin(); it != from.cend(); ++it)
+        {
+            auto found = other.constFind(it.key());
+            if(found == other.cend() || found->constBits() != it->constBits())
+            {
+                total += it->sizeInBytes();
+            }
+        }
+        return total;
+    };
+    return qMax(unique(before, after), unique(after, before));
+}
+
+QImage Layer::image() const
+{
+    QImage img(layerSize, QImage::Format_ARGB32_Premultiplied);
+    img.fill(Qt::transparent);
+
+    QPainter p(&img);
+    p.setCompositionMode(QPainter::CompositionMode_Source);
+    draw(&p, img.rect());
+    return img;
+}
+
+QPixmap Layer::toPixmap() const
+{
+    return QPixmap::fromImage(image());
+}
+
+void Layer::forEachTile(const QRect& r, bool create, const TileVisitor& fn)
+{
+    ensureResident();
+    const QRect area = r & extent();
+    if(area.isEmpty())
+    {
+        return;
+    }
+
+    bool allocated = false;
+    {
+        // 与撤销快照共享时第一次写入要复制，每笔只发生一次
+        ALLOCATION_EXPECTED_SCOPE();
+        tiles.detach();
+    }
+    for(int ty = floorDiv(area.top(), TILE_SIZE); ty <= floorDiv(area.bottom(), TILE_SIZE); ++ty)
+    {
+        for(int tx = floorDiv(area.left(), TILE_SIZE); tx <= floorDiv(area.right(), TILE_SIZE); ++tx)
+        {
+            const quint32 key = tileKey(tx, ty);
+            auto it = tiles.find(key);
+            if(it == tiles.end())
+            {
+                if(!create)
+                {
+                    continue;
+                }
+
+                ALLOCATION_EXPECTED_SCOPE();
+                QImage tile(TILE_SIZE, TILE_SIZE, QImage::Format_ARGB32_Premultiplied);
+                tile.fill(Qt::transparent);
+                it = tiles.insert(key, tile);
+                allocated = true;
+            }
+            if(!it->isDetached())
+            {
+                ALLOCATION_EXPECTED_SCOPE();
+                it->detach();
+            }
+            fn(&it.value(), QPoint(tx * TILE_SIZE, ty * TILE_SIZE));
+        }
+    }
+
+    changed |= area;
+    if(allocated)
+    {
+        contentChanged();
+    }
+}
+
+void Layer::forEachTile(const QRect& r, const ConstTileVisitor& fn) const
+{
+    ensureResident();
+    const QRect area = r & extent();
+    if(area.isEmpty() || tiles.isEmpty())
+    {
+        return;
+    }
+
+    const int tx0 = floorDiv(area.left(), TILE_SIZE);
+    const int ty0 = floorDiv(area.top(), TILE_SIZE);
+    const int tx1 = floorDiv(area.right(), TILE_SIZE);
+    const int ty1 = floorDiv(area.bottom(), TILE_SIZE);
+    // 缩小显示时区域很大，改为遍历已有瓦片，两种方式取较少的一种
+    if(qint64(tx1 - tx0 + 1) * (ty1 - ty0 + 1) > tiles.size())
+    {
+        for(auto it = tiles.constBegin(); it != tiles.constEnd(); ++it)
+        {
+            const QPoint index = tileIndex(it.key());
+            if(index.x() >= tx0 && index.x() <= tx1 && index.y() >= ty0 && index.y() <= ty1)
+            {
+                fn(it.value(), index * TILE_SIZE);
+            }
+        }
+        return;
+    }
+
+    for(int ty = ty0; ty <= ty1; ++ty)
+    {
+        for(int tx = tx0; tx <= tx1; ++tx)
+        {
+            auto it = tiles.constFind(tileKey(tx, ty));
+            if(it != tiles.constEnd())
+            {
+                fn(it.value(), QPoint(tx * TILE_SIZE, ty * TILE_SIZE));
+            }
+        }
+    }
+}
+
+void Layer::merge(const Layer& other)
+{
+    other.forEachTile(other.bounds(), [this](const QImage& src, const QPoint& origin){
+        // 两个图层的瓦片网格相同，每个源瓦片正好对应一个目标瓦片
+        forEachTile(QRect(origin, src.size()), true, [&src](QImage* dst, const QPoint&){
+            QPainter p(dst);
+            p.drawImage(0, 0, src);
+        });
+    });
+}
+
+void Layer::multiply(const Layer& other)
+{
+    other.forEachTile(other.bounds(), [this](const QImage& src, const QPoint& origin){
+        forEachTile(QRect(origin, src.size()), true, [&src](QImage* dst, const QPoint&){
+            for(int y = 0; y < TILE_SIZE; ++y)
+            {
+                multiplyRow(reinterpret_cast<const QRgb*>(src.constScanLine(y)), reinterpret_cast<QRgb*>(dst->scanLine(y)), TILE_SIZE);
+            }
+        });
+    });
+}
+
+void Layer::multiply(const Layer& other, const Tiles& base, const QRect& r)
+{
+    other.forEachTile(r, [this, &base](const QImage& src, const QPoint& origin){
+        const QImage under = base.value(tileKey(floorDiv(origin.x(), TILE_SIZE), floorDiv(origin.y(), TILE_SIZE)));
+        forEachTile(QRect(origin, src.size()), true, [&src, &under](QImage* dst, const QPoint&){
+            for(int y = 0; y < TILE_SIZE; ++y)
+            {
+                QRgb* row = reinterpret_cast<QRgb*>(dst->scanLine(y));
+                if(under.isNull())
+                {
+                    std::memset(row, 0, TILE_SIZE * sizeof(QRgb));
+                }
+                else
+                {
+                    std::memcpy(row, under.constScanLine(y), TILE_SIZE * sizeof(QRgb));
+                }
+                multiplyRow(reinterpret_cast<const QRgb*>(src.constScanLine(y)), row, TILE_SIZE);
+            }
+        });
+    });
+}
+
+void Layer::erase(const QRect& r)
+{
+    forEachTile(r, false, [&r](QImage* tile, const QPoint& origin){
+        QPainter p(tile);
+        p.setCompositionMode(QPainter::CompositionMode_Source);
+        p.fillRect(r.translated(-origin), Qt::transparent);
+    });
+}
+
+void Layer::draw(QPainter* p, const QRect& r) const
+{
+    const QRect& area = r;
+    forEachTile(area, [p, &area](const QImage& tile, const QPoint& origin){
+        QRect dst = QRect(origin, tile.size()) & area;
+        p->drawImage(dst, tile, dst.translated(-origin));
+    });
+}
+
+QRect Layer::takeChanged()
+{
+    QRect r = changed;
+    changed = QRect();
+    return r;
+}
+
+bool Layer::trim()
+{
+    bool trimmed = false;
+    for(auto it = tiles.begin(); it != tiles.end();)
+    {
+        const QImage& tile = it.value();
+        if(!tile.isDetached())
+        {
+            ++it;
+            continue;
+        }
+
+        // 擦除后全透明的瓦片直接丢弃
+        const quint32* px = reinterpret_cast<const quint32*>(tile.constBits());
+        if(!std::all_of(px, px + tile.sizeInBytes() / 4, [](quint32 v){ return v == 0; }))
+        {
+            // 画板大部分是透明像素，最快的压缩级别就足够
+            compressed.insert(it.key(), qCompress(tile.constBits(), int(tile.sizeInBytes()), 1));
+        }
+        it = tiles.erase(it);
+        trimmed = true;
+    }
+
+    if(trimmed)
+    {
+        contentChanged();
+    }
+    return trimmed;
+}
+
+bool Layer::isTrimmed() const
+{
+    return !compressed.isEmpty();
+}
+
+void Layer::ensureResident() const
+{
+    if(compressed.isEmpty())
+    {
+        return;
+    }
+
+    for(auto it = compressed.constBegin(); it != compressed.constEnd(); ++it)
+    {
+        QByteArray raw = qUncompress(it.value());
+        QImage tile(TILE_SIZE, TILE_SIZE, QImage::Format_ARGB32_Premultiplied);
+        std::memcpy(tile.bits(), raw.constData(), size_t(qMin<qsizetype>(raw.size(), tile.sizeInBytes())));
+        tiles.insert(it.key(), tile);
+    }
+    compressed.clear();
+    contentChanged();
+}
+
+QRect Layer::tileRect(quint32 key)
+{
+    return QRect(tileIndex(key) * TILE_SIZE, QSize(TILE_SIZE, TILE_SIZE));
+}
+
+void Layer::contentChanged() const
+{
+    qint64 total = bytes(tiles);
+    for(const QByteArray& data : compressed)
+    {
+        total += data.size();
+    }
+    tracker.update(total);
+}
@@ -0,0 +1,100 @@
+#ifndef LAYER_H
+#define LAYER_H
+
+#include "memorystats.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QImage>
+#include <QPixmap>
+
+#include <functional>
+
+class QPainter;
+
+// 按固定尺寸的瓦片稀疏存储，只有画过的区域才分配像素；坐标可以为负，画布没有边界
+class Layer
+{
+public:
+    static const int TILE_SIZE = 128;
+    // 键为 16 位有符号的 (ty << 16) | tx，瓦片之间隐式共享，撤销记录只复制被修改的瓦片
+    using Tiles = QHash<quint32, QImage>;
+    // origin 为瓦片左上角在图层中的坐标
+    using TileVisitor = std::function<void(QImage* tile, const QPoint& origin)>;
+    using ConstTileVisitor = std::function<void(const QImage& tile, const QPoint& origin)>;
+
+    Layer() = default;
+    explicit Layer(const QSize& s, MemoryStats::Category c = MemoryStats::BOARD);
+
+    // 导出范围，从原点开始；绘制不受其限制
+    QSize size() const;
+    void resize(const QSize& s);
+    // 瓦片键能表示的坐标范围
+    static QRect extent();
+    static quint32 tileKey(int tx, int ty);
+    static QPoint tileIndex(quint32 key);
+    // 向下取整的除法，负坐标也落在正确的瓦片
+    static int floorDiv(int v, int d);
+
+    bool isEmpty() const;
+    quint64 epoch() const;
+    // 已分配瓦片的外接矩形
+    QRect bounds() const;
+
+    // 切换到一个新的空白 epoch，不复制也不填充像素
+    void clear();
+    // 与当前 epoch 共享瓦片，用于撤销
+    Tiles snapshot() const;
+    void restore(const Tiles& t);
+    // from 与 to 之间被改动的瓦片在 from 中的版本，to 中新增的瓦片记为空图像
+    static Tiles diff(const Tiles& from, const Tiles& to);
+    // 把 patch 中的瓦片换入图层，空图像表示删除；返回被换出的瓦片，格式与 patch 相同
+    Tiles swap(const Tiles& patch);
+    static qint64 bytes(const Tiles& t);
+    // 相邻两个快照之间被改动的瓦片，取两侧中较大的一侧
+    // 撤销记录首尾共享瓦片，每条记录独占的只有改动瓦片的一个版本：已执行时是修改前的，撤销后是修改后的
+    static qint64 changedBytes(const Tiles& before, const Tiles& after);
+
+    // 展开成整张图，只用于导出
+    QImage image() const;
+    QPixmap toPixmap() const;
+
+    // 直接像素访问，格式固定为 ARGB32_Premultiplied；create 为真时分配 r 覆盖的瓦片
+    void forEachTile(const QRect& r, bool create, const TileVisitor& fn);
+    void forEachTile(const QRect& r, const ConstTileVisitor& fn) const;
+    // 把另一图层按 SourceOver 合并进来
+    void merge(const Layer& other);
+    // 把另一图层按正片叠底合并进来，只处理对方已分配的瓦片
+    void multiply(const Layer& other);
+    // r 内 other 已分配的瓦片：以 base 中的同一瓦片为底重新叠底，结果写入本图层
+    // 笔画进行中反复调用，结果与抬起时对 base 整体叠底一次相同
+    void multiply(const Layer& other, const Tiles& base, const QRect& r);
+    // 把 r 内的像素清为透明，不释放瓦片
+    void erase(const QRect& r);
+
+    // r 为目标区域，图层与窗口同尺寸，源区域与目标一致
+    void draw(QPainter* p, const QRect& r) const;
+
+    // 自上次调用以来被修改过的区域
+    QRect takeChanged();
+
+    // 空闲时把瓦片压缩保存，下次访问时自动解压；撤销记录只保存改动过的旧瓦片，
+    // 图层中的瓦片通常只有自己持有；仍被后台任务等临时共享的瓦片不处理
+    bool trim();
+    bool isTrimmed() const;
+    void ensureResident() const;
+
+private:
+    static QRect tileRect(quint32 key);
+    void contentChanged() const;
+
+private:
+    QSize layerSize;
+    mutable Tiles tiles;
+    mutable QHash<quint32, QByteArray> compressed;
+    QRect changed;
+    quint64 contentEpoch = 0;
+    mutable MemoryTracker tracker{MemoryStats::BOARD};
+};
+
+#endif // LAYER_H
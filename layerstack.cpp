@@ -0,0 +1,371 @@
+#include "layerstack.h"
+
+#include <QPainter>
+
+LayerStack::LayerStack(const QSize& s)
+    :stackSize(s)
+    ,flattened(s, MemoryStats::FLATTEN)
+{}
+
+QSize LayerStack::size() const
+{
+    return stackSize;
+}
+
+void LayerStack::resize(const QSize& s)
+{
+    if(stackSize == s)
+    {
+        return;
+    }
+
+    stackSize = s;
+    for(Entry& e : entries)
+    {
+        e.layer.resize(s);
+    }
+    flattened.resize(s);
+    invalidate(QRect(QPoint(0,0), s));
+}
+
+int LayerStack::count() const
+{
+    return entries.size();
+}
+
+const LayerStack::Entry& LayerStack::at(int index) const
+{
+    return entries.at(index);
+}
+
+int LayerStack::indexOf(quint32 id) const
+{
+    for(int i = 0; i < entries.size(); ++i)
+    {
+        if(entries.at(i).id == id)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+Layer* LayerStack::find(quint32 id)
+{
+    int index = indexOf(id);
+    return index < 0 ? nullptr : &entries[index].layer;
+}
+
+int LayerStack::currentIndex() const
+{
+    return currentLayer;
+}
+
+void LayerStack::setCurrentIndex(int index)
+{
+    if(index >= 0 && index < entries.size())
+    {
+        currentLayer = index;
+    }
+}
+
+Layer* LayerStack::current()
+{
+    return currentLayer < 0 ? nullptr : &entries[currentLayer].layer;
+}
+
+quint32 LayerStack::currentId() const
+{
+    return currentLayer < 0 ? 0 : entries.at(currentLayer).id;
+}
+
+quint32 LayerStack::add(const QString& name)
+{
+    Entry e;
+    e.id = nextId++;
+    e.name = name;
+    e.layer = Layer(stackSize, MemoryStats::BOARD);
+
+    // 新图层是空的，不影响合成结果
+    currentLayer = currentLayer + 1;
+    entries.insert(currentLayer, e);
+    return e.id;
+}
+
+void LayerStack::insert(int index, const Entry& e)
+{
+    collectChanges();
+
+    index = qBound(0, index, int(entries.size()));
+    entries.insert(index, e);
+    entries[index].layer.resize(stackSize);
+    entries[index].layer.takeChanged();
+    currentLayer = index;
+    nextId = qMax(nextId, e.id + 1);
+
+    if(e.visible)
+    {
+        invalidate(entries.at(index).layer.bounds());
+    }
+}
+
+LayerStack::Entry LayerStack::take(int index)
+{
+    collectChanges();
+
+    Entry e = entries.takeAt(index);
+    if(currentLayer >= entries.size() || currentLayer > index)
+    {
+        --currentLayer;
+    }
+    if(currentLayer < 0 && !entries.isEmpty())
+    {
+        currentLayer = 0;
+    }
+
+    if(e.visible)
+    {
+        invalidate(e.layer.bounds());
+    }
+    return e;
+}
+
+void LayerStack::move(int from, int to)
+{
+    if(from == to || from < 0 || to < 0 || from >= entries.size() || to >= entries.size())
+    {
+        return;
+    }
+    collectChanges();
+
+    quint32 currentEntry = currentId();
+    entries.move(from, to);
+    currentLayer = indexOf(currentEntry);
+
+    // 顺序只影响被移动图层覆盖的区域
+    if(entries.at(to).visible)
+    {
+        invalidate(entries.at(to).layer.bounds());
+    }
+}
+
+void LayerStack::setVisible(int index, bool v)
+{
+    if(index < 0 || index >= entries.size() || entries.at(index).visible == v)
+    {
+        return;
+    }
+    collectChanges();
+
+    entries[index].visible = v;
+    invalidate(entries.at(index).layer.bounds());
+}
+
+bool LayerStack::isEmpty() const
+{
+    for(const Entry& e : entries)
+    {
+        if(!e.layer.isEmpty())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void LayerStack::flatten(const QRect& r)
+{
+    ensureResident();
+    collectChanges();
+
+    if(visibleCount() <= 1)
+    {
+        // 只有一个图层有内容时直接绘制，缓存不再需要
+        if(flattenedValid)
+        {
+            flattened.clear();
+            flattened.takeChanged();
+            flattenedDirty = QRegion();
+            flattenedValid = false;
+        }
+        return;
+    }
+
+    if(!flattenedValid)
+    {
+        flattenedValid = true;
+        flattenedDirty = QRegion();
+        for(const Entry& e : entries)
+        {
+            if(e.visible)
+            {
+                flattenedDirty += e.layer.bounds();
+            }
+        }
+    }
+
+    // 只合成本次要绘制且过期的部分，其余留到下次
+    const QRegion todo = flattenedDirty & r;
+    if(todo.isEmpty())
+    {
+        return;
+    }
+    flattenedDirty -= todo;
+
+    for(const QRect& rect : todo)
+    {
+        flattened.erase(rect);
+        for(const Entry& e : entries)
+        {
+            if(!e.visible)
+            {
+                continue;
+            }
+
+            e.layer.forEachTile(rect, [this, &rect](const QImage& src, const QPoint& origin){
+                const QRect area = QRect(origin, src.size()) & rect;
+                flattened.forEachTile(area, true, [&](QImage* dst, const QPoint& dstOrigin){
+                    QPainter p(dst);
+                    p.drawImage(area.topLeft() - dstOrigin, src, area.translated(-origin));
+                });
+            });
+        }
+    }
+    flattened.takeChanged();
+}
+
+void LayerStack::draw(QPainter* p, const QRect& r) const
+{
+    if(flattenedValid)
+    {
+        flattened.draw(p, r);
+        return;
+    }
+
+    for(const Entry& e : entries)
+    {
+        if(e.visible)
+        {
+            e.layer.draw(p, r);
+        }
+    }
+}
+
+QImage LayerStack::image() const
+{
+    QImage img(stackSize, QImage::Format_ARGB32_Premultiplied);
+    img.fill(Qt::transparent);
+
+    QPainter p(&img);
+    for(const Entry& e : entries)
+    {
+        if(e.visible)
+        {
+            e.layer.draw(&p, img.rect());
+        }
+    }
+    return img;
+}
+
+Layer::Tiles LayerStack::composite()
+{
+    flatten(contentBounds());
+    if(flattenedValid)
+    {
+        return flattened.snapshot();
+    }
+
+    for(const Entry& e : std::as_const(entries))
+    {
+        if(e.visible && !e.layer.isEmpty())
+        {
+            return e.layer.snapshot();
+        }
+    }
+    return Layer::Tiles();
+}
+
+QRect LayerStack::contentBounds() const
+{
+    QRect r;
+    for(const Entry& e : entries)
+    {
+        if(e.visible)
+        {
+            r |= e.layer.bounds();
+        }
+    }
+    return r;
+}
+
+QRect LayerStack::takeCommitted()
+{
+    collectChanges();
+
+    QRect r = committed;
+    committed = QRect();
+    return r;
+}
+
+QRect LayerStack::uncommitted() const
+{
+    return committed;
+}
+
+bool LayerStack::trim()
+{
+    // 合成缓存可以随时重建，直接释放
+    flattened.clear();
+    flattened.takeChanged();
+    flattenedDirty = QRegion();
+    flattenedValid = false;
+
+    bool trimmed = false;
+    for(Entry& e : entries)
+    {
+        trimmed |= e.layer.trim();
+    }
+    return trimmed;
+}
+
+void LayerStack::ensureResident() const
+{
+    for(const Entry& e : entries)
+    {
+        e.layer.ensureResident();
+    }
+}
+
+void LayerStack::collectChanges()
+{
+    for(Entry& e : entries)
+    {
+        QRect c = e.layer.takeChanged();
+        if(e.visible && !c.isEmpty())
+        {
+            invalidate(c);
+        }
+    }
+}
+
+void LayerStack::invalidate(const QRect& r)
+{
+    committed |= r;
+    if(flattenedValid)
+    {
+        flattenedDirty += r;
+    }
+}
+
+int LayerStack::visibleCount() const
+{
+    int n = 0;
+    for(const Entry& e : entries)
+    {
+        if(e.visible && !e.layer.isEmpty())
+        {
+            ++n;
+        }
+    }
+    return n;
+}
@@ -0,0 +1,80 @@
+#ifndef LAYERSTACK_H
+#define LAYERSTACK_H
+
+#include "layer.h"
+
+#include <QRegion>
+#include <QString>
+#include <QVector>
+
+// 用户可见的批注图层，自底向上排列；多个图层可见时缓存合成结果
+class LayerStack
+{
+public:
+    struct Entry{
+        // 撤销记录通过 id 找回图层，不受增删和排序影响
+        quint32 id = 0;
+        QString name;
+        bool visible = true;
+        Layer layer;
+    };
+
+    LayerStack() = default;
+    explicit LayerStack(const QSize& s);
+
+    QSize size() const;
+    void resize(const QSize& s);
+
+    int count() const;
+    const Entry& at(int index) const;
+    int indexOf(quint32 id) const;
+    Layer* find(quint32 id);
+
+    int currentIndex() const;
+    void setCurrentIndex(int index);
+    Layer* current();
+    quint32 currentId() const;
+
+    // 在当前图层之上新建图层并设为当前图层
+    quint32 add(const QString& name);
+    void insert(int index, const Entry& e);
+    Entry take(int index);
+    void move(int from, int to);
+    void setVisible(int index, bool v);
+
+    bool isEmpty() const;
+
+    // 在界面线程更新 r 内的合成缓存，之后 draw 只读，可以在多个线程并发调用
+    void flatten(const QRect& r);
+    void draw(QPainter* p, const QRect& r) const;
+    QImage image() const;
+
+    // 所有可见图层合成后的瓦片，供生成缩略层级使用
+    Layer::Tiles composite();
+    QRect contentBounds() const;
+    // 自上次调用以来合成结果发生变化的区域
+    QRect takeCommitted();
+    QRect uncommitted() const;
+
+    bool trim();
+    void ensureResident() const;
+
+private:
+    // 收集各图层的修改区域，只重新合成这些区域
+    void collectChanges();
+    void invalidate(const QRect& r);
+    int visibleCount() const;
+
+private:
+    QSize stackSize;
+    QVector<Entry> entries;
+    int currentLayer = -1;
+    quint32 nextId = 1;
+
+    Layer flattened{QSize(), MemoryStats::FLATTEN};
+    QRegion flattenedDirty;
+    bool flattenedValid = false;
+    QRect committed;
+};
+
+#endif // LAYERSTACK_H
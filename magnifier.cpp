@@ -0,0 +1,125 @@
+#include "magnifier.h"
+
+#include <QPainter>
+#include <QPainterPath>
+
+#include <cmath>
+
+void Magnifier::setSource(const QImage& screenshot)
+{
+    levels.clear();
+    if(screenshot.isNull())
+    {
+        updateTracker();
+        return;
+    }
+
+    levels.append(screenshot.convertToFormat(QImage::Format_ARGB32_Premultiplied));
+    while(levels.size() <= MAX_LEVEL && levels.last().width() > 1 && levels.last().height() > 1)
+    {
+        const QImage& last = levels.last();
+        levels.append(last.scaled(last.width() / 2, last.height() / 2, Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
+    }
+    updateTracker();
+}
+
+void Magnifier::clear()
+{
+    levels.clear();
+    lens = QImage();
+    hide();
+    updateTracker();
+}
+
+bool Magnifier::isEmpty() const
+{
+    return levels.isEmpty();
+}
+
+void Magnifier::setZoom(qreal z)
+{
+    lensZoom = qBound(MIN_ZOOM, z, MAX_ZOOM);
+}
+
+qreal Magnifier::zoom() const
+{
+    return lensZoom;
+}
+
+void Magnifier::setRadius(int r)
+{
+    radius = qMax(8, r);
+}
+
+QRect Magnifier::render(const QPointF& center, const QSize& widgetSize)
+{
+    if(levels.isEmpty() || widgetSize.isEmpty())
+    {
+        hide();
+        return QRect();
+    }
+
+    // 镜片中一个窗口像素对应截图上 step 个像素，选间距不超过 step 的最粗一级
+    const qreal scale = qreal(levels.first().width()) / widgetSize.width();
+    const qreal step = scale / lensZoom;
+    const int level = step > 1 ? qMin(int(std::floor(std::log2(step))), int(levels.size()) - 1) : 0;
+    const QImage& src = levels.at(level);
+    const qreal f = qreal(src.width()) / levels.first().width();
+
+    const int d = radius * 2;
+    if(lens.size() != QSize(d, d))
+    {
+        lens = QImage(d, d, QImage::Format_ARGB32_Premultiplied);
+        updateTracker();
+    }
+    lens.fill(Qt::transparent);
+
+    const QPointF c = center * scale * f;
+    const qreal half = radius * step * f;
+    const QRectF source(c.x() - half, c.y() - half, 2 * half, 2 * half);
+
+    QPainter p(&lens);
+    p.setRenderHint(QPainter::Antialiasing);
+    p.setRenderHint(QPainter::SmoothPixmapTransform, lensZoom < 4);
+    QPainterPath circle;
+    circle.addEllipse(QRectF(1, 1, d - 2, d - 2));
+    p.setClipPath(circle);
+    p.drawImage(QRectF(0, 0, d, d), src, source);
+    p.setClipping(false);
+    p.setPen(QPen(QColor(255, 255, 255, 220), 2));
+    p.setBrush(Qt::NoBrush);
+    p.drawPath(circle);
+
+    lensRect = QRect(center.toPoint() - QPoint(radius, radius), QSize(d, d));
+    return lensRect;
+}
+
+void Magnifier::hide()
+{
+    lensRect = QRect();
+}
+
+QRect Magnifier::rect() const
+{
+    return lensRect;
+}
+
+void Magnifier::draw(QPainter* p, const QRect& r) const
+{
+    if(lensRect.isEmpty() || !lensRect.intersects(r))
+    {
+        return;
+    }
+    const QRect dst = lensRect & r;
+    p->drawImage(dst, lens, dst.translated(-lensRect.topLeft()));
+}
+
+void Magnifier::updateTracker()
+{
+    qint64 total = lens.sizeInBytes();
+    for(const QImage& img : std::as_const(levels))
+    {
+        total += img.sizeInBytes();
+    }
+    tracker.update(total);
+}
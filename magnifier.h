@@ -0,0 +1,48 @@
+#ifndef MAGNIFIER_H
+#define MAGNIFIER_H
+
+#include "memorystats.h"
+
+#include <QImage>
+#include <QRect>
+#include <QVector>
+
+class QPainter;
+
+// 冻结截图上的放大镜；截图预先生成逐级减半的缩略图，每帧只按镜片大小取样，与放大倍数无关
+class Magnifier
+{
+public:
+    static const int MAX_LEVEL = 6;
+    static constexpr qreal MIN_ZOOM = 0.25;
+    static constexpr qreal MAX_ZOOM = 16.0;
+
+    void setSource(const QImage& screenshot);
+    void clear();
+    bool isEmpty() const;
+
+    void setZoom(qreal z);
+    qreal zoom() const;
+    void setRadius(int r);
+
+    // 以窗口坐标 center 为中心重新生成镜片，widgetSize 用于换算截图像素
+    QRect render(const QPointF& center, const QSize& widgetSize);
+    void hide();
+    // 镜片当前在窗口中的范围，隐藏时为空
+    QRect rect() const;
+    void draw(QPainter* p, const QRect& r) const;
+
+private:
+    void updateTracker();
+
+private:
+    QVector<QImage> levels;
+    QImage lens;
+    QRect lensRect;
+    qreal lensZoom = 2.0;
+    int radius = 120;
+
+    MemoryTracker tracker{MemoryStats::MAGNIFIER};
+};
+
+#endif // MAGNIFIER_H
@@ -1,5 +1,7 @@
+#include "batchrenderer.h"
 #include "config.h"
 #include "dbapplication.h"
+#include "trace.h"
 #include "translator.h"
 #include "trayicon.h"
 
@@ -14,8 +16,18 @@ const char* CONFIG_LANGUAGE = "language";
 
 int main(int argc, char *argv[])
 {
+    // 离线渲染不创建托盘和窗口
+    if(BatchRender::requested(argc, argv))
+    {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+        DBApplication a(argc, argv);
+        return BatchRender::run(a.arguments());
+    }
+
     DBApplication a(argc, argv);
     a.setQuitOnLastWindowClosed(false); // 关闭最后一个窗口时不退出应用
+    a.setAttribute(Qt::AA_CompressHighFrequencyEvents, false); // 保留高回报率设备的每个采样
+    a.setAttribute(Qt::AA_CompressTabletEvents, false);
 
     Config* config = a.getSingleton<Config>();
     ConfigHandle* handle = config->getConfigHandle(Config::INTERNAL);
@@ -61,5 +73,12 @@ int main(int argc, char *argv[])
     });
 
     icon.show();
-    return a.exec();
+    const int ret = a.exec();
+
+    const QString traceFile = handle->getString("trace.file");
+    if(Trace::isEnabled() && !traceFile.isEmpty())
+    {
+        Trace::dump(traceFile);
+    }
+    return ret;
 }
@@ -0,0 +1,198 @@
+#include "memorystats.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+#include <QJsonDocument>
+
+namespace {
+MemoryStats* self = nullptr;
+}
+
+MemoryStats::MemoryStats(QObject *parent)
+    : QObject{parent}
+{
+    for(int i = 0; i < CATEGORY_COUNT; ++i)
+    {
+        counters[i].storeRelaxed(0);
+        peaks[i].storeRelaxed(0);
+    }
+    self = this;
+}
+
+MemoryStats::~MemoryStats()
+{
+    if(self == this)
+    {
+        self = nullptr;
+    }
+}
+
+MemoryStats* MemoryStats::instance()
+{
+    return self;
+}
+
+void MemoryStats::add(Category c, qint64 bytes)
+{
+    if(bytes == 0)
+    {
+        return;
+    }
+
+    qint64 now = counters[c].fetchAndAddRelaxed(bytes) + bytes;
+    if(now > peaks[c].loadRelaxed())
+    {
+        peaks[c].storeRelaxed(now);
+    }
+
+    qint64 sum = totalBytes.fetchAndAddRelaxed(bytes) + bytes;
+    if(budgetBytes > 0)
+    {
+        if(sum > budgetBytes && !overBudget)
+        {
+            qWarning() << "memory budget exceeded" << sum << ">" << budgetBytes << toJson();
+        }
+        overBudget = sum > budgetBytes;
+    }
+}
+
+qint64 MemoryStats::bytes(Category c) const
+{
+    return counters[c].loadRelaxed();
+}
+
+qint64 MemoryStats::peak(Category c) const
+{
+    return peaks[c].loadRelaxed();
+}
+
+qint64 MemoryStats::total() const
+{
+    return totalBytes.loadRelaxed();
+}
+
+void MemoryStats::setBudget(qint64 bytes)
+{
+    budgetBytes = bytes;
+    overBudget = false;
+}
+
+qint64 MemoryStats::budget() const
+{
+    return budgetBytes;
+}
+
+void MemoryStats::recordRestoreLatency(qint64 nsecs)
+{
+    lastRestoreNsecs = nsecs;
+    maxRestoreNsecs = qMax(maxRestoreNsecs, nsecs);
+    ++restoreCount;
+}
+
+QString MemoryStats::categoryName(Category c)
+{
+    switch (c) {
+    case BACKGROUND: return "background";
+    case BOARD: return "board";
+    case STAGING: return "staging";
+    case FOREGROUND: return "foreground";
+    case BACKING: return "backing";
+    case SCREENSHOT: return "screenshot";
+    case UNDO: return "undo";
+    case PREVIEW: return "preview";
+    case PEN_SHAPE: return "pen.shape";
+    case FLATTEN: return "flatten";
+    case PYRAMID: return "pyramid";
+    case GLYPH: return "glyph";
+    case MAGNIFIER: return "magnifier";
+    case SELECTION: return "selection";
+    case TIMELAPSE: return "timelapse";
+    default: return "unknown";
+    }
+}
+
+QJsonObject MemoryStats::toJson() const
+{
+    QJsonObject current;
+    QJsonObject peak;
+    for(int i = 0; i < CATEGORY_COUNT; ++i)
+    {
+        QString name = categoryName(Category(i));
+        current.insert(name, bytes(Category(i)));
+        peak.insert(name, this->peak(Category(i)));
+    }
+
+    QJsonObject obj;
+    obj.insert("timestamp", QDateTime::currentDateTime().toString(Qt::ISODateWithMs));
+    obj.insert("total", total());
+    obj.insert("budget", budgetBytes);
+    obj.insert("bytes", current);
+    obj.insert("peak", peak);
+
+    QJsonObject restore;
+    restore.insert("count", restoreCount);
+    restore.insert("last.ms", double(lastRestoreNsecs) / 1000000.0);
+    restore.insert("max.ms", double(maxRestoreNsecs) / 1000000.0);
+    obj.insert("restore", restore);
+    return obj;
+}
+
+bool MemoryStats::dump(const QString& filePath) const
+{
+    QFile file(filePath);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Text))
+    {
+        qDebug() << "open memory dump file failed" << filePath;
+        return false;
+    }
+
+    file.write(QJsonDocument(toJson()).toJson());
+    return true;
+}
+
+
+MemoryTracker::MemoryTracker(MemoryStats::Category c)
+    :category(c)
+{}
+
+MemoryTracker::MemoryTracker(const MemoryTracker& other)
+    :category(other.category)
+{
+    update(other.current);
+}
+
+MemoryTracker& MemoryTracker::operator=(const MemoryTracker& other)
+{
+    if(this != &other)
+    {
+        update(0);
+        category = other.category;
+        update(other.current);
+    }
+    return *this;
+}
+
+MemoryTracker::~MemoryTracker()
+{
+    update(0);
+}
+
+void MemoryTracker::update(qint64 bytes)
+{
+    if(bytes == current)
+    {
+        return;
+    }
+
+    if(MemoryStats* s = MemoryStats::instance())
+    {
+        s->add(category, bytes - current);
+    }
+    current = bytes;
+}
+
+qint64 MemoryTracker::bytes() const
+{
+    return current;
+}
@@ -0,0 +1,82 @@
+#ifndef MEMORYSTATS_H
+#define MEMORYSTATS_H
+
+#include <QAtomicInteger>
+#include <QJsonObject>
+#include <QObject>
+
+class MemoryStats : public QObject
+{
+    Q_OBJECT
+public:
+    enum Category{
+        BACKGROUND,
+        BOARD,
+        STAGING,
+        FOREGROUND,
+        BACKING,
+        SCREENSHOT,
+        UNDO,
+        PREVIEW,
+        PEN_SHAPE,
+        FLATTEN,
+        PYRAMID,
+        GLYPH,
+        MAGNIFIER,
+        SELECTION,
+        TIMELAPSE,
+
+        CATEGORY_COUNT,
+    };
+
+    explicit MemoryStats(QObject *parent = nullptr);
+    ~MemoryStats();
+
+    // MemoryTracker 在应用析构过程中也可能调用，不能依赖 getSingleton
+    static MemoryStats* instance();
+
+    void add(Category c, qint64 bytes);
+    qint64 bytes(Category c) const;
+    qint64 peak(Category c) const;
+    qint64 total() const;
+
+    // 超出预算时打印警告，0 表示不限制
+    void setBudget(qint64 bytes);
+    qint64 budget() const;
+
+    // 空闲回收后恢复内存的耗时
+    void recordRestoreLatency(qint64 nsecs);
+
+    static QString categoryName(Category c);
+    QJsonObject toJson() const;
+    bool dump(const QString& filePath) const;
+
+private:
+    QAtomicInteger<qint64> counters[CATEGORY_COUNT];
+    QAtomicInteger<qint64> peaks[CATEGORY_COUNT];
+    QAtomicInteger<qint64> totalBytes = 0;
+    qint64 budgetBytes = 0;
+    bool overBudget = false;
+    qint64 lastRestoreNsecs = 0;
+    qint64 maxRestoreNsecs = 0;
+    int restoreCount = 0;
+};
+
+// 记录某块内存当前占用的字节数，析构时自动归还
+class MemoryTracker
+{
+public:
+    explicit MemoryTracker(MemoryStats::Category c);
+    MemoryTracker(const MemoryTracker& other);
+    MemoryTracker& operator=(const MemoryTracker& other);
+    ~MemoryTracker();
+
+    void update(qint64 bytes);
+    qint64 bytes() const;
+
+private:
+    MemoryStats::Category category;
+    qint64 current = 0;
+};
+
+#endif // MEMORYSTATS_H
@@ -6,6 +6,22 @@
 class Pen : public QPen
 {
 public:
+    // 自由笔画或按下、拖动、抬起确定的形状
+    enum Tool{
+        FREEHAND,
+        LINE,
+        ARROW,
+        RECTANGLE,
+        ELLIPSE,
+        TEXT,
+        // 放大镜不绘制，只在冻结的截图上跟随光标
+        MAGNIFIER,
+        // 油漆桶，点击处的连通区域整体填色
+        FILL,
+        // 套索选取，选中的内容可以拖动、缩放或删除
+        SELECT,
+    };
+
     Pen():QPen(){}
     Pen(Qt::PenStyle s):QPen(s){}
     Pen(const QColor &color):QPen(color){}
@@ -18,6 +34,11 @@ public:
     virtual QPixmap shape() const = 0;
     virtual QPixmap staticShape() const = 0;
     virtual bool isEraser() const = 0;
+    virtual Tool tool() const { return FREEHAND; }
+    // 荧光笔笔画与下方内容正片叠底，重叠部分不会加深
+    virtual bool isHighlighter() const { return false; }
+    // 激光笔迹不写入图层，抬起后几秒内淡出
+    virtual bool isLaser() const { return false; }
 };
 
 #endif // PEN_H
@@ -2,6 +2,7 @@
 #include "tools.h"
 #include "config.h"
 #include "dbapplication.h"
+#include "trace.h"
 
 #include <capabilitybutton.h>
 
@@ -16,6 +17,7 @@ Preview::Preview(const QPixmap& pix, QWidget* parent)
     : QWidget{parent}
 {
     this->pix = pix;
+    tracker.update(qint64(pix.width()) * pix.height() * pix.depth() / 8);
 
     DBApplication* app = static_cast<DBApplication*>(qApp);
     ConfigHandle* handle = app->getSingleton<Config>()->getConfigHandle(Config::INTERNAL);
@@ -126,6 +128,7 @@ bool Preview::isMaxMode(const QSize& s)
 
 void Preview::download()
 {
+    TRACE_SCOPE("Preview::save");
     pix.save(localFilePath);
 }
 
@@ -1,6 +1,8 @@
 #ifndef PREVIEW_H
 #define PREVIEW_H
 
+#include "memorystats.h"
+
 #include <QWidget>
 
 class QBoxLayout;
@@ -46,6 +48,7 @@ private:
     QSize maxSize;
     QSize minSize;
     QString localFilePath;
+    MemoryTracker tracker{MemoryStats::PREVIEW};
 };
 
 #endif // PREVIEW_H
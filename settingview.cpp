@@ -1,10 +1,13 @@
 #include "config.h"
 #include "dbapplication.h"
+#include "memorystats.h"
 #include "settingview.h"
 #include "ui_settingview.h"
 
+#include <QDateTime>
 #include <QDesktopServices>
 #include <QFileDialog>
+#include <QTimer>
 
 SettingView::SettingView(QWidget *parent)
     :QWidget(parent, Qt::WindowStaysOnTopHint | Qt::Dialog)
@@ -29,6 +32,16 @@ SettingView::SettingView(QWidget *parent)
         if(id == "dir.download")
             ui->downloadDirEdit->setText(handle->getString("dir.download"));
     });
+
+    QTimer* memoryTimer = new QTimer(this);
+    connect(memoryTimer, &QTimer::timeout, this, [this](){
+        if(ui->tabWidget->currentWidget() == ui->tab_4)
+        {
+            refreshMemoryStats();
+        }
+    });
+    memoryTimer->start(1000);
+    connect(ui->tabWidget, &QTabWidget::currentChanged, this, &SettingView::refreshMemoryStats);
 }
 
 SettingView::~SettingView()
@@ -112,3 +125,40 @@ void SettingView::on_checkBox_displayPen_clicked(bool checked)
     handle->setValue("display.pen", checked);
 }
 
+
+void SettingView::on_pushButton_dumpMemory_clicked()
+{
+    MemoryStats* stats = static_cast<DBApplication*>(qApp)->getSingleton<MemoryStats>();
+    Q_ASSERT(stats);
+    ConfigHandle* handle = static_cast<DBApplication*>(qApp)->getSingleton<Config>()->getConfigHandle(Config::INTERNAL);
+    Q_ASSERT(handle);
+
+    QString filePath = handle->getString("const.dir.setting")
+            + "/memory-" + QDateTime::currentDateTime().toString("yyyy-MM-dd-hh-mm-ss") + ".json";
+    ui->label_memoryDump->setText(stats->dump(filePath) ? filePath : QString());
+}
+
+void SettingView::refreshMemoryStats()
+{
+    MemoryStats* stats = static_cast<DBApplication*>(qApp)->getSingleton<MemoryStats>();
+    Q_ASSERT(stats);
+
+    auto mb = [](qint64 bytes){
+        return QString::number(double(bytes) / (1024 * 1024), 'f', 2) + " MB";
+    };
+
+    QStringList lines;
+    for(int i = 0; i < MemoryStats::CATEGORY_COUNT; ++i)
+    {
+        MemoryStats::Category c = MemoryStats::Category(i);
+        lines << QString("%1: %2 (peak %3)").arg(MemoryStats::categoryName(c), mb(stats->bytes(c)), mb(stats->peak(c)));
+    }
+    lines << QString();
+    lines << QString("%1: %2").arg(tr("setting.label.text.memory.total"), mb(stats->total()));
+    if(stats->budget() > 0)
+    {
+        lines << QString("%1: %2").arg(tr("setting.label.text.memory.budget"), mb(stats->budget()));
+    }
+
+    ui->plainTextEdit_memory->setPlainText(lines.join("\n"));
+}
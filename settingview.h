@@ -32,6 +32,11 @@ private slots:
 
     void on_checkBox_displayPen_clicked(bool checked);
 
+    void on_pushButton_dumpMemory_clicked();
+
+private:
+    void refreshMemoryStats();
+
 private:
     Ui::SettingView *ui;
 };
@@ -0,0 +1,271 @@
+#include "strokeprotocol.h"
+
+#include <QtMath>
+
+namespace {
+void putVarint(QByteArray* out, quint64 v)
+{
+    while(v >= 0x80)
+    {
+        out->append(char(quint8(v) | 0x80));
+        v >>= 7;
+    }
+    out->append(char(quint8(v)));
+}
+
+void putSigned(QByteArray* out, qint64 v)
+{
+    putVarint(out, (quint64(v) << 1) ^ quint64(v >> 63));
+}
+
+// 越界或超过 10 字节时返回 false
+bool getVarint(const char*& p, const char* end, quint64* v)
+{
+    quint64 result = 0;
+    for(int shift = 0; shift < 64 && p < end; shift += 7)
+    {
+        const quint8 b = quint8(*p++);
+        result |= quint64(b & 0x7f) << shift;
+        if(!(b & 0x80))
+        {
+            *v = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool getSigned(const char*& p, const char* end, qint64* v)
+{
+    quint64 u = 0;
+    if(!getVarint(p, end, &u))
+    {
+        return false;
+    }
+    *v = qint64(u >> 1) ^ -qint64(u & 1);
+    return true;
+}
+
+QPoint quantize(const QPointF& pos)
+{
+    return QPoint(qRound(pos.x() * StrokeProtocol::SUBPIXEL), qRound(pos.y() * StrokeProtocol::SUBPIXEL));
+}
+
+QPointF dequantize(const QPoint& pos)
+{
+    return QPointF(pos) / StrokeProtocol::SUBPIXEL;
+}
+}
+
+namespace StrokeProtocol {
+
+bool PenState::operator==(const PenState& other) const
+{
+    return flags == other.flags && color == other.color && qFuzzyCompare(width, other.width);
+}
+
+void Encoder::pen(const PenState& state)
+{
+    if(penValid && state == sentPen)
+    {
+        return;
+    }
+    sentPen = state;
+    penValid = true;
+
+    body.append(char(PEN));
+    body.append(char(state.flags));
+    putVarint(&body, state.color);
+    putVarint(&body, quint64(qMax(0, qRound(state.width * SUBPIXEL))));
+}
+
+void Encoder::begin(const QPointF& pos)
+{
+    last = quantize(pos);
+    body.append(char(BEGIN));
+    putSigned(&body, last.x());
+    putSigned(&body, last.y());
+}
+
+void Encoder::points(const QVector<InputSample>& samples)
+{
+    if(samples.isEmpty())
+    {
+        return;
+    }
+
+    body.append(char(POINTS));
+    putVarint(&body, quint64(samples.size()));
+    for(const InputSample& s : samples)
+    {
+        // 差值基于量化后的上一点，误差不会累积
+        const QPoint q = quantize(s.pos);
+        putSigned(&body, q.x() - last.x());
+        putSigned(&body, q.y() - last.y());
+        body.append(char(quint8(qBound(0, qRound(s.pressure * 255), 255))));
+        last = q;
+    }
+}
+
+void Encoder::end()
+{
+    body.append(char(END));
+}
+
+void Encoder::resetPen()
+{
+    penValid = false;
+}
+
+bool Encoder::isEmpty() const
+{
+    return body.isEmpty();
+}
+
+QByteArray Encoder::take(qint64 msecs)
+{
+    if(body.isEmpty())
+    {
+        return QByteArray();
+    }
+
+    QByteArray content;
+    putVarint(&content, quint64(msecs));
+    content.append(body);
+    body.clear();
+
+    QByteArray packet;
+    putVarint(&packet, quint64(content.size()));
+    packet.append(content);
+    return packet;
+}
+
+void Decoder::feed(const QByteArray& data)
+{
+    if(broken)
+    {
+        return;
+    }
+    // 已解析的部分积累到一定大小再移除，避免每包都搬动缓冲区
+    if(offset > 0 && offset >= buffer.size() / 2)
+    {
+        buffer.remove(0, offset);
+        offset = 0;
+    }
+    buffer.append(data);
+}
+
+bool Decoder::next(qint64* msecs, QVector<Message>* messages)
+{
+    messages->resize(0);
+    if(broken)
+    {
+        return false;
+    }
+
+    const char* begin = buffer.constData() + offset;
+    const char* end = buffer.constData() + buffer.size();
+    const char* p = begin;
+    quint64 length = 0;
+    if(!getVarint(p, end, &length))
+    {
+        // 长度前缀本身不完整
+        broken = end - begin >= 10;
+        return false;
+    }
+    if(length > MAX_PACKET)
+    {
+        broken = true;
+        buffer.clear();
+        offset = 0;
+        return false;
+    }
+    if(quint64(end - p) < length)
+    {
+        return false;
+    }
+
+    const char* packetEnd = p + length;
+    quint64 sent = 0;
+    bool ok = getVarint(p, packetEnd, &sent);
+    while(ok && p < packetEnd)
+    {
+        Message m;
+        m.type = Type(quint8(*p++));
+        switch (m.type) {
+        case PEN:
+        {
+            quint64 color = 0;
+            quint64 width = 0;
+            ok = p < packetEnd;
+            if(ok)
+            {
+                m.pen.flags = quint8(*p++);
+                ok = getVarint(p, packetEnd, &color) && getVarint(p, packetEnd, &width);
+            }
+            m.pen.color = QRgb(color);
+            m.pen.width = qreal(width) / SUBPIXEL;
+            break;
+        }
+        case BEGIN:
+        {
+            qint64 x = 0;
+            qint64 y = 0;
+            ok = getSigned(p, packetEnd, &x) && getSigned(p, packetEnd, &y);
+            last = QPoint(int(x), int(y));
+            InputSample s;
+            s.pos = dequantize(last);
+            m.samples.append(s);
+            break;
+        }
+        case POINTS:
+        {
+            quint64 count = 0;
+            ok = getVarint(p, packetEnd, &count) && count <= quint64(packetEnd - p);
+            m.samples.reserve(qsizetype(count));
+            for(quint64 i = 0; ok && i < count; ++i)
+            {
+                qint64 dx = 0;
+                qint64 dy = 0;
+                ok = getSigned(p, packetEnd, &dx) && getSigned(p, packetEnd, &dy) && p < packetEnd;
+                if(ok)
+                {
+                    last += QPoint(int(dx), int(dy));
+                    InputSample s;
+                    s.pos = dequantize(last);
+                    s.pressure = quint8(*p++) / 255.0;
+                    m.samples.append(s);
+                }
+            }
+            break;
+        }
+        case END:
+            break;
+        default:
+            ok = false;
+            break;
+        }
+        if(ok)
+        {
+            messages->append(m);
+        }
+    }
+
+    if(!ok)
+    {
+        broken = true;
+        messages->resize(0);
+        return false;
+    }
+
+    *msecs = qint64(sent);
+    offset = packetEnd - buffer.constData();
+    return true;
+}
+
+bool Decoder::error() const
+{
+    return broken;
+}
+
+}
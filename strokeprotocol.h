@@ -0,0 +1,86 @@
+#ifndef STROKEPROTOCOL_H
+#define STROKEPROTOCOL_H
+
+#include "inputbuffer.h"
+
+#include <QByteArray>
+#include <QColor>
+#include <QPoint>
+#include <QVector>
+
+// 实例之间同步笔画的二进制协议
+// 每个包为 varint 长度加内容，内容以发送时间开头，后面是若干条消息
+// 坐标为画布坐标的 1/16 像素定点数，起点写绝对值，之后写与上一点的 zigzag varint 差值
+namespace StrokeProtocol {
+    const int SUBPIXEL = 16;
+    // 单个包的长度上限，一帧的采样远小于此；超过时视为数据损坏，不再缓冲
+    const quint64 MAX_PACKET = 1 << 20;
+
+    enum Type : quint8{
+        PEN = 1,
+        BEGIN = 2,
+        POINTS = 3,
+        END = 4,
+    };
+
+    enum PenFlag : quint8{
+        ERASER = 1 << 0,
+        HIGHLIGHTER = 1 << 1,
+    };
+
+    struct PenState{
+        quint8 flags = 0;
+        QRgb color = 0;
+        // 画布像素
+        qreal width = 1;
+
+        bool operator==(const PenState& other) const;
+    };
+
+    struct Message{
+        Type type = END;
+        PenState pen;
+        // BEGIN 只有一个点
+        QVector<InputSample> samples;
+    };
+
+    // 把一笔的消息累积成一个包，每帧取出一次发送
+    class Encoder
+    {
+    public:
+        void pen(const PenState& state);
+        void begin(const QPointF& pos);
+        void points(const QVector<InputSample>& samples);
+        void end();
+        // 新的对端加入时重新发送笔的状态
+        void resetPen();
+
+        bool isEmpty() const;
+        // 取出带长度前缀的完整包，没有消息时返回空
+        QByteArray take(qint64 msecs);
+
+    private:
+        QByteArray body;
+        QPoint last;
+        PenState sentPen;
+        bool penValid = false;
+    };
+
+    // 从字节流中拆包，不完整的包留到下次
+    class Decoder
+    {
+    public:
+        void feed(const QByteArray& data);
+        // 解析出一个完整包返回 true；数据损坏或长度超过 MAX_PACKET 时 error() 为真，之后不再解析
+        bool next(qint64* msecs, QVector<Message>* messages);
+        bool error() const;
+
+    private:
+        QByteArray buffer;
+        qsizetype offset = 0;
+        QPoint last;
+        bool broken = false;
+    };
+}
+
+#endif // STROKEPROTOCOL_H
@@ -0,0 +1,386 @@
+#include "strokerasterizer.h"
+
+#include <QImage>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+inline int mul255(int a, int b)
+{
+    int t = a * b + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+#ifdef __SSE2__
+// 16 位通道上的 mul255，与标量版本结果完全一致
+inline __m128i mul255x8(__m128i a, __m128i b)
+{
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(a, b), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+// 两个像素：src * c + dst * k，k 在 SourceOver 时为 255 - src.a * c，否则为 255 - c
+inline __m128i blendPair(__m128i d, __m128i src, __m128i c, bool clear, bool over)
+{
+    const __m128i full = _mm_set1_epi16(255);
+    const __m128i s = clear ? _mm_setzero_si128() : mul255x8(src, c);
+    __m128i k;
+    if(over)
+    {
+        k = _mm_sub_epi16(full, _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3)));
+    }
+    else
+    {
+        k = _mm_sub_epi16(full, c);
+    }
+    return _mm_add_epi16(s, mul255x8(d, k));
+}
+#endif
+
+// 部分覆盖的一段像素，覆盖率为 0 的像素保持不变
+void blendSpan(QRgb* dst, const quint8* cov, int n, QRgb src, StrokeRasterizer::Mode mode)
+{
+    const int sa = qAlpha(src);
+    const int sr = qRed(src);
+    const int sg = qGreen(src);
+    const int sb = qBlue(src);
+    int i = 0;
+
+#ifdef __SSE2__
+    // 一次四个像素，展开成 16 位通道；Max 需要逐像素比较，走标量
+    if(mode != StrokeRasterizer::Max)
+    {
+        const bool clear = mode == StrokeRasterizer::Clear;
+        const bool over = mode == StrokeRasterizer::SourceOver;
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i s = _mm_unpacklo_epi8(_mm_set1_epi32(int(src)), zero);
+        for(; i + 4 <= n; i += 4)
+        {
+            quint32 c4;
+            std::memcpy(&c4, cov + i, 4);
+            if(c4 == 0)
+            {
+                continue;
+            }
+            // 每个像素的覆盖率铺满自己的四个通道
+            const __m128i c16 = _mm_unpacklo_epi8(_mm_cvtsi32_si128(int(c4)), zero);
+            const __m128i c32 = _mm_unpacklo_epi16(c16, c16);
+            const __m128i cLo = _mm_unpacklo_epi32(c32, c32);
+            const __m128i cHi = _mm_unpackhi_epi32(c32, c32);
+
+            __m128i* p = reinterpret_cast<__m128i*>(dst + i);
+            const __m128i d = _mm_loadu_si128(p);
+            const __m128i lo = blendPair(_mm_unpacklo_epi8(d, zero), s, cLo, clear, over);
+            const __m128i hi = blendPair(_mm_unpackhi_epi8(d, zero), s, cHi, clear, over);
+            _mm_storeu_si128(p, _mm_packus_epi16(lo, hi));
+        }
+    }
+#endif
+
+    for(; i < n; ++i)
+    {
+        const int c = cov[i];
+        if(c == 0)
+        {
+            continue;
+        }
+
+        const QRgb d = dst[i];
+        switch (mode) {
+        case StrokeRasterizer::Clear:
+        {
+            const int k = 255 - c;
+            dst[i] = qRgba(mul255(qRed(d), k), mul255(qGreen(d), k), mul255(qBlue(d), k), mul255(qAlpha(d), k));
+            break;
+        }
+        case StrokeRasterizer::Max:
+        {
+            const int a = mul255(sa, c);
+            if(a > qAlpha(d))
+            {
+                dst[i] = qRgba(mul255(sr, c), mul255(sg, c), mul255(sb, c), a);
+            }
+            break;
+        }
+        case StrokeRasterizer::Source:
+        {
+            const int k = 255 - c;
+            dst[i] = qRgba(mul255(sr, c) + mul255(qRed(d), k), mul255(sg, c) + mul255(qGreen(d), k),
+                           mul255(sb, c) + mul255(qBlue(d), k), mul255(sa, c) + mul255(qAlpha(d), k));
+            break;
+        }
+        case StrokeRasterizer::SourceOver:
+        default:
+        {
+            const int k = 255 - mul255(sa, c);
+            dst[i] = qRgba(mul255(sr, c) + mul255(qRed(d), k), mul255(sg, c) + mul255(qGreen(d), k),
+                           mul255(sb, c) + mul255(qBlue(d), k), mul255(sa, c) + mul255(qAlpha(d), k));
+            break;
+        }
+        }
+    }
+}
+
+// 胶囊体（线段 + 两端圆）与水平线 y 的交集，凸形所以结果是一个区间
+bool capsuleSpan(const QPointF& a, const QPointF& b, qreal y, qreal radius, qreal* lo, qreal* hi)
+{
+    const qreal inf = std::numeric_limits<qreal>::infinity();
+    *lo = inf;
+    *hi = -inf;
+
+    auto disc = [&](const QPointF& p){
+        qreal h = radius * radius - (y - p.y()) * (y - p.y());
+        if(h < 0) return;
+        qreal w = std::sqrt(h);
+        *lo = qMin(*lo, p.x() - w);
+        *hi = qMax(*hi, p.x() + w);
+    };
+    disc(a);
+    disc(b);
+
+    const qreal dx = b.x() - a.x();
+    const qreal dy = b.y() - a.y();
+    const qreal len2 = dx * dx + dy * dy;
+    if(len2 > 1e-12)
+    {
+        const qreal len = std::sqrt(len2);
+        qreal bandLo = -inf;
+        qreal bandHi = inf;
+
+        // 投影落在线段内：0 <= dx*(x-ax) + dy*(y-ay) <= len2
+        const qreal k = dy * (y - a.y());
+        if(std::abs(dx) > 1e-9)
+        {
+            qreal x0 = a.x() - k / dx;
+            qreal x1 = a.x() + (len2 - k) / dx;
+            bandLo = qMax(bandLo, qMin(x0, x1));
+            bandHi = qMin(bandHi, qMax(x0, x1));
+        }
+        else if(k < 0 || k > len2)
+        {
+            bandHi = -inf;
+        }
+
+        // 到直线的距离不超过半径：|(x-ax)*dy - (y-ay)*dx| <= r*len
+        const qreal m = (y - a.y()) * dx;
+        if(std::abs(dy) > 1e-9)
+        {
+            qreal x0 = a.x() + (m - radius * len) / dy;
+            qreal x1 = a.x() + (m + radius * len) / dy;
+            bandLo = qMax(bandLo, qMin(x0, x1));
+            bandHi = qMin(bandHi, qMax(x0, x1));
+        }
+        else if(std::abs(m) > radius * len)
+        {
+            bandHi = -inf;
+        }
+
+        if(bandLo <= bandHi)
+        {
+            *lo = qMin(*lo, bandLo);
+            *hi = qMax(*hi, bandHi);
+        }
+    }
+
+    return *lo <= *hi;
+}
+
+inline quint8 coverageAt(const QPointF& a, const QPointF& b, qreal r, qreal px, qreal py)
+{
+    const qreal dx = b.x() - a.x();
+    const qreal dy = b.y() - a.y();
+    const qreal len2 = dx * dx + dy * dy;
+    qreal t = len2 > 1e-12 ? ((px - a.x()) * dx + (py - a.y()) * dy) / len2 : 0;
+    t = qBound<qreal>(0, t, 1);
+    const qreal ex = a.x() + t * dx - px;
+    const qreal ey = a.y() + t * dy - py;
+    const qreal cov = qBound<qreal>(0, r + 0.5 - std::sqrt(ex * ex + ey * ey), 1);
+    return quint8(cov * 255 + 0.5);
+}
+}
+
+bool StrokeRasterizer::needsStaging(bool highlighter, bool eraser, int alpha)
+{
+    return highlighter || (alpha < 255 && !eraser);
+}
+
+StrokeRasterizer::Mode StrokeRasterizer::modeFor(bool highlighter, bool eraser, bool staging)
+{
+    if(highlighter)
+    {
+        return Max;
+    }
+    if(staging)
+    {
+        return Source;
+    }
+    return eraser ? Clear : SourceOver;
+}
+
+QRect StrokeRasterizer::rasterize(const QPointF& from, const QVector<InputSample>& samples, qreal width, const QRect& clip)
+{
+    capsules.resize(0);
+
+    qreal minX = from.x(), minY = from.y(), maxX = from.x(), maxY = from.y();
+    qreal maxR = 0;
+    QPointF last = from;
+    for(const InputSample& sample : samples)
+    {
+        Capsule c;
+        c.a = last;
+        c.b = sample.pos;
+        c.r = qMax<qreal>(0.5, width * sample.pressure / 2);
+        capsules.append(c);
+
+        minX = qMin(minX, sample.pos.x());
+        minY = qMin(minY, sample.pos.y());
+        maxX = qMax(maxX, sample.pos.x());
+        maxY = qMax(maxY, sample.pos.y());
+        maxR = qMax(maxR, c.r);
+        last = sample.pos;
+    }
+
+    const qreal m = maxR + 1;
+    strokeRect = QRect(QPoint(int(std::floor(minX - m)), int(std::floor(minY - m))),
+                       QPoint(int(std::ceil(maxX + m)), int(std::ceil(maxY + m)))) & clip;
+    if(strokeRect.isEmpty())
+    {
+        strokeRect = QRect();
+    }
+    return strokeRect;
+}
+
+void StrokeRasterizer::fillCapsule(const Capsule& c)
+{
+    const qreal outer = c.r + 0.5;
+    const qreal inner = c.r - 0.5;
+    const int stride = maskRect.width();
+
+    // 与遮罩不相交的线段直接跳过
+    if(qMax(c.a.x(), c.b.x()) + outer < maskRect.left() || qMin(c.a.x(), c.b.x()) - outer > maskRect.right() + 1)
+    {
+        return;
+    }
+
+    int y0 = qMax(maskRect.top(), int(std::floor(qMin(c.a.y(), c.b.y()) - outer)));
+    int y1 = qMin(maskRect.bottom(), int(std::ceil(qMax(c.a.y(), c.b.y()) + outer)));
+    for(int y = y0; y <= y1; ++y)
+    {
+        const qreal py = y + 0.5;
+        qreal lo, hi;
+        if(!capsuleSpan(c.a, c.b, py, outer, &lo, &hi))
+        {
+            continue;
+        }
+
+        const int x0 = qMax(maskRect.left(), int(std::ceil(lo - 0.5)));
+        const int x1 = qMin(maskRect.right(), int(std::floor(hi - 0.5)));
+        if(x0 > x1)
+        {
+            continue;
+        }
+
+        quint8* row = mask.data() + (y - maskRect.top()) * stride - maskRect.left();
+
+        // 内部区间整段填满，只在边缘逐像素计算距离
+        int i0 = x1 + 1;
+        int i1 = x1;
+        qreal innerLo, innerHi;
+        if(inner > 0 && capsuleSpan(c.a, c.b, py, inner, &innerLo, &innerHi))
+        {
+            int s0 = qMax(x0, int(std::ceil(innerLo - 0.5)));
+            int s1 = qMin(x1, int(std::floor(innerHi - 0.5)));
+            if(s0 <= s1)
+            {
+                std::memset(row + s0, 255, s1 - s0 + 1);
+                i0 = s0;
+                i1 = s1;
+            }
+        }
+
+        for(int x = x0; x < i0; ++x)
+        {
+            row[x] = qMax(row[x], coverageAt(c.a, c.b, c.r, x + 0.5, py));
+        }
+        for(int x = i1 + 1; x <= x1; ++x)
+        {
+            row[x] = qMax(row[x], coverageAt(c.a, c.b, c.r, x + 0.5, py));
+        }
+    }
+}
+
+void StrokeRasterizer::composite(QImage* target, const QPoint& origin, const QColor& color, Mode mode)
+{
+    Q_ASSERT(target->format() == QImage::Format_ARGB32_Premultiplied);
+
+    const QRect r = strokeRect & QRect(origin, target->size());
+    if(r.isEmpty())
+    {
+        return;
+    }
+
+    // 整条折线共用一张遮罩，取覆盖率最大值，接头处不会重复叠加
+    maskRect = r;
+    mask.resize(qsizetype(r.width()) * r.height());
+    std::memset(mask.data(), 0, size_t(mask.size()));
+    for(const Capsule& c : std::as_const(capsules))
+    {
+        fillCapsule(c);
+    }
+
+    const QRgb src = qPremultiply(color.rgba());
+    const int stride = maskRect.width();
+
+    // 完全覆盖时结果与目标无关，可以整段填充
+    const bool fillable = mode != SourceOver || qAlpha(src) == 255;
+    const QRgb fillValue = mode == Clear ? 0 : src;
+
+    for(int y = r.top(); y <= r.bottom(); ++y)
+    {
+        QRgb* dst = reinterpret_cast<QRgb*>(target->scanLine(y - origin.y())) - origin.x();
+        const quint8* cov = mask.constData() + (y - maskRect.top()) * stride - maskRect.left();
+
+        int x = r.left();
+        while(x <= r.right())
+        {
+            const int c = cov[x];
+            if(c == 0)
+            {
+                ++x;
+                continue;
+            }
+
+            int end = x;
+            if(c == 255 && fillable)
+            {
+                while(end < r.right() && cov[end + 1] == 255)
+                {
+                    ++end;
+                }
+                std::fill(dst + x, dst + end + 1, fillValue);
+            }
+            else
+            {
+                // 到下一段可以整段填充的像素为止，中间夹着的空白由混合函数跳过
+                while(end < r.right() && !(fillable && cov[end + 1] == 255))
+                {
+                    ++end;
+                }
+                blendSpan(dst + x, cov + x, end - x + 1, src, mode);
+            }
+            x = end + 1;
+        }
+    }
+}
+
+QRect StrokeRasterizer::bounds() const
+{
+    return strokeRect;
+}
@@ -0,0 +1,54 @@
+#ifndef STROKERASTERIZER_H
+#define STROKERASTERIZER_H
+
+#include "inputbuffer.h"
+
+#include <QColor>
+#include <QRect>
+#include <QVector>
+
+class QImage;
+
+// 把一段圆头折线渲染成覆盖率遮罩，再一次性合成到图层
+// 遮罩按每次合成的目标区域生成，通常是一块瓦片，低缩放下的长笔画也不会分配巨大的遮罩
+class StrokeRasterizer
+{
+public:
+    enum Mode{
+        SourceOver,
+        Source,
+        Clear,
+        // 只保留较大的覆盖，同一笔画内线段重叠处不会叠加
+        Max,
+    };
+
+    // 半透明笔和荧光笔整笔先写入预备层，抬起时再合并，线段重叠处不会反复加深
+    static bool needsStaging(bool highlighter, bool eraser, int alpha);
+    // 写入目标层时的混合方式，画板、对端笔画和离线渲染共用
+    static Mode modeFor(bool highlighter, bool eraser, bool staging);
+
+    // 折线从 from 开始依次连到每个采样点，宽度按压感缩放；只记录线段，返回覆盖范围
+    QRect rasterize(const QPointF& from, const QVector<InputSample>& samples, qreal width, const QRect& clip);
+    // origin 为 target 左上角在画布中的坐标，可以只合成到一块瓦片
+    void composite(QImage* target, const QPoint& origin, const QColor& color, Mode mode);
+
+    QRect bounds() const;
+
+private:
+    struct Capsule{
+        QPointF a;
+        QPointF b;
+        qreal r;
+    };
+
+    void fillCapsule(const Capsule& c);
+
+private:
+    QVector<Capsule> capsules;
+    QRect strokeRect;
+    // 当前合成区域的遮罩，多次合成之间复用
+    QVector<quint8> mask;
+    QRect maskRect;
+};
+
+#endif // STROKERASTERIZER_H
@@ -0,0 +1,234 @@
+#include "strokeshare.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+
+namespace {
+// 与绘制节奏一致，一帧内的采样合并成一个包
+const int FLUSH_INTERVAL = 16;
+}
+
+StrokeShare::StrokeShare(QObject *parent)
+    : QObject{parent}
+{
+    flushTimer = new QTimer(this);
+    flushTimer->setSingleShot(true);
+    flushTimer->setTimerType(Qt::PreciseTimer);
+    flushTimer->setInterval(FLUSH_INTERVAL);
+    connect(flushTimer, &QTimer::timeout, this, &StrokeShare::flush);
+}
+
+StrokeShare::~StrokeShare()
+{
+    flush();
+}
+
+bool StrokeShare::listen(const QString& name, const QString& address, quint16 port)
+{
+    localServer = new QLocalServer(this);
+    localServer->setSocketOptions(QLocalServer::UserAccessOption);
+    // 上次异常退出可能留下同名套接字文件
+    QLocalServer::removeServer(name);
+    if(!localServer->listen(name))
+    {
+        qDebug() << "share listen failed" << name << localServer->errorString();
+        return false;
+    }
+    connect(localServer, &QLocalServer::newConnection, this, [this](){
+        while(QLocalSocket* socket = localServer->nextPendingConnection())
+        {
+            addPeer(socket);
+        }
+    });
+
+    if(port > 0)
+    {
+        // 连接没有认证，默认只接受本机连接，开放给局域网需要显式配置
+        const QHostAddress bind = address.isEmpty() ? QHostAddress(QHostAddress::LocalHost) : QHostAddress(address);
+        if(bind.isNull())
+        {
+            qDebug() << "share listen failed, invalid address" << address;
+            return false;
+        }
+        tcpServer = new QTcpServer(this);
+        if(!tcpServer->listen(bind, port))
+        {
+            qDebug() << "share listen failed" << bind << port << tcpServer->errorString();
+            return false;
+        }
+        connect(tcpServer, &QTcpServer::newConnection, this, [this](){
+            while(QTcpSocket* socket = tcpServer->nextPendingConnection())
+            {
+                socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+                addPeer(socket);
+            }
+        });
+    }
+    return true;
+}
+
+void StrokeShare::connectTo(const QString& name, const QString& host, quint16 port)
+{
+    if(host.isEmpty())
+    {
+        QLocalSocket* socket = new QLocalSocket(this);
+        addPeer(socket);
+        socket->connectToServer(name);
+        return;
+    }
+
+    QTcpSocket* socket = new QTcpSocket(this);
+    socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    addPeer(socket);
+    socket->connectToHost(host, port);
+}
+
+bool StrokeShare::hasPeers() const
+{
+    return !peers.isEmpty();
+}
+
+void StrokeShare::beginStroke(const StrokeProtocol::PenState& pen, const QPointF& pos)
+{
+    if(peers.isEmpty())
+    {
+        return;
+    }
+    stroking = true;
+    encoder.pen(pen);
+    encoder.begin(pos);
+    scheduleFlush();
+}
+
+void StrokeShare::strokePoints(const QVector<InputSample>& samples)
+{
+    if(!stroking)
+    {
+        return;
+    }
+    encoder.points(samples);
+    scheduleFlush();
+}
+
+void StrokeShare::endStroke()
+{
+    if(!stroking)
+    {
+        return;
+    }
+    stroking = false;
+    encoder.end();
+    // 抬笔立即发送，对端尽快提交
+    flush();
+}
+
+bool StrokeShare::isStroking() const
+{
+    return stroking;
+}
+
+void StrokeShare::addPeer(QIODevice* device)
+{
+    const quint32 id = nextPeer++;
+    Peer peer;
+    peer.device = device;
+    peers.insert(id, peer);
+    // 新的对端不知道当前笔的状态
+    encoder.resetPen();
+
+    connect(device, &QIODevice::readyRead, this, [this, id](){
+        readPeer(id);
+    });
+    auto leave = [this, id](){
+        removePeer(id);
+    };
+    if(QLocalSocket* socket = qobject_cast<QLocalSocket*>(device))
+    {
+        connect(socket, &QLocalSocket::disconnected, this, leave);
+        connect(socket, &QLocalSocket::errorOccurred, this, [socket, leave](){
+            qDebug() << "share peer error" << socket->errorString();
+            leave();
+        });
+    }
+    else if(QTcpSocket* socket = qobject_cast<QTcpSocket*>(device))
+    {
+        connect(socket, &QTcpSocket::disconnected, this, leave);
+        connect(socket, &QTcpSocket::errorOccurred, this, [socket, leave](){
+            qDebug() << "share peer error" << socket->errorString();
+            leave();
+        });
+    }
+}
+
+void StrokeShare::removePeer(quint32 id)
+{
+    auto it = peers.find(id);
+    if(it == peers.end())
+    {
+        return;
+    }
+    QIODevice* device = it->device;
+    peers.erase(it);
+    device->disconnect(this);
+    device->deleteLater();
+    emit peerLeft(id);
+}
+
+void StrokeShare::readPeer(quint32 id)
+{
+    auto it = peers.find(id);
+    if(it == peers.end())
+    {
+        return;
+    }
+
+    it->decoder.feed(it->device->readAll());
+
+    qint64 sent = 0;
+    QVector<StrokeProtocol::Message> messages;
+    while(it->decoder.next(&sent, &messages))
+    {
+        emit received(id, messages);
+
+        // 处理消息时对端可能已经断开
+        it = peers.find(id);
+        if(it == peers.end())
+        {
+            return;
+        }
+    }
+
+    if(it->decoder.error())
+    {
+        qDebug() << "share protocol error, dropping peer" << id;
+        removePeer(id);
+    }
+}
+
+void StrokeShare::scheduleFlush()
+{
+    if(!flushTimer->isActive())
+    {
+        flushTimer->start();
+    }
+}
+
+void StrokeShare::flush()
+{
+    flushTimer->stop();
+    const QByteArray packet = encoder.take(QDateTime::currentMSecsSinceEpoch());
+    if(packet.isEmpty())
+    {
+        return;
+    }
+
+    for(const Peer& peer : std::as_const(peers))
+    {
+        peer.device->write(packet);
+    }
+}
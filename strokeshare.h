@@ -0,0 +1,62 @@
+#ifndef STROKESHARE_H
+#define STROKESHARE_H
+
+#include "strokeprotocol.h"
+
+#include <QHash>
+#include <QObject>
+
+class QIODevice;
+class QLocalServer;
+class QTcpServer;
+class QTimer;
+
+// 在多个实例之间同步手绘笔画：主机端监听本地套接字和可选的 TCP 端口，加入端连接主机
+// 本地笔画的消息每帧合并成一个包发给所有对端，对端之间不转发
+class StrokeShare : public QObject
+{
+    Q_OBJECT
+public:
+    explicit StrokeShare(QObject *parent = nullptr);
+    ~StrokeShare();
+
+    // port 为 0 时只监听本地套接字；TCP 只绑定 address，为空时为本机回环地址
+    bool listen(const QString& name, const QString& address, quint16 port);
+    // host 为空时连接本地套接字
+    void connectTo(const QString& name, const QString& host, quint16 port);
+    bool hasPeers() const;
+
+    void beginStroke(const StrokeProtocol::PenState& pen, const QPointF& pos);
+    void strokePoints(const QVector<InputSample>& samples);
+    void endStroke();
+    bool isStroking() const;
+
+signals:
+    // 每收到一个包发出一次，同一对端的消息按顺序到达
+    void received(quint32 peer, const QVector<StrokeProtocol::Message>& messages);
+    void peerLeft(quint32 peer);
+
+private:
+    struct Peer{
+        QIODevice* device = nullptr;
+        StrokeProtocol::Decoder decoder;
+    };
+
+    void addPeer(QIODevice* device);
+    void removePeer(quint32 id);
+    void readPeer(quint32 id);
+    void scheduleFlush();
+    void flush();
+
+private:
+    QLocalServer* localServer = nullptr;
+    QTcpServer* tcpServer = nullptr;
+    QHash<quint32, Peer> peers;
+    quint32 nextPeer = 1;
+
+    StrokeProtocol::Encoder encoder;
+    QTimer* flushTimer = nullptr;
+    bool stroking = false;
+};
+
+#endif // STROKESHARE_H
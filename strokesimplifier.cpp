@@ -0,0 +1,68 @@
+#include "strokesimplifier.h"
+
+#include <QtMath>
+
+namespace {
+// 一段线段最多覆盖的采样数，限制逐点检查的开销
+const int MAX_RUN = 64;
+
+qreal distanceToSegment(const QPointF& p, const QPointF& a, const QPointF& b)
+{
+    const QPointF ab = b - a;
+    const qreal len2 = QPointF::dotProduct(ab, ab);
+    qreal t = len2 > 0 ? QPointF::dotProduct(p - a, ab) / len2 : 0;
+    t = qBound<qreal>(0, t, 1);
+    const QPointF d = p - (a + ab * t);
+    return qSqrt(QPointF::dotProduct(d, d));
+}
+}
+
+void StrokeSimplifier::simplify(const QPointF& from, const QVector<InputSample>& in, qreal tolerance, qreal radiusScale, QVector<InputSample>* out)
+{
+    out->resize(0);
+    inputCount += in.size();
+
+    if(tolerance <= 0 || in.size() < 3)
+    {
+        for(const InputSample& s : in)
+        {
+            out->append(s);
+        }
+        outputCount += out->size();
+        return;
+    }
+
+    // in[start, i) 为当前线段 anchor -> in[i] 将要丢掉的采样
+    QPointF anchor = from;
+    int start = 0;
+    for(int i = 0; i < in.size(); ++i)
+    {
+        const InputSample& end = in.at(i);
+        bool fits = i - start < MAX_RUN;
+        for(int j = start; fits && j < i; ++j)
+        {
+            const InputSample& s = in.at(j);
+            // 线段半径取终点的压感，与逐段绘制时的半径比较
+            fits = distanceToSegment(s.pos, anchor, end.pos) + qAbs(s.pressure - end.pressure) * radiusScale <= tolerance;
+        }
+        if(!fits)
+        {
+            // 上一个采样作为顶点保留，从它重新开始
+            out->append(in.at(i - 1));
+            anchor = in.at(i - 1).pos;
+            start = i;
+        }
+    }
+    out->append(in.last());
+    outputCount += out->size();
+}
+
+quint64 StrokeSimplifier::inputPoints() const
+{
+    return inputCount;
+}
+
+quint64 StrokeSimplifier::outputPoints() const
+{
+    return outputCount;
+}
@@ -0,0 +1,25 @@
+#ifndef STROKESIMPLIFIER_H
+#define STROKESIMPLIFIER_H
+
+#include "inputbuffer.h"
+
+#include <QVector>
+
+// 在线折线化简：丢掉的采样到化简后线段的距离加上半径之差不超过容差，
+// 化简前后的笔画轮廓相差不超过容差；每批的最后一个采样总是保留，笔尖不会滞后
+class StrokeSimplifier
+{
+public:
+    // from 为上一批保留的最后一点；tolerance 和 radiusScale 为画布像素，
+    // radiusScale 为压感 1.0 时的半径；tolerance 不大于 0 时原样输出
+    void simplify(const QPointF& from, const QVector<InputSample>& in, qreal tolerance, qreal radiusScale, QVector<InputSample>* out);
+
+    quint64 inputPoints() const;
+    quint64 outputPoints() const;
+
+private:
+    quint64 inputCount = 0;
+    quint64 outputCount = 0;
+};
+
+#endif // STROKESIMPLIFIER_H
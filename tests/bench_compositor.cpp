@@ -0,0 +1,70 @@
+#include "compositor.h"
+#include "testmain.h"
+
+#include <QPainter>
+#include <QThread>
+
+// 整屏重绘按条带并行合成，4K 和 8K 下比较不同线程数的耗时
+// 每条带与画板一样先画背景再叠加半透明的笔迹层
+class CompositorBench : public QObject
+{
+    Q_OBJECT
+private slots:
+    void fullScreen_data();
+    void fullScreen();
+    void cleanup();
+};
+
+void CompositorBench::fullScreen_data()
+{
+    QTest::addColumn<QSize>("size");
+    QTest::addColumn<int>("threads");
+
+    const QList<QPair<const char*, QSize>> screens = {
+        {"4K", QSize(3840, 2160)},
+        {"8K", QSize(7680, 4320)},
+    };
+    const int cores = QThread::idealThreadCount();
+    for(const auto& screen : screens)
+    {
+        for(int threads = 1; ; threads *= 2)
+        {
+            threads = qMin(threads, cores);
+            QTest::addRow("%s %d threads", screen.first, threads) << screen.second << threads;
+            if(threads == cores)
+            {
+                break;
+            }
+        }
+    }
+}
+
+void CompositorBench::fullScreen()
+{
+    QFETCH(QSize, size);
+    QFETCH(int, threads);
+
+    QImage ink(size, QImage::Format_ARGB32_Premultiplied);
+    ink.fill(QColor(255, 0, 0, 128));
+    QImage target(size, QImage::Format_ARGB32_Premultiplied);
+    const QColor background(255, 255, 255, 64);
+
+    Compositor::setThreadCount(threads);
+    QCOMPARE(Compositor::threadCount(), threads);
+
+    QBENCHMARK {
+        Compositor::composite(&target, target.rect(), [&](QPainter* p, const QRect& stripe){
+            p->fillRect(stripe, background);
+            p->drawImage(stripe, ink, stripe);
+        });
+    }
+    QCOMPARE(target.pixel(size.width() - 1, size.height() - 1), target.pixel(0, 0));
+}
+
+void CompositorBench::cleanup()
+{
+    Compositor::setThreadCount(0);
+}
+
+DRAWINGBOARD_TEST_MAIN(CompositorBench)
+#include "bench_compositor.moc"
@@ -0,0 +1,92 @@
+#include "strokerasterizer.h"
+#include "testmain.h"
+
+#include <QImage>
+#include <QPainter>
+#include <QtMath>
+
+namespace {
+const QSize CANVAS(1920, 1080);
+const int POINTS = 256;
+
+// 横跨画布的曲线，线段长度和方向都在变化
+QVector<InputSample> curve()
+{
+    QVector<InputSample> samples;
+    for(int i = 0; i <= POINTS; ++i)
+    {
+        const qreal t = qreal(i) / POINTS;
+        InputSample s;
+        s.pos = QPointF(100 + t * (CANVAS.width() - 200), CANVAS.height() / 2.0 + qSin(t * 6 * M_PI) * 300);
+        samples.append(s);
+    }
+    return samples;
+}
+
+void widths()
+{
+    QTest::addColumn<int>("width");
+    for(int w : {1, 2, 4, 8, 16, 32, 64, 100})
+    {
+        QTest::addRow("%dpx", w) << w;
+    }
+}
+}
+
+// 同一条折线，专用光栅化器与原先逐段 QPainter::drawLine 的耗时对比，按笔宽分组
+class StrokeRasterizerBench : public QObject
+{
+    Q_OBJECT
+private slots:
+    void rasterizer_data();
+    void rasterizer();
+    void painter_data();
+    void painter();
+};
+
+void StrokeRasterizerBench::rasterizer_data()
+{
+    widths();
+}
+
+void StrokeRasterizerBench::rasterizer()
+{
+    QFETCH(int, width);
+    const QVector<InputSample> samples = curve();
+    const QVector<InputSample> rest = samples.mid(1);
+    QImage image(CANVAS, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+    StrokeRasterizer r;
+
+    QBENCHMARK {
+        r.rasterize(samples.first().pos, rest, width, image.rect());
+        r.composite(&image, QPoint(0, 0), Qt::red, StrokeRasterizer::SourceOver);
+    }
+    QVERIFY(!r.bounds().isEmpty());
+}
+
+void StrokeRasterizerBench::painter_data()
+{
+    widths();
+}
+
+void StrokeRasterizerBench::painter()
+{
+    QFETCH(int, width);
+    const QVector<InputSample> samples = curve();
+    QImage image(CANVAS, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+
+    QBENCHMARK {
+        QPainter p(&image);
+        p.setRenderHint(QPainter::Antialiasing);
+        p.setPen(QPen(Qt::red, width, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
+        for(int i = 1; i < samples.size(); ++i)
+        {
+            p.drawLine(samples.at(i - 1).pos, samples.at(i).pos);
+        }
+    }
+}
+
+DRAWINGBOARD_TEST_MAIN(StrokeRasterizerBench)
+#include "bench_strokerasterizer.moc"
@@ -0,0 +1,20 @@
+#ifndef TESTMAIN_H
+#define TESTMAIN_H
+
+#include "dbapplication.h"
+
+#include <QStandardPaths>
+#include <QTest>
+
+// 与 QTEST_MAIN 相同，但使用 DBApplication，画板依赖其中注册的单例
+// 测试模式下配置写入单独的目录，不影响用户配置
+#define DRAWINGBOARD_TEST_MAIN(TestObject) \
+int main(int argc, char** argv) \
+{ \
+    QStandardPaths::setTestModeEnabled(true); \
+    DBApplication app(argc, argv); \
+    TestObject tc; \
+    return QTest::qExec(&tc, argc, argv); \
+}
+
+#endif // TESTMAIN_H
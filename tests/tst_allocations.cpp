@@ -0,0 +1,79 @@
+#include "allocationcounter.h"
+#include "board.h"
+#include "testmain.h"
+
+#include <QMouseEvent>
+#include <QtMath>
+
+namespace {
+// 预热的移动次数，之后的移动应当不再分配
+const int WARMUP_MOVES = 200;
+const int MOVES = 2000;
+// 每隔多少次移动刷新一次，与按帧绘制的节奏相近
+const int MOVES_PER_FRAME = 8;
+}
+
+// 按下、移动、抬起都经过 Board 的事件处理，稳定状态下移动和绘制的检查范围内不应有堆分配
+// 只有打开 DRAWINGBOARD_ALLOC_COUNTER 编译时才能统计，否则跳过
+class AllocationsTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void steadyStateMoves();
+
+private:
+    void move(Board* board, int i);
+};
+
+void AllocationsTest::move(Board* board, int i)
+{
+    // 在画板中部来回画圆，覆盖的瓦片在预热时就已经建好
+    const qreal t = 2 * M_PI * i / 240;
+    const QPointF pos(320 + qCos(t) * 150, 240 + qSin(t) * 150);
+    QMouseEvent event(QEvent::MouseMove, pos, board->mapToGlobal(pos), Qt::NoButton, Qt::LeftButton, Qt::NoModifier);
+    QCoreApplication::sendEvent(board, &event);
+    if(i % MOVES_PER_FRAME == 0)
+    {
+        // 移动时已经请求刷新，立即处理；采样在 UpdateRequest 中绘制
+        QCoreApplication::sendPostedEvents(board, QEvent::UpdateRequest);
+    }
+}
+
+void AllocationsTest::steadyStateMoves()
+{
+    if(!AllocationCounter::enabled())
+    {
+        QSKIP("built without DRAWINGBOARD_ALLOC_COUNTER");
+    }
+
+    Board board;
+    board.resize(640, 480);
+    board.show();
+    QVERIFY(QTest::qWaitForWindowExposed(&board));
+    board.readyToDraw();
+
+    board.injectPress(QPointF(470, 240));
+    for(int i = 0; i < WARMUP_MOVES; ++i)
+    {
+        move(&board, i);
+    }
+    QCoreApplication::processEvents();
+
+    const QJsonObject before = AllocationCounter::toJson();
+    for(int i = WARMUP_MOVES; i < WARMUP_MOVES + MOVES; ++i)
+    {
+        move(&board, i);
+    }
+    const QJsonObject after = AllocationCounter::toJson();
+    board.injectRelease(QPointF(470, 240));
+
+    const int scopes = after.value("scopes").toInt() - before.value("scopes").toInt();
+    const int dirty = after.value("dirty").toInt() - before.value("dirty").toInt();
+    qDebug() << "checked scopes" << scopes << "with allocations" << dirty << "worst" << after.value("worst").toInt();
+    // 移动事件和绘制都进入了检查范围
+    QVERIFY(scopes >= MOVES);
+    QCOMPARE(dirty, 0);
+}
+
+DRAWINGBOARD_TEST_MAIN(AllocationsTest)
+#include "tst_allocations.moc"
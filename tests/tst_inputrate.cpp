@@ -0,0 +1,106 @@
+#include "board.h"
+#include "latencyprobe.h"
+#include "testmain.h"
+
+#include <QElapsedTimer>
+#include <QMouseEvent>
+#include <QTimer>
+#include <QtMath>
+
+#include <algorithm>
+
+namespace {
+// 合成输入的回报率和时长
+const int RATE_HZ = 500;
+const int DURATION_MS = 3000;
+
+// 微秒，取第 p 分位
+qint64 percentile(QVector<qint64> values, double p)
+{
+    if(values.isEmpty())
+    {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    return values.at(qMin(values.size() - 1, int(p * values.size())));
+}
+}
+
+// 按固定回报率向画板投递移动事件，检查采样全部绘制，且事件循环的延迟不随时间增长
+class InputRateTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void sustainsRate();
+};
+
+void InputRateTest::sustainsRate()
+{
+    Board board;
+    board.resize(1280, 720);
+    board.show();
+    QVERIFY(QTest::qWaitForWindowExposed(&board));
+    board.readyToDraw();
+
+    LatencyProbe* probe = board.latency();
+    probe->setEnabled(true);
+    probe->reset();
+
+    // 李萨如曲线，每秒一个周期，相邻采样位置都不同
+    const QPointF center(board.width() / 2.0, board.height() / 2.0);
+    auto point = [&](int i){
+        const qreal t = 2 * M_PI * i / RATE_HZ;
+        return center + QPointF(qSin(3 * t) * 400, qSin(2 * t) * 250);
+    };
+
+    board.injectPress(point(0));
+
+    // 生成器按时钟补发到期的采样，计时器迟到时一次发出多个，与设备合并上报相同
+    const int total = RATE_HZ * DURATION_MS / 1000;
+    int sent = 0;
+    // 每次补发时最早一个采样已经等待的时间，微秒
+    QVector<qint64> lateness;
+    QElapsedTimer clock;
+    QTimer timer;
+    timer.setTimerType(Qt::PreciseTimer);
+    timer.setInterval(1000 / RATE_HZ);
+    connect(&timer, &QTimer::timeout, this, [&](){
+        const qint64 elapsed = clock.nsecsElapsed();
+        const int due = qMin(total, int(elapsed * RATE_HZ / 1000000000) + 1);
+        if(sent < due)
+        {
+            lateness.append((elapsed - qint64(sent) * 1000000000 / RATE_HZ) / 1000);
+        }
+        for(; sent < due; ++sent)
+        {
+            const QPointF pos = point(sent + 1);
+            QMouseEvent* event = new QMouseEvent(QEvent::MouseMove, pos, board.mapToGlobal(pos), Qt::NoButton, Qt::LeftButton, Qt::NoModifier);
+            event->setTimestamp(quint64(clock.elapsed()));
+            QCoreApplication::postEvent(&board, event);
+        }
+        if(sent == total)
+        {
+            timer.stop();
+        }
+    });
+    clock.start();
+    timer.start();
+
+    QTRY_VERIFY_WITH_TIMEOUT(!timer.isActive(), DURATION_MS * 3);
+    // 最后一批采样画到窗口上之后才计入
+    QTRY_VERIFY_WITH_TIMEOUT(probe->samples() >= total, 5000);
+    board.injectRelease(point(total));
+
+    QCOMPARE(probe->toJson().value("dropped").toInt(), 0);
+
+    // 前后各取四分之一比较，积压时后段的延迟会持续增长
+    const int quarter = lateness.size() / 4;
+    QVERIFY(quarter > 0);
+    const qint64 head = percentile(lateness.mid(0, quarter), 0.9);
+    const qint64 tail = percentile(lateness.mid(lateness.size() - quarter), 0.9);
+    qDebug() << "input rate" << RATE_HZ << "samples" << probe->samples() << "lateness p90 head" << head << "us tail" << tail << "us";
+    QVERIFY2(tail <= head * 2 + 4000, qPrintable(QString("event loop lateness grew from %1us to %2us").arg(head).arg(tail)));
+}
+
+DRAWINGBOARD_TEST_MAIN(InputRateTest)
+#include "tst_inputrate.moc"
@@ -0,0 +1,203 @@
+#include "board.h"
+#include "config.h"
+#include "strokeshare.h"
+#include "testmain.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QMouseEvent>
+#include <QtMath>
+
+#include <algorithm>
+
+namespace {
+const int POINTS = 400;
+const int BATCH = 8;
+
+// 定点数和压感量化引入的误差
+const qreal POS_EPSILON = 0.5 / StrokeProtocol::SUBPIXEL + 1e-6;
+const qreal PRESSURE_EPSILON = 0.5 / 255 + 1e-6;
+
+InputSample sample(int i)
+{
+    InputSample s;
+    const qreal t = 2 * M_PI * i / POINTS;
+    s.pos = QPointF(640 + qSin(3 * t) * 400.3, 360 + qSin(2 * t) * 250.7);
+    s.pressure = 0.2 + 0.8 * i / POINTS;
+    return s;
+}
+}
+
+// 同一进程内的主机和加入端通过本地套接字连接，检查笔画往返后点位不变，并输出延迟
+class StrokeShareTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void roundTrip();
+    void passThroughMirror();
+    void oversizedPacket();
+
+private:
+    void transfer(StrokeShare* from, StrokeShare* to);
+};
+
+void StrokeShareTest::transfer(StrokeShare* from, StrokeShare* to)
+{
+    QVector<StrokeProtocol::Message> received;
+    // 每批点交给发送端的时刻，按收到的点数找到对应的批次
+    QVector<qint64> sentAt;
+    QVector<qint64> latency;
+    int receivedPoints = 0;
+    QElapsedTimer clock;
+    clock.start();
+
+    const QMetaObject::Connection connection = connect(to, &StrokeShare::received, this, [&](quint32, const QVector<StrokeProtocol::Message>& messages){
+        const qint64 now = clock.nsecsElapsed();
+        for(const StrokeProtocol::Message& m : messages)
+        {
+            if(m.type == StrokeProtocol::POINTS && !m.samples.isEmpty())
+            {
+                // 包里最早的一批等待最久
+                latency.append((now - sentAt.value(receivedPoints / BATCH, now)) / 1000);
+                receivedPoints += m.samples.size();
+            }
+            received.append(m);
+        }
+    });
+
+    StrokeProtocol::PenState pen;
+    pen.flags = StrokeProtocol::HIGHLIGHTER;
+    pen.color = qRgba(10, 200, 30, 128);
+    pen.width = 12.5;
+
+    from->beginStroke(pen, sample(0).pos);
+    QVERIFY(from->isStroking());
+    for(int i = 1; i < POINTS; i += BATCH)
+    {
+        QVector<InputSample> batch;
+        for(int j = i; j < qMin(POINTS, i + BATCH); ++j)
+        {
+            batch.append(sample(j));
+        }
+        sentAt.append(clock.nsecsElapsed());
+        from->strokePoints(batch);
+        // 按输入节奏让出事件循环，包在定时器到期时发出
+        QTest::qWait(1);
+    }
+    from->endStroke();
+
+    QTRY_VERIFY_WITH_TIMEOUT(!received.isEmpty() && received.last().type == StrokeProtocol::END, 5000);
+    disconnect(connection);
+
+    QCOMPARE(received.first().type, StrokeProtocol::PEN);
+    QVERIFY(received.first().pen == pen);
+    QCOMPARE(received.at(1).type, StrokeProtocol::BEGIN);
+    QCOMPARE(received.at(1).samples.size(), 1);
+
+    QVector<InputSample> points = received.at(1).samples;
+    for(int i = 2; i < received.size() - 1; ++i)
+    {
+        QCOMPARE(received.at(i).type, StrokeProtocol::POINTS);
+        points += received.at(i).samples;
+    }
+    QCOMPARE(points.size(), POINTS);
+    for(int i = 0; i < POINTS; ++i)
+    {
+        const InputSample expected = sample(i);
+        const QPointF d = points.at(i).pos - expected.pos;
+        QVERIFY2(qAbs(d.x()) <= POS_EPSILON && qAbs(d.y()) <= POS_EPSILON, qPrintable(QString("point %1 moved by (%2, %3)").arg(i).arg(d.x()).arg(d.y())));
+        // BEGIN 不带压感
+        if(i > 0)
+        {
+            QVERIFY(qAbs(points.at(i).pressure - expected.pressure) <= PRESSURE_EPSILON);
+        }
+    }
+
+    std::sort(latency.begin(), latency.end());
+    QVERIFY(!latency.isEmpty());
+    qDebug() << "share latency p50" << latency.at(latency.size() / 2) << "us p90" << latency.at(latency.size() * 9 / 10) << "us max" << latency.last() << "us";
+}
+
+void StrokeShareTest::roundTrip()
+{
+    const QString name = QString("DrawingBoardTest-%1").arg(QCoreApplication::applicationPid());
+    StrokeShare host;
+    QVERIFY(host.listen(name, QString(), 0));
+    StrokeShare join;
+    join.connectTo(name, QString(), 0);
+    QTRY_VERIFY_WITH_TIMEOUT(host.hasPeers(), 5000);
+
+    // 主机发给加入端，加入端收到后连接一定已经建立，再反向发送
+    transfer(&host, &join);
+    if(QTest::currentTestFailed())
+    {
+        return;
+    }
+    transfer(&join, &host);
+}
+
+void StrokeShareTest::passThroughMirror()
+{
+    const QString name = QString("DrawingBoardMirror-%1").arg(QCoreApplication::applicationPid());
+    StrokeShare host;
+    QVERIFY(host.listen(name, QString(), 0));
+
+    // 画板在构造时按配置加入主机
+    ConfigHandle* handle = static_cast<DBApplication*>(qApp)->getSingleton<Config>()->getConfigHandle(Config::INTERNAL);
+    QVERIFY(handle);
+    handle->setValue("share.mode", "join");
+    handle->setValue("share.name", name);
+    Board board;
+    handle->setValue("share.mode", "off");
+    board.resize(640, 480);
+    board.show();
+    QVERIFY(QTest::qWaitForWindowExposed(&board));
+    board.readyToDraw();
+    QTRY_VERIFY_WITH_TIMEOUT(host.hasPeers(), 5000);
+
+    // 右键抬起进入穿透状态，之后只贴静态画面
+    QMouseEvent release(QEvent::MouseButtonRelease, QPointF(10, 10), board.mapToGlobal(QPointF(10, 10)), Qt::RightButton, Qt::NoButton, Qt::NoModifier);
+    QCoreApplication::sendEvent(&board, &release);
+    const QPoint probe(320, 240);
+    const QRgb before = board.grab().toImage().pixel(probe);
+
+    StrokeProtocol::PenState pen;
+    pen.color = qRgba(220, 30, 30, 255);
+    pen.width = 8;
+    host.beginStroke(pen, QPointF(100, 240));
+    QVector<InputSample> samples;
+    for(int x = 110; x <= 540; x += 10)
+    {
+        InputSample s;
+        s.pos = QPointF(x, 240);
+        samples.append(s);
+    }
+    host.strokePoints(samples);
+    host.endStroke();
+
+    // 对端的笔画应当出现在穿透状态的画面中
+    QTRY_VERIFY_WITH_TIMEOUT(board.grab().toImage().pixel(probe) != before, 5000);
+}
+
+void StrokeShareTest::oversizedPacket()
+{
+    // 长度前缀超过上限时立即视为损坏，不等待内容
+    QByteArray data;
+    quint64 length = StrokeProtocol::MAX_PACKET + 1;
+    while(length >= 0x80)
+    {
+        data.append(char(quint8(length) | 0x80));
+        length >>= 7;
+    }
+    data.append(char(quint8(length)));
+
+    StrokeProtocol::Decoder decoder;
+    decoder.feed(data);
+    qint64 msecs = 0;
+    QVector<StrokeProtocol::Message> messages;
+    QVERIFY(!decoder.next(&msecs, &messages));
+    QVERIFY(decoder.error());
+}
+
+DRAWINGBOARD_TEST_MAIN(StrokeShareTest)
+#include "tst_strokeshare.moc"
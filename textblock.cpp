@@ -0,0 +1,322 @@
+#include "textblock.h"
+
+#include <QFontMetricsF>
+#include <QPainter>
+
+#include <algorithm>
+#include <cmath>
+
+TextBlock::TextBlock(GlyphCache* cache, const QFont& font, const QColor& color, const QPointF& origin)
+    :cache(cache)
+    ,font(cache->fontId(font))
+    ,color(color)
+    ,origin(origin)
+    ,generation(cache->generation())
+{
+    QFontMetricsF metrics(font);
+    lineHeight = metrics.lineSpacing();
+    ascent = metrics.ascent();
+}
+
+bool TextBlock::isEmpty() const
+{
+    return lines.size() == 1 && lines.first().chars.isEmpty();
+}
+
+QString TextBlock::text() const
+{
+    QStringList result;
+    for(const Line& line : lines)
+    {
+        result << QString::fromUcs4(line.chars.constData(), line.chars.size());
+    }
+    return result.join('\n');
+}
+
+QRectF TextBlock::insert(const QString& s)
+{
+    const QList<uint> ucs4 = s.toUcs4();
+    if(ucs4.isEmpty())
+    {
+        return QRectF();
+    }
+
+    QRectF damage = caretRect();
+    const int first = caretLine;
+    if(!ucs4.contains('\n'))
+    {
+        // 同一行内插入，只有插入点之后的字形需要移动
+        Line& line = lines[caretLine];
+        const qreal fromX = line.x.at(caretColumn);
+        const qreal oldWidth = line.x.last();
+        for(uint ch : ucs4)
+        {
+            line.chars.insert(caretColumn++, char32_t(ch));
+        }
+        layoutLine(caretLine, caretColumn - ucs4.size());
+        damage |= lineRect(caretLine, fromX, qMax(oldWidth, line.x.last()));
+        return damage | caretRect();
+    }
+
+    // 换行会让下面所有行下移
+    damage |= linesRect(first, lines.size() - 1);
+    QVector<char32_t> tail = lines[caretLine].chars.mid(caretColumn);
+    lines[caretLine].chars.resize(caretColumn);
+    for(uint ch : ucs4)
+    {
+        if(ch == '\n')
+        {
+            layoutLine(caretLine, 0);
+            lines.insert(++caretLine, Line());
+            caretColumn = 0;
+            continue;
+        }
+        lines[caretLine].chars.insert(caretColumn++, char32_t(ch));
+    }
+    lines[caretLine].chars += tail;
+    layoutLine(caretLine, 0);
+    return damage | linesRect(first, lines.size() - 1);
+}
+
+QRectF TextBlock::backspace()
+{
+    QRectF damage = caretRect();
+    if(caretColumn > 0)
+    {
+        Line& line = lines[caretLine];
+        const qreal oldWidth = line.x.last();
+        line.chars.remove(--caretColumn);
+        layoutLine(caretLine, caretColumn);
+        return damage | lineRect(caretLine, line.x.at(caretColumn), oldWidth);
+    }
+    if(caretLine == 0)
+    {
+        return QRectF();
+    }
+
+    // 与上一行合并
+    damage |= linesRect(caretLine - 1, lines.size() - 1);
+    Line& prev = lines[caretLine - 1];
+    caretColumn = prev.chars.size();
+    prev.chars += lines.at(caretLine).chars;
+    lines.remove(caretLine--);
+    layoutLine(caretLine, caretColumn);
+    return damage | caretRect();
+}
+
+QRectF TextBlock::remove()
+{
+    Line& line = lines[caretLine];
+    if(caretColumn < line.chars.size())
+    {
+        const qreal oldWidth = line.x.last();
+        line.chars.remove(caretColumn);
+        layoutLine(caretLine, caretColumn);
+        return lineRect(caretLine, line.x.at(caretColumn), oldWidth) | caretRect();
+    }
+    if(caretLine == lines.size() - 1)
+    {
+        return QRectF();
+    }
+
+    // 与下一行合并
+    const QRectF damage = linesRect(caretLine, lines.size() - 1);
+    line.chars += lines.at(caretLine + 1).chars;
+    lines.remove(caretLine + 1);
+    layoutLine(caretLine, caretColumn);
+    return damage;
+}
+
+QRectF TextBlock::moveCaret(int key)
+{
+    const QRectF before = caretRect();
+    const Line& line = lines.at(caretLine);
+
+    // 上下移动时保持横向位置，选离原位置最近的字符边界
+    auto columnAt = [this](int l, qreal x){
+        const QVector<qreal>& xs = lines.at(l).x;
+        auto it = std::lower_bound(xs.constBegin(), xs.constEnd(), x);
+        if(it == xs.constEnd())
+        {
+            return int(xs.size() - 1);
+        }
+        if(it != xs.constBegin() && x - *(it - 1) < *it - x)
+        {
+            --it;
+        }
+        return int(it - xs.constBegin());
+    };
+
+    switch (key) {
+    case Qt::Key_Left:
+        if(caretColumn > 0)
+        {
+            --caretColumn;
+        }
+        else if(caretLine > 0)
+        {
+            caretColumn = lines.at(--caretLine).chars.size();
+        }
+        break;
+    case Qt::Key_Right:
+        if(caretColumn < line.chars.size())
+        {
+            ++caretColumn;
+        }
+        else if(caretLine < lines.size() - 1)
+        {
+            ++caretLine;
+            caretColumn = 0;
+        }
+        break;
+    case Qt::Key_Up:
+        if(caretLine > 0)
+        {
+            caretColumn = columnAt(caretLine - 1, line.x.at(caretColumn));
+            --caretLine;
+        }
+        break;
+    case Qt::Key_Down:
+        if(caretLine < lines.size() - 1)
+        {
+            caretColumn = columnAt(caretLine + 1, line.x.at(caretColumn));
+            ++caretLine;
+        }
+        break;
+    case Qt::Key_Home:
+        caretColumn = 0;
+        break;
+    case Qt::Key_End:
+        caretColumn = line.chars.size();
+        break;
+    default:
+        return QRectF();
+    }
+    return before | caretRect();
+}
+
+QRectF TextBlock::bounds() const
+{
+    return linesRect(0, lines.size() - 1) | caretRect();
+}
+
+QRectF TextBlock::caretRect() const
+{
+    const qreal w = qMax<qreal>(2, lineHeight / 16);
+    return QRectF(origin.x() + lines.at(caretLine).x.at(caretColumn) - w / 2, origin.y() + caretLine * lineHeight, w, lineHeight);
+}
+
+void TextBlock::ensureLayout()
+{
+    if(generation == cache->generation())
+    {
+        return;
+    }
+
+    // 字宽不变，重新取字形后位置不变，不需要重绘
+    generation = cache->generation();
+    for(int i = 0; i < lines.size(); ++i)
+    {
+        layoutLine(i, 0);
+    }
+}
+
+void TextBlock::draw(QPainter* p, const QRectF& clip, bool caret) const
+{
+    const int first = qMax(0, int(std::floor((clip.top() - origin.y()) / lineHeight)));
+    const int last = qMin(int(lines.size()) - 1, int(std::floor((clip.bottom() - origin.y()) / lineHeight)));
+    // 字形可能超出字宽，左右各放宽半行高判断是否在裁剪区内
+    const qreal left = clip.left() - origin.x() - lineHeight / 2;
+    const qreal right = clip.right() - origin.x() + lineHeight / 2;
+    bool directPen = false;
+
+    for(int l = first; l <= last; ++l)
+    {
+        const Line& line = lines.at(l);
+        const qreal baseline = origin.y() + l * lineHeight + ascent;
+        auto it = std::upper_bound(line.x.constBegin(), line.x.constEnd(), left);
+        for(int i = qMax(0, int(it - line.x.constBegin()) - 1); i < line.glyphs.size() && line.x.at(i) <= right; ++i)
+        {
+            const GlyphCache::Glyph& g = line.glyphs.at(i);
+            if(g.direct)
+            {
+                // 放不进图集的大字形每次直接绘制
+                if(!directPen)
+                {
+                    p->save();
+                    p->setRenderHint(QPainter::TextAntialiasing);
+                    p->setFont(cache->font(font));
+                    p->setPen(color);
+                    directPen = true;
+                }
+                const char32_t ch = line.chars.at(i);
+                p->drawText(QPointF(origin.x() + line.x.at(i), baseline), QString::fromUcs4(&ch, 1));
+                continue;
+            }
+            if(g.page < 0)
+            {
+                continue;
+            }
+            p->drawImage(QPointF(origin.x() + line.x.at(i) + g.offset.x(), baseline + g.offset.y()), cache->page(g.page), g.source);
+        }
+    }
+
+    if(directPen)
+    {
+        p->restore();
+    }
+
+    if(caret && caretRect().intersects(clip))
+    {
+        p->fillRect(caretRect(), color);
+    }
+}
+
+void TextBlock::commit(Layer* layer) const
+{
+    if(isEmpty())
+    {
+        return;
+    }
+
+    layer->forEachTile(linesRect(0, lines.size() - 1).toAlignedRect(), true, [this](QImage* tile, const QPoint& tileOrigin){
+        QPainter p(tile);
+        p.translate(-tileOrigin);
+        draw(&p, QRectF(tileOrigin, tile->size()), false);
+    });
+}
+
+void TextBlock::layoutLine(int line, int from)
+{
+    Line& l = lines[line];
+    l.glyphs.resize(l.chars.size());
+    l.x.resize(l.chars.size() + 1);
+    for(int i = from; i < l.chars.size(); ++i)
+    {
+        l.glyphs[i] = cache->glyph(font, color, l.chars.at(i));
+        l.x[i + 1] = l.x.at(i) + l.glyphs.at(i).advance;
+    }
+}
+
+QRectF TextBlock::lineRect(int line, qreal fromX, qreal toX) const
+{
+    // 字形的墨迹可能超出字宽，左右留出余量
+    const qreal pad = lineHeight / 4;
+    return QRectF(origin.x() + fromX - pad, origin.y() + line * lineHeight, toX - fromX + 2 * pad, lineHeight);
+}
+
+QRectF TextBlock::linesRect(int from, int to) const
+{
+    const qreal pad = lineHeight / 4;
+    return QRectF(origin.x() - pad, origin.y() + from * lineHeight, width() + 2 * pad, (to - from + 1) * lineHeight);
+}
+
+qreal TextBlock::width() const
+{
+    qreal w = 0;
+    for(const Line& line : lines)
+    {
+        w = qMax(w, line.x.last());
+    }
+    return w;
+}
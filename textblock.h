@@ -0,0 +1,67 @@
+#ifndef TEXTBLOCK_H
+#define TEXTBLOCK_H
+
+#include "glyphcache.h"
+#include "layer.h"
+
+#include <QColor>
+#include <QFont>
+#include <QPointF>
+#include <QVector>
+
+class QPainter;
+
+// 正在编辑的一段多行文字，坐标都是画布坐标
+// 每行保存已经解析好的字形和累计宽度，编辑只重新排版改动的那一行之后的部分，并返回需要重绘的区域
+class TextBlock
+{
+public:
+    TextBlock(GlyphCache* cache, const QFont& font, const QColor& color, const QPointF& origin);
+
+    bool isEmpty() const;
+    QString text() const;
+
+    // 以下编辑操作返回受影响的画布区域
+    QRectF insert(const QString& s);
+    QRectF backspace();
+    QRectF remove();
+    QRectF moveCaret(int key);
+
+    QRectF bounds() const;
+    QRectF caretRect() const;
+
+    // 图集被清空后重新取字形，只能在界面线程调用
+    void ensureLayout();
+    // 只读取已经解析好的字形，可以在合成线程调用
+    void draw(QPainter* p, const QRectF& clip, bool caret) const;
+    // 把文字写入图层瓦片
+    void commit(Layer* layer) const;
+
+private:
+    struct Line{
+        QVector<char32_t> chars;
+        QVector<GlyphCache::Glyph> glyphs;
+        // x[i] 为第 i 个字符的起点，x 比 chars 多一项，最后一项为行宽
+        QVector<qreal> x{0};
+    };
+
+    void layoutLine(int line, int from);
+    QRectF lineRect(int line, qreal fromX, qreal toX) const;
+    QRectF linesRect(int from, int to) const;
+    qreal width() const;
+
+private:
+    GlyphCache* cache;
+    int font;
+    QColor color;
+    QPointF origin;
+    qreal lineHeight;
+    qreal ascent;
+    quint64 generation;
+
+    QVector<Line> lines{Line()};
+    int caretLine = 0;
+    int caretColumn = 0;
+};
+
+#endif // TEXTBLOCK_H
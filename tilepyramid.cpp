@@ -0,0 +1,218 @@
+#include "tilepyramid.h"
+
+#include <QPainter>
+
+#include <cmath>
+
+namespace {
+// 2x2 像素取平均，预乘格式下可以直接对各通道求均值
+void downsample(const QImage& src, QImage* dst, int ox, int oy)
+{
+    const int half = Layer::TILE_SIZE / 2;
+    for(int y = 0; y < half; ++y)
+    {
+        const QRgb* s0 = reinterpret_cast<const QRgb*>(src.constScanLine(2 * y));
+        const QRgb* s1 = reinterpret_cast<const QRgb*>(src.constScanLine(2 * y + 1));
+        QRgb* d = reinterpret_cast<QRgb*>(dst->scanLine(oy + y)) + ox;
+        for(int x = 0; x < half; ++x)
+        {
+            const quint32 a = s0[2 * x];
+            const quint32 b = s0[2 * x + 1];
+            const quint32 c = s1[2 * x];
+            const quint32 e = s1[2 * x + 1];
+            if((a | b | c | e) == 0)
+            {
+                continue;
+            }
+
+            // 两个通道一组同时求和，每组和不超过 10 位，不会互相进位
+            const quint32 rb = (((a & 0xff00ff) + (b & 0xff00ff) + (c & 0xff00ff) + (e & 0xff00ff) + 0x20002) >> 2) & 0xff00ff;
+            const quint32 ag = ((((a >> 8) & 0xff00ff) + ((b >> 8) & 0xff00ff) + ((c >> 8) & 0xff00ff) + ((e >> 8) & 0xff00ff) + 0x20002) >> 2) & 0xff00ff;
+            d[x] = rb | (ag << 8);
+        }
+    }
+}
+
+// 自下而上逐级重建覆盖 r 的瓦片，每级的输入是下一级刚生成的结果
+QVector<Layer::Tiles> buildLevels(const Layer::Tiles& base, QVector<Layer::Tiles> levels, const QRect& r)
+{
+    const int half = Layer::TILE_SIZE / 2;
+    const Layer::Tiles* below = &base;
+    for(int level = 1; level < levels.size(); ++level)
+    {
+        const int span = Layer::TILE_SIZE << level;
+        Layer::Tiles& tiles = levels[level];
+
+        for(int ty = Layer::floorDiv(r.top(), span); ty <= Layer::floorDiv(r.bottom(), span); ++ty)
+        {
+            for(int tx = Layer::floorDiv(r.left(), span); tx <= Layer::floorDiv(r.right(), span); ++tx)
+            {
+                QImage out;
+                for(int i = 0; i < 4; ++i)
+                {
+                    auto it = below->constFind(Layer::tileKey(2 * tx + (i & 1), 2 * ty + (i >> 1)));
+                    if(it == below->constEnd())
+                    {
+                        continue;
+                    }
+
+                    if(out.isNull())
+                    {
+                        out = QImage(Layer::TILE_SIZE, Layer::TILE_SIZE, QImage::Format_ARGB32_Premultiplied);
+                        out.fill(Qt::transparent);
+                    }
+                    downsample(it.value(), &out, (i & 1) * half, (i >> 1) * half);
+                }
+
+                if(out.isNull())
+                {
+                    tiles.remove(Layer::tileKey(tx, ty));
+                }
+                else
+                {
+                    tiles.insert(Layer::tileKey(tx, ty), out);
+                }
+            }
+        }
+        below = &tiles;
+    }
+    return levels;
+}
+}
+
+TilePyramid::TilePyramid(QObject *parent)
+    : QObject{parent}
+    , levels(MAX_LEVEL + 1)
+{
+    // 任务串行执行，结果按提交顺序应用
+    pool.setMaxThreadCount(1);
+    pool.setExpiryTimeout(5000);
+}
+
+TilePyramid::~TilePyramid()
+{
+    pool.clear();
+    pool.waitForDone();
+}
+
+void TilePyramid::update(const Layer::Tiles& base, const QRect& r)
+{
+    if(r.isEmpty())
+    {
+        return;
+    }
+
+    pendingBase = base;
+    pendingRegion += r;
+    if(!running)
+    {
+        startNext();
+    }
+}
+
+void TilePyramid::clear()
+{
+    ++generation;
+    levels = QVector<Layer::Tiles>(MAX_LEVEL + 1);
+    pendingRegion = QRegion();
+    pendingBase = Layer::Tiles();
+    tracker.update(0);
+}
+
+int TilePyramid::levelFor(qreal zoom)
+{
+    if(zoom >= 1)
+    {
+        return 0;
+    }
+    // 选不大于显示尺寸的一级，缩放倍数保持在 (0.5, 1] 之间
+    return qBound(0, int(std::floor(std::log2(1 / zoom))), MAX_LEVEL);
+}
+
+void TilePyramid::draw(QPainter* p, int level, const QRect& canvasRect) const
+{
+    const Layer::Tiles& tiles = levels.at(level);
+    if(tiles.isEmpty())
+    {
+        return;
+    }
+
+    const int span = Layer::TILE_SIZE << level;
+    const int tx0 = Layer::floorDiv(canvasRect.left(), span);
+    const int ty0 = Layer::floorDiv(canvasRect.top(), span);
+    const int tx1 = Layer::floorDiv(canvasRect.right(), span);
+    const int ty1 = Layer::floorDiv(canvasRect.bottom(), span);
+
+    auto drawTile = [p, span](const QPoint& index, const QImage& tile){
+        p->drawImage(QRect(index * span, QSize(span, span)), tile);
+    };
+
+    if(qint64(tx1 - tx0 + 1) * (ty1 - ty0 + 1) > tiles.size())
+    {
+        for(auto it = tiles.constBegin(); it != tiles.constEnd(); ++it)
+        {
+            const QPoint index = Layer::tileIndex(it.key());
+            if(index.x() >= tx0 && index.x() <= tx1 && index.y() >= ty0 && index.y() <= ty1)
+            {
+                drawTile(index, it.value());
+            }
+        }
+        return;
+    }
+
+    for(int ty = ty0; ty <= ty1; ++ty)
+    {
+        for(int tx = tx0; tx <= tx1; ++tx)
+        {
+            auto it = tiles.constFind(Layer::tileKey(tx, ty));
+            if(it != tiles.constEnd())
+            {
+                drawTile(QPoint(tx, ty), it.value());
+            }
+        }
+    }
+}
+
+QRegion TilePyramid::stale() const
+{
+    return running ? pendingRegion.united(runningRect) : pendingRegion;
+}
+
+void TilePyramid::startNext()
+{
+    if(pendingRegion.isEmpty())
+    {
+        return;
+    }
+
+    running = true;
+    runningRect = pendingRegion.boundingRect();
+    pendingRegion = QRegion();
+
+    // 瓦片隐式共享，后台线程写入时各自分离，不影响界面线程
+    Layer::Tiles base = pendingBase;
+    pendingBase = Layer::Tiles();
+    QVector<Layer::Tiles> current = levels;
+    const QRect rect = runningRect;
+    const quint64 gen = generation;
+
+    pool.start([this, base, current, rect, gen](){
+        QVector<Layer::Tiles> result = buildLevels(base, current, rect);
+        QMetaObject::invokeMethod(this, [this, result, rect, gen](){
+            running = false;
+            if(gen == generation)
+            {
+                levels = result;
+
+                qint64 total = 0;
+                for(const Layer::Tiles& tiles : std::as_const(levels))
+                {
+                    total += Layer::bytes(tiles);
+                }
+                tracker.update(total);
+                emit updated(rect);
+            }
+            startNext();
+        }, Qt::QueuedConnection);
+    });
+}
@@ -0,0 +1,51 @@
+#ifndef TILEPYRAMID_H
+#define TILEPYRAMID_H
+
+#include "layer.h"
+
+#include <QObject>
+#include <QRegion>
+#include <QThreadPool>
+#include <QVector>
+
+// 合成结果的多级缩略瓦片，第 L 级每个像素对应画布上 2^L 个像素
+// 笔画提交后在后台线程增量生成，缩小显示时按缩放比例选最接近的一级绘制
+class TilePyramid : public QObject
+{
+    Q_OBJECT
+public:
+    static const int MAX_LEVEL = 7;
+
+    explicit TilePyramid(QObject *parent = nullptr);
+    ~TilePyramid();
+
+    // base 为第 0 级瓦片，只重新生成 r 覆盖的上层瓦片
+    void update(const Layer::Tiles& base, const QRect& r);
+    void clear();
+
+    static int levelFor(qreal zoom);
+    // painter 已经设置好画布到窗口的变换
+    void draw(QPainter* p, int level, const QRect& canvasRect) const;
+    // 已提交但后台尚未生成完的区域，这部分应从第 0 级绘制
+    QRegion stale() const;
+
+signals:
+    void updated(const QRect& r);
+
+private:
+    void startNext();
+
+private:
+    QVector<Layer::Tiles> levels;
+    QThreadPool pool;
+    quint64 generation = 0;
+
+    bool running = false;
+    QRect runningRect;
+    QRegion pendingRegion;
+    Layer::Tiles pendingBase;
+
+    MemoryTracker tracker{MemoryStats::PYRAMID};
+};
+
+#endif // TILEPYRAMID_H
@@ -0,0 +1,358 @@
+#include "timelapse.h"
+#include "trace.h"
+
+#include <QDebug>
+#include <QPainter>
+#include <QThread>
+
+#include <cstring>
+
+namespace {
+// 把瓦片表中 r 覆盖的像素按行紧密排列复制出来，没有瓦片的位置为透明
+QImage copyRect(const Layer::Tiles& tiles, const QRect& r)
+{
+    QImage img(r.size(), QImage::Format_ARGB32_Premultiplied);
+    img.fill(Qt::transparent);
+    if(tiles.isEmpty())
+    {
+        return img;
+    }
+
+    const int size = Layer::TILE_SIZE;
+    for(int ty = Layer::floorDiv(r.top(), size); ty <= Layer::floorDiv(r.bottom(), size); ++ty)
+    {
+        for(int tx = Layer::floorDiv(r.left(), size); tx <= Layer::floorDiv(r.right(), size); ++tx)
+        {
+            auto it = tiles.constFind(Layer::tileKey(tx, ty));
+            if(it == tiles.constEnd())
+            {
+                continue;
+            }
+
+            const QPoint origin(tx * size, ty * size);
+            const QRect part = QRect(origin, QSize(size, size)) & r;
+            for(int y = part.top(); y <= part.bottom(); ++y)
+            {
+                const QRgb* src = reinterpret_cast<const QRgb*>(it.value().constScanLine(y - origin.y())) + (part.left() - origin.x());
+                QRgb* dst = reinterpret_cast<QRgb*>(img.scanLine(y - r.top())) + (part.left() - r.left());
+                std::memcpy(dst, src, size_t(part.width()) * sizeof(QRgb));
+            }
+        }
+    }
+    return img;
+}
+}
+
+TimelapseRecorder::~TimelapseRecorder()
+{
+    stop();
+}
+
+bool TimelapseRecorder::start(const QString& path, const QRect& viewport)
+{
+    stop();
+
+    file.setFileName(path);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qDebug() << "open timelapse file failed" << path;
+        return false;
+    }
+    out.setDevice(&file);
+    out.setVersion(QDataStream::Qt_6_0);
+    out << Timelapse::MAGIC << Timelapse::VERSION << viewport;
+
+    recorded = QRect();
+    previous = Layer::Tiles();
+    stopping = false;
+    counters = Stats();
+    clock.start();
+
+    worker = QThread::create([this](){ run(); });
+    worker->start(QThread::LowPriority);
+    return true;
+}
+
+void TimelapseRecorder::stop()
+{
+    if(!worker)
+    {
+        return;
+    }
+
+    {
+        QMutexLocker lock(&mutex);
+        stopping = true;
+    }
+    wake.wakeAll();
+    worker->wait();
+    delete worker;
+    worker = nullptr;
+
+    out.setDevice(nullptr);
+    file.close();
+    previous = Layer::Tiles();
+
+    if(!verbose)
+    {
+        return;
+    }
+    const Stats s = stats();
+    const int captures = qMax(1, s.frames + s.merged);
+    qDebug() << "timelapse" << file.fileName() << s.frames << "frames" << s.merged << "merged" << s.bytes << "bytes"
+             << "capture avg" << double(s.captureNsecs) / captures / 1000.0 << "us"
+             << "max" << double(s.maxCaptureNsecs) / 1000.0 << "us"
+             << "encode avg" << double(s.encodeNsecs) / qMax(1, s.frames) / 1000000.0 << "ms";
+}
+
+void TimelapseRecorder::setVerbose(bool verbose)
+{
+    this->verbose = verbose;
+}
+
+bool TimelapseRecorder::isRecording() const
+{
+    return worker != nullptr;
+}
+
+QRect TimelapseRecorder::bounds() const
+{
+    return recorded;
+}
+
+void TimelapseRecorder::capture(const Layer::Tiles& tiles, const QRect& r)
+{
+    if(!worker || r.isEmpty())
+    {
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    recorded |= r;
+
+    QMutexLocker lock(&mutex);
+    // 合并后的帧仍然覆盖两次提交之间所有变化的区域，只是少了中间状态
+    if(queue.size() >= MAX_QUEUE)
+    {
+        Frame& last = queue.last();
+        last.msecs = clock.elapsed();
+        last.rect |= r;
+        last.tiles = tiles;
+        ++counters.merged;
+    }
+    else
+    {
+        queue.enqueue(Frame{clock.elapsed(), r, tiles});
+        wake.wakeOne();
+    }
+
+    const qint64 nsecs = timer.nsecsElapsed();
+    counters.captureNsecs += nsecs;
+    counters.maxCaptureNsecs = qMax(counters.maxCaptureNsecs, nsecs);
+}
+
+TimelapseRecorder::Stats TimelapseRecorder::stats() const
+{
+    QMutexLocker lock(&mutex);
+    return counters;
+}
+
+void TimelapseRecorder::run()
+{
+    QMutexLocker lock(&mutex);
+    while(true)
+    {
+        while(queue.isEmpty() && !stopping)
+        {
+            wake.wait(&mutex);
+        }
+        if(queue.isEmpty())
+        {
+            return;
+        }
+
+        const Frame frame = queue.dequeue();
+        lock.unlock();
+
+        QElapsedTimer timer;
+        timer.start();
+        const qint64 before = file.pos();
+        write(frame);
+        const qint64 written = file.pos() - before;
+
+        lock.relock();
+        ++counters.frames;
+        counters.bytes += written;
+        counters.encodeNsecs += timer.nsecsElapsed();
+    }
+}
+
+void TimelapseRecorder::write(const Frame& frame)
+{
+    TRACE_SCOPE("Timelapse::write");
+    // 合并后的帧可能覆盖很大的范围，按瓦片逐块编码，不需要整块的图像
+    const int size = Layer::TILE_SIZE;
+    const QRect& r = frame.rect;
+    for(int ty = Layer::floorDiv(r.top(), size); ty <= Layer::floorDiv(r.bottom(), size); ++ty)
+    {
+        for(int tx = Layer::floorDiv(r.left(), size); tx <= Layer::floorDiv(r.right(), size); ++tx)
+        {
+            // 两帧共享的瓦片和两边都没有的瓦片没有变化
+            const quint32 key = Layer::tileKey(tx, ty);
+            auto now = frame.tiles.constFind(key);
+            auto before = previous.constFind(key);
+            const bool hasNow = now != frame.tiles.constEnd();
+            const bool hasBefore = before != previous.constEnd();
+            if(hasNow ? (hasBefore && now->constBits() == before->constBits()) : !hasBefore)
+            {
+                continue;
+            }
+
+            // 与上一帧异或，没有变化的像素为 0，压缩后几乎不占空间
+            const QRect part = QRect(QPoint(tx * size, ty * size), QSize(size, size)) & r;
+            QImage pixels = copyRect(frame.tiles, part);
+            const QImage reference = copyRect(previous, part);
+            quint32* dst = reinterpret_cast<quint32*>(pixels.bits());
+            const quint32* src = reinterpret_cast<const quint32*>(reference.constBits());
+            const qsizetype count = pixels.sizeInBytes() / qsizetype(sizeof(quint32));
+            quint32 diff = 0;
+            for(qsizetype i = 0; i < count; ++i)
+            {
+                dst[i] ^= src[i];
+                diff |= dst[i];
+            }
+            if(diff == 0)
+            {
+                continue;
+            }
+
+            out << frame.msecs << part << qCompress(pixels.constBits(), int(pixels.sizeInBytes()), 1);
+        }
+    }
+    previous = frame.tiles;
+}
+
+TimelapsePlayer::TimelapsePlayer()
+    :canvas(QSize(), MemoryStats::TIMELAPSE)
+{}
+
+bool TimelapsePlayer::open(const QString& path)
+{
+    file.close();
+    file.setFileName(path);
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+    in.setDevice(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+
+    quint32 magic = 0;
+    quint16 version = 0;
+    in >> magic >> version >> view;
+    if(in.status() != QDataStream::Ok || magic != Timelapse::MAGIC || version != Timelapse::VERSION)
+    {
+        file.close();
+        return false;
+    }
+
+    canvas.clear();
+    canvas.resize(view.size());
+    msecs = 0;
+    hasPending = false;
+    return true;
+}
+
+QRect TimelapsePlayer::viewport() const
+{
+    return view;
+}
+
+bool TimelapsePlayer::next()
+{
+    Record record;
+    if(hasPending)
+    {
+        record = pending;
+        hasPending = false;
+    }
+    else if(!read(&record))
+    {
+        return false;
+    }
+    if(!apply(record))
+    {
+        return false;
+    }
+
+    // 同一帧拆成的其余记录一起应用，读到下一帧时留到下次
+    Record more;
+    while(read(&more))
+    {
+        if(more.msecs != record.msecs)
+        {
+            pending = more;
+            hasPending = true;
+            break;
+        }
+        if(!apply(more))
+        {
+            break;
+        }
+    }
+
+    msecs = record.msecs;
+    return true;
+}
+
+bool TimelapsePlayer::read(Record* record)
+{
+    if(!file.isOpen() || in.atEnd())
+    {
+        return false;
+    }
+
+    in >> record->msecs >> record->rect >> record->payload;
+    return in.status() == QDataStream::Ok;
+}
+
+bool TimelapsePlayer::apply(const Record& record)
+{
+    const QRect& r = record.rect;
+    const QByteArray raw = qUncompress(record.payload);
+    if(r.isEmpty() || raw.size() != qsizetype(r.width()) * r.height() * qsizetype(sizeof(quint32)))
+    {
+        return false;
+    }
+
+    const quint32* delta = reinterpret_cast<const quint32*>(raw.constData());
+    canvas.forEachTile(r, true, [&r, delta](QImage* tile, const QPoint& origin){
+        const QRect part = QRect(origin, tile->size()) & r;
+        for(int y = part.top(); y <= part.bottom(); ++y)
+        {
+            quint32* dst = reinterpret_cast<quint32*>(tile->scanLine(y - origin.y())) + (part.left() - origin.x());
+            const quint32* src = delta + qsizetype(y - r.top()) * r.width() + (part.left() - r.left());
+            for(int x = 0; x < part.width(); ++x)
+            {
+                dst[x] ^= src[x];
+            }
+        }
+    });
+    return true;
+}
+
+qint64 TimelapsePlayer::timestamp() const
+{
+    return msecs;
+}
+
+QImage TimelapsePlayer::frame() const
+{
+    QImage img(view.size(), QImage::Format_ARGB32_Premultiplied);
+    img.fill(Qt::transparent);
+    QPainter p(&img);
+    p.translate(-view.topLeft());
+    canvas.draw(&p, view);
+    return img;
+}
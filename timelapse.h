@@ -0,0 +1,119 @@
+#ifndef TIMELAPSE_H
+#define TIMELAPSE_H
+
+#include "layer.h"
+
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutex>
+#include <QQueue>
+#include <QRect>
+#include <QWaitCondition>
+
+class QThread;
+
+// 延时录像文件：文件头记录开始时的视口，之后每条记录为时间戳、画布矩形和该矩形内与上一帧异或后压缩的像素
+// 一帧按瓦片拆成多条时间戳相同的记录，没有变化的瓦片不写
+namespace Timelapse {
+    const quint32 MAGIC = 0x4442544c;
+    const quint16 VERSION = 1;
+    const QString SUFFIX = "dbtl";
+}
+
+// 笔画提交后记录合成结果中变化的区域，编码和写盘都在后台线程完成
+class TimelapseRecorder
+{
+public:
+    // 队列满时新的区域并入最后一帧，界面线程不等待磁盘
+    static const int MAX_QUEUE = 32;
+
+    struct Stats{
+        int frames = 0;
+        int merged = 0;
+        qint64 bytes = 0;
+        qint64 captureNsecs = 0;
+        qint64 maxCaptureNsecs = 0;
+        qint64 encodeNsecs = 0;
+    };
+
+    TimelapseRecorder() = default;
+    ~TimelapseRecorder();
+
+    // viewport 为播放时显示的画布范围
+    bool start(const QString& path, const QRect& viewport);
+    // 写完队列中剩余的帧后关闭文件
+    void stop();
+    // 停止时打印帧数、大小和耗时
+    void setVerbose(bool verbose);
+    bool isRecording() const;
+    // 已记录区域的外接矩形，清空整个画布时用来覆盖旧内容
+    QRect bounds() const;
+
+    // tiles 为合成结果，只复制隐式共享的瓦片表
+    void capture(const Layer::Tiles& tiles, const QRect& r);
+    Stats stats() const;
+
+private:
+    struct Frame{
+        qint64 msecs;
+        QRect rect;
+        Layer::Tiles tiles;
+    };
+
+    void run();
+    void write(const Frame& frame);
+
+private:
+    QThread* worker = nullptr;
+    QFile file;
+    QDataStream out;
+    QElapsedTimer clock;
+    QRect recorded;
+    // 只在后台线程访问，作为异或的参考
+    Layer::Tiles previous;
+
+    mutable QMutex mutex;
+    QWaitCondition wake;
+    QQueue<Frame> queue;
+    bool stopping = false;
+    Stats counters;
+    bool verbose = false;
+};
+
+// 逐帧重建录像内容
+class TimelapsePlayer
+{
+public:
+    TimelapsePlayer();
+
+    bool open(const QString& path);
+    QRect viewport() const;
+    // 读取并应用下一帧，时间戳相同的记录属于同一帧；文件结束或损坏时返回 false
+    bool next();
+    qint64 timestamp() const;
+    // 当前视口内的画面
+    QImage frame() const;
+
+private:
+    struct Record{
+        qint64 msecs = 0;
+        QRect rect;
+        QByteArray payload;
+    };
+
+    bool read(Record* record);
+    bool apply(const Record& record);
+
+private:
+    QFile file;
+    QDataStream in;
+    QRect view;
+    qint64 msecs = 0;
+    Layer canvas;
+    // 预读的下一帧的第一条记录
+    Record pending;
+    bool hasPending = false;
+};
+
+#endif // TIMELAPSE_H
@@ -0,0 +1,74 @@
+#include "timelapseview.h"
+
+#include "config.h"
+#include "dbapplication.h"
+
+#include <QFileInfo>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QTimer>
+
+TimelapseView::TimelapseView(QWidget *parent)
+    : QWidget{parent}
+{
+    DBApplication* app = static_cast<DBApplication*>(qApp);
+    ConfigHandle* handle = app->getSingleton<Config>()->getConfigHandle(Config::INTERNAL);
+
+    timer = new QTimer(this);
+    timer->setInterval(qMax(1, handle->getInt("timelapse.frame.interval")));
+    connect(timer, &QTimer::timeout, this, &TimelapseView::step);
+}
+
+bool TimelapseView::open(const QString& path)
+{
+    timer->stop();
+    if(!player.open(path))
+    {
+        return false;
+    }
+
+    filePath = path;
+    current = player.frame();
+    this->setWindowTitle(tr("timelapse.title").arg(QFileInfo(path).fileName()));
+    this->resize(player.viewport().size().scaled(800, 600, Qt::KeepAspectRatio));
+    timer->start();
+    return true;
+}
+
+void TimelapseView::paintEvent(QPaintEvent* event)
+{
+    Q_UNUSED(event)
+    QPainter p(this);
+    p.fillRect(this->rect(), Qt::darkGray);
+    if(current.isNull())
+    {
+        return;
+    }
+
+    // 保持比例居中显示
+    QRect target(QPoint(), current.size().scaled(this->size(), Qt::KeepAspectRatio));
+    target.moveCenter(this->rect().center());
+    p.setRenderHint(QPainter::SmoothPixmapTransform);
+    p.drawImage(target, current);
+}
+
+void TimelapseView::mouseReleaseEvent(QMouseEvent* event)
+{
+    // 播放结束后单击从头开始
+    event->accept();
+    if(!timer->isActive() && !filePath.isEmpty())
+    {
+        open(filePath);
+    }
+}
+
+void TimelapseView::step()
+{
+    if(!player.next())
+    {
+        timer->stop();
+        return;
+    }
+    current = player.frame();
+    this->update();
+}
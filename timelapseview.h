@@ -0,0 +1,34 @@
+#ifndef TIMELAPSEVIEW_H
+#define TIMELAPSEVIEW_H
+
+#include "timelapse.h"
+
+#include <QImage>
+#include <QWidget>
+
+class QTimer;
+
+// 按固定间隔逐帧播放延时录像，每次提交为一帧，播放结束后停在最后一帧
+class TimelapseView : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit TimelapseView(QWidget *parent = nullptr);
+
+    bool open(const QString& path);
+
+protected:
+    virtual void paintEvent(QPaintEvent* event) override;
+    virtual void mouseReleaseEvent(QMouseEvent* event) override;
+
+private:
+    void step();
+
+private:
+    QString filePath;
+    TimelapsePlayer player;
+    QImage current;
+    QTimer* timer = nullptr;
+};
+
+#endif // TIMELAPSEVIEW_H
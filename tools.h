@@ -1,6 +1,8 @@
 #ifndef TOOLS_H
 #define TOOLS_H
 
+#include "memorystats.h"
+
 #include <functional>
 #include <QMargins>
 #include <QUndoStack>
@@ -18,9 +20,12 @@ namespace TOOLS {
             :u(undo),r(redo){}
         virtual void undo() override{ if(u) u();}
         virtual void redo() override{ if(r) r();}
+        // 闭包中捕获的图像字节数，命令销毁时归还
+        void setMemoryCost(qint64 bytes){ tracker.update(bytes);}
     private:
         std::function<void ()> u = nullptr;
         std::function<void ()> r = nullptr;
+        MemoryTracker tracker{MemoryStats::UNDO};
     };
     UndoRedoCommand* createUndoRedoCommand(std::function<void(void)> undo, std::function<void(void)> redo);
 }
@@ -0,0 +1,227 @@
+#include "trace.h"
+
+#include <QAtomicInteger>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QList>
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+
+namespace {
+struct Event{
+    const char* name;
+    const char* argName;
+    qint64 arg;
+    qint64 begin;
+    qint64 end;
+};
+
+// 只有所属线程写入，head 之前的 capacity 条有效
+struct Buffer{
+    QVector<Event> events;
+    quint64 mask = 0;
+    QAtomicInteger<quint64> head = 0;
+    int tid = 0;
+    QByteArray threadName;
+};
+
+// 线程退出后缓冲仍然保留，导出时还能看到它的记录
+struct Registry{
+    QMutex mutex;
+    QList<Buffer*> buffers;
+    int capacity = 0;
+    QElapsedTimer clock;
+
+    ~Registry()
+    {
+        qDeleteAll(buffers);
+    }
+};
+
+Registry registry;
+QAtomicInt enabled = 0;
+thread_local Buffer* current = nullptr;
+
+Buffer* currentBuffer()
+{
+    if(current)
+    {
+        return current;
+    }
+
+    QMutexLocker lock(&registry.mutex);
+    if(registry.capacity == 0)
+    {
+        return nullptr;
+    }
+    Buffer* buffer = new Buffer;
+    buffer->events.resize(registry.capacity);
+    buffer->mask = quint64(registry.capacity - 1);
+    buffer->tid = registry.buffers.size() + 1;
+    QThread* thread = QThread::currentThread();
+    if(QCoreApplication::instance() && thread == QCoreApplication::instance()->thread())
+    {
+        buffer->threadName = "main";
+    }
+    else
+    {
+        buffer->threadName = thread->objectName().toUtf8();
+        if(buffer->threadName.isEmpty())
+        {
+            buffer->threadName = "thread " + QByteArray::number(buffer->tid);
+        }
+    }
+    registry.buffers.append(buffer);
+    current = buffer;
+    return buffer;
+}
+
+void appendEscaped(QByteArray* out, const QByteArray& s)
+{
+    for(char c : s)
+    {
+        if(c == '"' || c == '\\')
+        {
+            out->append('\\');
+        }
+        out->append(c);
+    }
+}
+}
+
+namespace Trace {
+
+void start(int capacity)
+{
+    {
+        QMutexLocker lock(&registry.mutex);
+        if(registry.capacity == 0)
+        {
+            // 按 2 的幂取整，写入位置用掩码回绕
+            int size = 1;
+            while(size < capacity)
+            {
+                size <<= 1;
+            }
+            registry.capacity = size;
+            registry.clock.start();
+        }
+    }
+    // 当前线程提前登记，第一次记录时不再分配
+    currentBuffer();
+    enabled.storeRelease(1);
+}
+
+void stop()
+{
+    enabled.storeRelease(0);
+}
+
+bool isEnabled()
+{
+    return enabled.loadRelaxed() != 0;
+}
+
+qint64 now()
+{
+    return registry.clock.nsecsElapsed();
+}
+
+void record(const char* name, qint64 begin, qint64 end, const char* argName, qint64 arg)
+{
+    Buffer* buffer = currentBuffer();
+    if(!buffer)
+    {
+        return;
+    }
+
+    const quint64 index = buffer->head.loadRelaxed();
+    Event& e = buffer->events.data()[index & buffer->mask];
+    e.name = name;
+    e.argName = argName;
+    e.arg = arg;
+    e.begin = begin;
+    e.end = end;
+    buffer->head.storeRelease(index + 1);
+}
+
+bool dump(const QString& filePath)
+{
+    QFile file(filePath);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qDebug() << "trace dump failed" << filePath << file.errorString();
+        return false;
+    }
+
+    QMutexLocker lock(&registry.mutex);
+    const QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+    QByteArray out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    auto separate = [&](){
+        if(!first)
+        {
+            out += ",\n";
+        }
+        first = false;
+    };
+
+    qint64 count = 0;
+    QVector<Event> snapshot;
+    for(const Buffer* buffer : std::as_const(registry.buffers))
+    {
+        const QByteArray tid = QByteArray::number(buffer->tid);
+        separate();
+        out += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + pid + ",\"tid\":" + tid + ",\"args\":{\"name\":\"";
+        appendEscaped(&out, buffer->threadName);
+        out += "\"}}";
+
+        // 先复制再检查写入位置，复制期间被所属线程覆盖的记录不可信
+        const quint64 capacity = buffer->mask + 1;
+        const quint64 end = buffer->head.loadAcquire();
+        const quint64 begin = end > capacity ? end - capacity : 0;
+        snapshot.resize(int(end - begin));
+        for(quint64 i = begin; i < end; ++i)
+        {
+            snapshot[int(i - begin)] = buffer->events.at(int(i & buffer->mask));
+        }
+        // 所属线程可能正在写 after 所在的槽位，它在复制时也可能被覆盖
+        const quint64 after = buffer->head.loadAcquire();
+        const quint64 valid = after + 1 > capacity ? after + 1 - capacity : 0;
+
+        for(quint64 i = qMax(begin, valid); i < end; ++i)
+        {
+            const Event& e = snapshot.at(int(i - begin));
+            separate();
+            out += "{\"name\":\"";
+            out += e.name;
+            out += "\",\"ph\":\"X\",\"pid\":" + pid + ",\"tid\":" + tid;
+            out += ",\"ts\":" + QByteArray::number(double(e.begin) / 1000, 'f', 3);
+            out += ",\"dur\":" + QByteArray::number(double(e.end - e.begin) / 1000, 'f', 3);
+            if(e.argName)
+            {
+                out += ",\"args\":{\"";
+                out += e.argName;
+                out += "\":" + QByteArray::number(e.arg) + "}";
+            }
+            out += "}";
+            ++count;
+        }
+
+        if(out.size() > (1 << 20))
+        {
+            file.write(out);
+            out.clear();
+        }
+    }
+    out += "\n]}\n";
+    file.write(out);
+
+    qDebug() << "trace dumped" << count << "events from" << registry.buffers.size() << "threads to" << filePath;
+    return file.error() == QFileDevice::NoError;
+}
+
+}
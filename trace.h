@@ -0,0 +1,49 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QString>
+#include <QtGlobal>
+
+// 性能追踪，导出为 Chrome trace 格式，可在 chrome://tracing 或 Perfetto 中查看
+// 每个线程写自己的环形缓冲，记录时不加锁也不分配，缓冲满后覆盖最早的记录
+// 名称和参数名必须是字符串字面量，导出时才读取
+namespace Trace {
+    // 每个线程保留最近 capacity 条记录，只在第一次开始时生效
+    void start(int capacity);
+    void stop();
+    bool isEnabled();
+    // 纳秒，从第一次开始记录时算起
+    qint64 now();
+    void record(const char* name, qint64 begin, qint64 end, const char* argName = nullptr, qint64 arg = 0);
+    // 导出时各线程可以继续记录，导出期间被覆盖的记录丢弃
+    bool dump(const QString& filePath);
+}
+
+class TraceScope
+{
+public:
+    explicit TraceScope(const char* name, const char* argName = nullptr, qint64 arg = 0)
+        :name(name)
+        ,argName(argName)
+        ,arg(arg)
+        ,begin(Trace::isEnabled() ? Trace::now() : -1)
+    {}
+    ~TraceScope()
+    {
+        if(begin >= 0)
+        {
+            Trace::record(name, begin, Trace::now(), argName, arg);
+        }
+    }
+
+private:
+    const char* name;
+    const char* argName;
+    qint64 arg;
+    qint64 begin;
+};
+
+#define TRACE_SCOPE(name) TraceScope traceScope_(name)
+#define TRACE_SCOPE_ARG(name, argName, arg) TraceScope traceScope_(name, argName, qint64(arg))
+
+#endif // TRACE_H
@@ -1,10 +1,16 @@
 #include "trayicon.h"
 
 #include "board.h"
+#include "config.h"
+#include "controlserver.h"
+#include "dbapplication.h"
 #include "preview.h"
 #include "settingview.h"
+#include "timelapseview.h"
 
 #include <QApplication>
+#include <QDateTime>
+#include <QFileDialog>
 #include <QKeyEvent>
 #include <QMenu>
 #include <QPropertyAnimation>
@@ -22,12 +28,27 @@ TrayIcon::TrayIcon(QObject *parent)
     connect(drawAction, &QAction::triggered, this, &TrayIcon::draw);
     QAction* preferenceAction = menu->addAction(tr("menu.action.text.preference"), QKeySequence::Preferences);
     connect(preferenceAction, &QAction::triggered, this, &TrayIcon::showPreference);
+    recordAction = menu->addAction(tr("menu.action.text.record"));
+    recordAction->setCheckable(true);
+    connect(recordAction, &QAction::toggled, this, &TrayIcon::setRecording);
+    QAction* playAction = menu->addAction(tr("menu.action.text.play"));
+    connect(playAction, &QAction::triggered, this, &TrayIcon::playTimelapse);
     menu->addSeparator();
     menu->addAction(tr("menu.action.text.quit"), QKeySequence::Quit, [](){
         qApp->quit();
     });
 
     this->setContextMenu(menu);
+
+    // 配置了套接字名时接受本地脚本控制
+    ConfigHandle* handle = static_cast<DBApplication*>(qApp)->getSingleton<Config>()->getConfigHandle(Config::INTERNAL);
+    const QString controlName = handle->getString("control.name");
+    if(!controlName.isEmpty())
+    {
+        controlServer = new ControlServer(this);
+        connect(controlServer, &ControlServer::openRequested, this, &TrayIcon::draw);
+        controlServer->listen(controlName);
+    }
 }
 
 bool TrayIcon::eventFilter(QObject* watched, QEvent* event)
@@ -70,7 +91,15 @@ void TrayIcon::draw()
 #else
     pBoard = new Board(nullptr, Qt::FramelessWindowHint | Qt::WindowStaysOnTopHint);
 #endif
-    connect(pBoard, &Board::destroyed, this, [this](){pBoard = nullptr;});
+    // 画板关闭时录像随之结束
+    connect(pBoard, &Board::destroyed, this, [this](){
+        pBoard = nullptr;
+        recordAction->setChecked(false);
+    });
+    if(controlServer)
+    {
+        controlServer->setBoard(pBoard);
+    }
 
     pBoard->setAttribute(Qt::WA_DeleteOnClose, true);
     pBoard->setAttribute(Qt::WA_TranslucentBackground, true);
@@ -105,3 +134,61 @@ void TrayIcon::showPreference()
         }
     });
 }
+
+void TrayIcon::setRecording(bool on)
+{
+    if(!on)
+    {
+        if(pBoard)
+        {
+            pBoard->stopRecording();
+        }
+        return;
+    }
+    if(pBoard && pBoard->isRecording())
+    {
+        return;
+    }
+
+    if(!pBoard)
+    {
+        draw();
+    }
+    if(!pBoard)
+    {
+        recordAction->setChecked(false);
+        return;
+    }
+
+    DBApplication* app = static_cast<DBApplication*>(qApp);
+    ConfigHandle* handle = app->getSingleton<Config>()->getConfigHandle(Config::INTERNAL);
+    const QString path = handle->getString("dir.download")
+            + "/"
+            + app->applicationName() + "-" + QDateTime::currentDateTime().toString("yyyy-MM-dd-hh-mm-ss") + "." + Timelapse::SUFFIX;
+    if(!pBoard->startRecording(path))
+    {
+        recordAction->setChecked(false);
+    }
+}
+
+void TrayIcon::playTimelapse()
+{
+    DBApplication* app = static_cast<DBApplication*>(qApp);
+    ConfigHandle* handle = app->getSingleton<Config>()->getConfigHandle(Config::INTERNAL);
+    const QString path = QFileDialog::getOpenFileName(nullptr, tr("menu.action.text.play"), handle->getString("dir.download"),
+                                                      QString("*.%1").arg(Timelapse::SUFFIX));
+    if(path.isEmpty())
+    {
+        return;
+    }
+
+    TimelapseView* view = new TimelapseView;
+    view->setAttribute(Qt::WA_DeleteOnClose, true);
+    view->setWindowFlag(Qt::WindowStaysOnTopHint);
+    if(!view->open(path))
+    {
+        delete view;
+        return;
+    }
+    view->show();
+}
@@ -3,7 +3,10 @@
 
 #include <QSystemTrayIcon>
 
+class QAction;
+
 class Board;
+class ControlServer;
 class SettingView;
 
 class TrayIcon : public QSystemTrayIcon
@@ -17,10 +20,14 @@ protected:
 public slots:
     void draw();
     void showPreference();
+    void setRecording(bool on);
+    void playTimelapse();
 
 private:
     Board* pBoard = nullptr;
     SettingView* pSettingView = nullptr;
+    QAction* recordAction = nullptr;
+    ControlServer* controlServer = nullptr;
 };
 
 #endif // TRAYICON_H